@@ -0,0 +1,409 @@
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+#define _POSIX_C_SOURCE 200819L
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+
+#include <getopt.h>
+#include <sys/resource.h>
+
+#define IO_IMPLEMENTATION
+#define IO_STATIC
+#include "io.h"
+
+#include "trie.h"
+
+/*
+ * A benchmark driver for the trie library. It builds a trie from a word list,
+ * or from a synthetic one generated from a seed, then times prefix lookups
+ * and completions, and writes the results as one JSON object on stdout, so
+ * that runs can be compared over time. Runs with the same arguments on the
+ * same host are comparable; the corpora and queries are the same every time.
+ */
+
+#define PROGRAM_NAME     "trie-bench"
+#define DEFAULT_QUERIES  (1024 * 200)
+#define DEFAULT_SEED     UINT64_C(42)
+#define TOP_K            10
+
+/* Lookup latencies are also counted in power-of-two buckets of nanoseconds. */
+#define HIST_BUCKETS     24
+
+typedef struct {
+    bool radix;
+    bool minimize;
+    bool relayout;
+    bool freeze;
+    size_t synthetic;           /* Generate this many keys, if non-zero. */
+    size_t queries;
+    uint64_t seed;
+    const char *path;
+} BenchOptions;
+
+static void usage_err(void)
+{
+    fprintf(stderr, "Usage: " PROGRAM_NAME " [-rmRD] [-q QUERIES] [-s SEED] "
+        "(-g KEYS | FILE)\n");
+    exit(EXIT_FAILURE);
+}
+
+static size_t parse_count(const char *arg)
+{
+    char *end = NULL;
+
+    errno = 0;
+    const unsigned long long n = strtoull(arg, &end, 10);
+
+    if (errno || end == arg || *end != '\0' || *arg == '-' || n == 0
+        || n > SIZE_MAX) {
+        fprintf(stderr, "Error: %s is not a positive integer.\n", arg);
+        usage_err();
+    }
+    return (size_t) n;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+/* xorshift64*, so that corpora and queries do not depend on the libc. */
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+/* Returns `nkeys` lines of syllable soup, some with a weight. Keys are drawn
+ * from a small set of syllables, so that they share prefixes and suffixes
+ * about as much as words of a natural language do.
+ */
+static char *generate_corpus(size_t nkeys, uint64_t seed, size_t *nbytes)
+{
+    static const char *const syllables[] = {
+        "a", "an", "ar", "be", "ca", "co", "de", "di", "el", "en", "er", "es",
+        "fa", "ge", "in", "is", "ka", "la", "le", "li", "ma", "me", "mi", "mo",
+        "na", "ne", "no", "on", "or", "pa", "pe", "po", "ra", "re", "ri", "ro",
+        "sa", "se", "si", "so", "ta", "te", "ti", "to", "un", "ur", "va", "ve",
+        "ing", "tion", "ment", "ness", "able", "_", "x", "q",
+    };
+    const size_t nsyllables = sizeof syllables / sizeof *syllables;
+    /* Six syllables of at most four bytes, a weight, a tab and a newline. */
+    const size_t max_line = 6 * 4 + 12 + 2;
+    char *const corpus = malloc(nkeys * max_line + 1);
+    uint64_t state = seed ? seed : DEFAULT_SEED;
+    size_t len = 0;
+
+    if (corpus == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nkeys; ++i) {
+        const size_t count = 1 + (size_t) (next_random(&state) % 6);
+
+        for (size_t j = 0; j < count; ++j) {
+            /* Squaring skews the draw towards the first syllables. */
+            const uint64_t r = next_random(&state) % nsyllables;
+            const char *const s = syllables[r * r / nsyllables];
+            const size_t slen = strlen(s);
+
+            memcpy(corpus + len, s, slen);
+            len += slen;
+        }
+
+        if (next_random(&state) % 2) {
+            len += (size_t) sprintf(corpus + len, "\t%" PRIu64,
+                                    next_random(&state) % 100000);
+        }
+        corpus[len++] = '\n';
+    }
+
+    corpus[len] = '\0';
+    *nbytes = len;
+    return corpus;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static bool count_key(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    (void) key;
+    (void) len;
+    (void) weight;
+    ++*(size_t *) ctx;
+    return true;
+}
+
+static void parse_options(int argc, char **argv, BenchOptions *opts)
+{
+    int c = 0;
+
+    while ((c = getopt(argc, argv, "rmRDg:q:s:")) != -1) {
+        switch (c) {
+            case 'r':
+                opts->radix = true;
+                break;
+            case 'm':
+                opts->minimize = true;
+                break;
+            case 'R':
+                opts->relayout = true;
+                break;
+            case 'D':
+                opts->freeze = true;
+                break;
+            case 'g':
+                opts->synthetic = parse_count(optarg);
+                break;
+            case 'q':
+                opts->queries = parse_count(optarg);
+                break;
+            case 's':
+                opts->seed = (uint64_t) parse_count(optarg);
+                break;
+            default:
+                usage_err();
+        }
+    }
+
+    if ((optind + 1 == argc) == (opts->synthetic != 0)) {
+        usage_err();
+    }
+
+    opts->path = optind < argc ? argv[optind] : NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions opts = { .queries = DEFAULT_QUERIES, .seed = DEFAULT_SEED };
+
+    parse_options(argc, argv, &opts);
+
+    size_t nbytes = 0;
+    char *corpus = NULL;
+
+    if (opts.synthetic) {
+        corpus = generate_corpus(opts.synthetic, opts.seed, &nbytes);
+    } else {
+        FILE *const stream = fopen(opts.path, "rb");
+
+        if (stream == NULL) {
+            perror(opts.path);
+            return EXIT_FAILURE;
+        }
+
+        corpus = io_read_file(stream, &nbytes);
+        fclose(stream);
+
+        if (corpus == NULL) {
+            perror("fread()");
+        }
+    }
+
+    if (corpus == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    /* The build goes through the same streaming path as the command-line
+     * tool, from a stream on the corpus in memory, so that disk reads are not
+     * timed.
+     */
+    FILE *const stream = fmemopen(corpus, nbytes ? nbytes : 1, "r");
+    trie_t *const trie = trie_create(opts.radix ? TRIE_RADIX : 0);
+    size_t nlines = 0;
+
+    if (stream == NULL || trie == NULL) {
+        perror("fmemopen()");
+        return EXIT_FAILURE;
+    }
+
+    const double build_start = now();
+
+    if (!trie_insert_stream(trie, stream, &nlines, NULL)) {
+        return EXIT_FAILURE;
+    }
+
+    trie_shrink_to_fit(trie);
+
+    if ((opts.minimize && !trie_minimize(trie))
+        || (opts.relayout && !trie_relayout(trie))
+        || (opts.freeze && !trie_freeze(trie))) {
+        return EXIT_FAILURE;
+    }
+
+    const double build_time = now() - build_start;
+
+    fclose(stream);
+
+    /* The queries are prefixes of keys of the corpus, of random lengths. */
+    size_t nkeys = 0;
+    char **const keys = io_split_lines(corpus, &nkeys);
+    char **const queries = malloc(sizeof *queries * opts.queries);
+    double *const latencies = malloc(sizeof *latencies * opts.queries);
+    trie_cursor_t *const cur = trie_cursor_create(trie);
+    uint64_t state = opts.seed;
+
+    if (nkeys == 0) {
+        fputs("Error: the corpus holds no keys.\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (keys == NULL || queries == NULL || latencies == NULL || cur == NULL) {
+        perror("malloc()");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < opts.queries; ++i) {
+        char *const key = keys[next_random(&state) % nkeys];
+        const size_t len = strcspn(key, "\t\r");
+
+        queries[i] = malloc(len + 1);
+
+        if (queries[i] == NULL) {
+            perror("malloc()");
+            return EXIT_FAILURE;
+        }
+
+        const size_t prefix_len = len ? 1 + (size_t) (next_random(&state) % len) : 0;
+
+        memcpy(queries[i], key, prefix_len);
+        queries[i][prefix_len] = '\0';
+    }
+
+    size_t hist[HIST_BUCKETS] = { 0 };
+    size_t found = 0;
+    double total = 0.0;
+
+    for (size_t i = 0; i < opts.queries; ++i) {
+        /* Every lookup descends from the root, as a lookup at random would. */
+        trie_find_prefix(cur, "");
+
+        const double start = now();
+
+        found += trie_find_prefix(cur, queries[i]);
+
+        const double ns = (now() - start) * 1e9;
+        size_t bucket = 0;
+
+        while (bucket + 1 < HIST_BUCKETS && ns >= (double) ((size_t) 2 << bucket)) {
+            ++bucket;
+        }
+
+        ++hist[bucket];
+        latencies[i] = ns;
+        total += ns;
+    }
+
+    qsort(latencies, opts.queries, sizeof *latencies, compare_doubles);
+
+    /* The same lookups back to back, one at a time, then TRIE_FIND_BATCH at a
+     * time, on as many cursors.
+     */
+    trie_cursor_t *batch[TRIE_FIND_BATCH];
+
+    for (size_t i = 0; i < TRIE_FIND_BATCH; ++i) {
+        if ((batch[i] = trie_cursor_create(trie)) == NULL) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    const double serial_start = now();
+
+    for (size_t i = 0; i < opts.queries; ++i) {
+        trie_find_prefix(batch[i % TRIE_FIND_BATCH], queries[i]);
+    }
+
+    const double serial_time = now() - serial_start;
+    const double batch_start = now();
+
+    for (size_t i = 0; i < opts.queries; i += TRIE_FIND_BATCH) {
+        const size_t n = opts.queries - i < TRIE_FIND_BATCH
+                       ? opts.queries - i : TRIE_FIND_BATCH;
+
+        trie_find_prefixes(batch, (const char *const *) queries + i, n, NULL);
+    }
+
+    const double batch_time = now() - batch_start;
+
+    size_t enumerated = 0;
+    const double enum_start = now();
+
+    trie_find_prefix(cur, "");
+
+    if (!trie_complete(cur, 0, count_key, &enumerated)) {
+        return EXIT_FAILURE;
+    }
+
+    const double enum_time = now() - enum_start;
+    size_t top_emitted = 0;
+    const double top_start = now();
+
+    for (size_t i = 0; i < opts.queries; ++i) {
+        if (trie_find_prefix(cur, queries[i])
+            && !trie_complete(cur, TOP_K, count_key, &top_emitted)) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    const double top_time = now() - top_start;
+    trie_stats_t st;
+    struct rusage usage;
+
+    trie_get_stats(trie, &st);
+    getrusage(RUSAGE_SELF, &usage);
+
+    const size_t q = opts.queries;
+
+    printf("{\"corpus\":\"%s\",\"seed\":%" PRIu64 ",\"radix\":%s,"
+        "\"minimized\":%s,\"relayout\":%s,\"double_array\":%s,"
+        "\"lines\":%zu,\"keys\":%zu,\"bytes\":%zu,\"nodes\":%zu,"
+        "\"build_s\":%.6f,\"keys_per_s\":%.0f,\"bytes_per_s\":%.0f,"
+        "\"peak_rss_kib\":%ld,\"bytes_per_key\":%.2f,"
+        "\"queries\":%zu,\"found\":%zu,"
+        "\"lookup_ns\":{\"mean\":%.1f,\"p50\":%.0f,\"p99\":%.0f,\"p999\":%.0f},"
+        "\"lookup_hist_ns\":[",
+        opts.synthetic ? "synthetic" : opts.path, opts.seed,
+        opts.radix ? "true" : "false", opts.minimize ? "true" : "false",
+        opts.relayout ? "true" : "false", opts.freeze ? "true" : "false",
+        nlines, st.keys, nbytes, st.nodes,
+        build_time, (double) nlines / build_time, (double) nbytes / build_time,
+        usage.ru_maxrss, (double) st.bytes_used / (double) (st.keys ? st.keys : 1),
+        q, found, total / (double) q, latencies[q / 2], latencies[q * 99 / 100],
+        latencies[q * 999 / 1000]);
+
+    /* Bucket i counts latencies in [2^i, 2^(i+1)) ns, bucket 0 those below 2 ns,
+     * and each is printed as its lower bound and its count.
+     */
+    for (size_t i = 0, sep = 0; i < HIST_BUCKETS; ++i) {
+        if (hist[i]) {
+            printf("%s[%zu,%zu]", sep++ ? "," : "", i ? (size_t) 1 << i : 0, hist[i]);
+        }
+    }
+
+    printf("],\"lookups_per_s\":%.0f,\"batched_lookups_per_s\":%.0f,"
+        "\"enum_keys_per_s\":%.0f,\"top%d_queries_per_s\":%.0f}\n",
+        (double) q / serial_time, (double) q / batch_time,
+        (double) enumerated / enum_time, TOP_K, (double) q / top_time);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "cache.h"
+
+/* No entry, at the end of a chain or of the free list. */
+#define CACHE_NONE SIZE_MAX
+
+typedef struct {
+    char *data;                 /* The key, then the value; NULL if free. */
+    size_t key_len;
+    size_t len;
+    uint64_t hash;
+    size_t next;                /* In the chain of the bucket, or free list. */
+    bool referenced;            /* Looked up since the hand last passed. */
+} Entry;
+
+struct Cache {
+    Entry *entries;
+    size_t nslots;              /* Entries in use or free, up to the last. */
+    size_t capacity;
+    size_t free_list;
+    size_t *buckets;            /* Heads of the chains, by hash. */
+    size_t nbuckets;            /* A power of two. */
+    size_t hand;                /* Where the sweep of CLOCK stands. */
+    size_t max_bytes;
+    CacheStats stats;
+};
+
+static uint64_t hash_key(const char *key, size_t len)
+{
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ (unsigned char) key[i]) * UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+/* What an entry costs, its slot and its bucket included. */
+static size_t entry_bytes(size_t key_len, size_t len)
+{
+    return sizeof (Entry) + sizeof (size_t) + key_len + len;
+}
+
+Cache *cache_create(size_t max_bytes)
+{
+    Cache *const cache = calloc(1, sizeof *cache);
+
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    cache->nbuckets = 64;
+    cache->buckets = malloc(sizeof *cache->buckets * cache->nbuckets);
+    cache->free_list = CACHE_NONE;
+    cache->max_bytes = max_bytes;
+
+    if (cache->buckets == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cache->nbuckets; ++i) {
+        cache->buckets[i] = CACHE_NONE;
+    }
+    return cache;
+}
+
+void cache_destroy(Cache *cache)
+{
+    if (cache) {
+        cache_clear(cache);
+        free(cache->entries);
+        free(cache->buckets);
+        free(cache);
+    }
+}
+
+static size_t cache_find(const Cache *cache, const char *key, size_t key_len,
+                         uint64_t hash)
+{
+    size_t i = cache->buckets[hash & (cache->nbuckets - 1)];
+
+    while (i != CACHE_NONE) {
+        const Entry *const e = cache->entries + i;
+
+        if (e->hash == hash && e->key_len == key_len
+            && memcmp(e->data, key, key_len) == 0) {
+            break;
+        }
+        i = e->next;
+    }
+    return i;
+}
+
+const char *cache_get(Cache *cache, const char *key, size_t key_len,
+                      size_t *len)
+{
+    const size_t i = cache_find(cache, key, key_len, hash_key(key, key_len));
+
+    if (i == CACHE_NONE) {
+        ++cache->stats.misses;
+        return NULL;
+    }
+
+    Entry *const e = cache->entries + i;
+
+    ++cache->stats.hits;
+    e->referenced = true;
+    *len = e->len;
+    return e->data + e->key_len;
+}
+
+/* Unlinks entry `i` from its chain, and frees it. */
+static void cache_evict(Cache *cache, size_t i)
+{
+    Entry *const e = cache->entries + i;
+    size_t *link = cache->buckets + (e->hash & (cache->nbuckets - 1));
+
+    while (*link != i) {
+        link = &cache->entries[*link].next;
+    }
+
+    *link = e->next;
+    cache->stats.bytes -= entry_bytes(e->key_len, e->len);
+    --cache->stats.entries;
+    free(e->data);
+    e->data = NULL;
+    e->next = cache->free_list;
+    cache->free_list = i;
+}
+
+/* Doubles the buckets, and spreads the entries over them again. */
+static bool cache_rehash(Cache *cache)
+{
+    const size_t nbuckets = cache->nbuckets * 2;
+    size_t *const buckets = malloc(sizeof *buckets * nbuckets);
+
+    if (buckets == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < nbuckets; ++i) {
+        buckets[i] = CACHE_NONE;
+    }
+
+    for (size_t i = 0; i < cache->nslots; ++i) {
+        Entry *const e = cache->entries + i;
+
+        if (e->data) {
+            const size_t b = e->hash & (nbuckets - 1);
+
+            e->next = buckets[b];
+            buckets[b] = i;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->nbuckets = nbuckets;
+    return true;
+}
+
+/* Returns a free slot, or CACHE_NONE on memory allocation failure. */
+static size_t cache_slot(Cache *cache)
+{
+    if (cache->free_list != CACHE_NONE) {
+        const size_t i = cache->free_list;
+
+        cache->free_list = cache->entries[i].next;
+        return i;
+    }
+
+    if (cache->nslots >= cache->capacity) {
+        const size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+        Entry *const tmp = realloc(cache->entries, sizeof *tmp * capacity);
+
+        if (tmp == NULL) {
+            return CACHE_NONE;
+        }
+        cache->entries = tmp;
+        cache->capacity = capacity;
+    }
+    return cache->nslots++;
+}
+
+void cache_put(Cache *cache, const char *key, size_t key_len,
+               const char *value, size_t len)
+{
+    const size_t bytes = entry_bytes(key_len, len);
+    const uint64_t hash = hash_key(key, key_len);
+
+    if (bytes > cache->max_bytes / 8
+        || cache_find(cache, key, key_len, hash) != CACHE_NONE) {
+        return;
+    }
+
+    /* Sweep until there is room. Every entry the hand passes is given a
+     * second chance if it was looked up since, so this takes two rounds at
+     * most.
+     */
+    while (cache->stats.bytes + bytes > cache->max_bytes) {
+        if (cache->hand >= cache->nslots) {
+            cache->hand = 0;
+        }
+
+        Entry *const e = cache->entries + cache->hand;
+
+        if (e->data && !e->referenced) {
+            cache_evict(cache, cache->hand);
+            ++cache->stats.evictions;
+        } else {
+            e->referenced = false;
+        }
+        ++cache->hand;
+    }
+
+    if (cache->stats.entries >= cache->nbuckets && !cache_rehash(cache)) {
+        return;
+    }
+
+    char *const data = malloc(key_len + len);
+    const size_t i = data ? cache_slot(cache) : CACHE_NONE;
+
+    if (i == CACHE_NONE) {
+        free(data);
+        return;
+    }
+
+    memcpy(data, key, key_len);
+    memcpy(data + key_len, value, len);
+
+    const size_t b = hash & (cache->nbuckets - 1);
+
+    cache->entries[i] = (Entry) {
+        .data = data,
+        .key_len = key_len,
+        .len = len,
+        .hash = hash,
+        .next = cache->buckets[b],
+        .referenced = false,
+    };
+    cache->buckets[b] = i;
+    cache->stats.bytes += bytes;
+    ++cache->stats.entries;
+}
+
+void cache_clear(Cache *cache)
+{
+    for (size_t i = 0; i < cache->nslots; ++i) {
+        free(cache->entries[i].data);
+    }
+
+    for (size_t i = 0; i < cache->nbuckets; ++i) {
+        cache->buckets[i] = CACHE_NONE;
+    }
+
+    cache->nslots = 0;
+    cache->free_list = CACHE_NONE;
+    cache->hand = 0;
+    cache->stats.entries = 0;
+    cache->stats.bytes = 0;
+}
+
+void cache_add_stats(const Cache *cache, CacheStats *stats)
+{
+    stats->hits += cache->stats.hits;
+    stats->misses += cache->stats.misses;
+    stats->evictions += cache->stats.evictions;
+    stats->entries += cache->stats.entries;
+    stats->bytes += cache->stats.bytes;
+}
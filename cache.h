@@ -0,0 +1,56 @@
+#ifndef CACHE_H
+#define CACHE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A cache of answers, keyed on the query and the options it is answered with,
+ * that holds at most a given number of bytes. Once it is full, room is made
+ * by CLOCK: the entries are swept in a circle, and an entry is evicted unless
+ * it was looked up since the sweep last passed it, in which case it is given
+ * another round. A hit costs a hash lookup and setting a flag, with no list to
+ * reorder as in LRU, which evicts about the same entries.
+ *
+ * A cache is not thread-safe; every thread has a cache of its own.
+ */
+typedef struct Cache Cache;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;             /* Held at the moment. */
+    size_t bytes;               /* Held at the moment, bookkeeping included. */
+} CacheStats;
+
+/* Returns an empty cache of at most `max_bytes` bytes, or NULL on memory
+ * allocation failure.
+ */
+Cache *cache_create(size_t max_bytes);
+
+/* Releases `cache`. A null pointer is ignored. */
+void cache_destroy(Cache *cache);
+
+/* Returns the value of the `key_len` bytes at `key`, and sets `*len` to its
+ * length, or returns NULL if it is not cached. The value stays valid until
+ * the next call to cache_put() or cache_clear().
+ */
+const char *cache_get(Cache *cache, const char *key, size_t key_len,
+                      size_t *len);
+
+/* Caches the `len` bytes at `value` as the value of the `key_len` bytes at
+ * `key`, evicting entries until it fits, unless the key is cached already.
+ * A value bigger than an eighth of the cache is not cached, so that no single
+ * answer can flush it, and neither is one for which there is no memory.
+ */
+void cache_put(Cache *cache, const char *key, size_t key_len,
+               const char *value, size_t len);
+
+/* Drops every entry, as once the answers they hold are out of date. */
+void cache_clear(Cache *cache);
+
+/* Adds the counts of `cache` to those of `stats`. */
+void cache_add_stats(const Cache *cache, CacheStats *stats);
+
+#endif                          /* CACHE_H */
@@ -89,6 +89,32 @@ IO_DEF char **io_split_by_delim(char *restrict s, const char *restrict delim,
 IO_DEF char **io_split_lines(char *s, size_t *nlines)
     ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
 
+/*
+ * Returns the length of the line at the start of the `len` bytes pointed to by
+ * `s`, i.e. the offset of the first newline, or `len` if there is none.
+ * `valid` shall hold whether the line is free of nul bytes, so that it can be
+ * used as a string once its newline is overwritten.
+ *
+ * Both are found in the same pass, which is vectorized with AVX2, SSE2 or NEON
+ * when the target supports it.
+ */
+IO_DEF size_t io_find_line(const char *s, size_t len, bool valid[static 1])
+    ATTRIB_NONNULL(1, 3);
+
+/*
+ * Splits the `len` bytes pointed to by `s` into lines, as `io_split_lines()`
+ * does, but with `io_find_line()`, and drops the lines that are not valid.
+ * `s[len]` must be writable, as it is in a buffer returned by `io_read_file()`.
+ * If `nlines` is not NULL, it shall hold the amount of lines kept, and if
+ * `nskipped` is not NULL, the amount of lines dropped.
+ *
+ * Returns an array of pointers to the lines, or NULL on memory allocation
+ * failure. The caller is responsible for freeing the returned pointer.
+ */
+IO_DEF char **io_split_lines_valid(char *s, size_t len, size_t *nlines,
+    size_t *nskipped)
+    ATTRIB_NONNULL(1) ATTRIB_WARN_UNUSED_RESULT ATTRIB_MALLOC;
+
 /* 
  * Reads the next chunk of data from the stream referenced to by `stream`.
  * `chunk` must be a pointer to an array of size IO_CHUNK_SIZE. 
@@ -179,6 +205,19 @@ IO_DEF bool io_write_file(FILE *stream, size_t nbytes, const char data[static nb
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__GNUC__) || defined(__clang__)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define IO_SIMD_AVX2
+    #elif defined(__SSE2__)
+        #include <emmintrin.h>
+        #define IO_SIMD_SSE2
+    #elif defined(__ARM_NEON)
+        #include <arm_neon.h>
+        #define IO_SIMD_NEON
+    #endif
+#endif
+
 #define IO_TOKEN_CHUNK_SIZE    (1024 * 2)
 
 #define GROW_CAPACITY(capacity, initial) \
@@ -265,6 +304,144 @@ IO_DEF char **io_split_lines(char *s, size_t *nlines)
     return io_split_by_delim(s, "\n", nlines);
 }
 
+#ifdef IO_SIMD_NEON
+/* NEON has no movemask. Narrowing every 16-bit lane by 4 bits leaves a 64-bit
+ * mask with 4 bits per byte of `cmp`.
+ */
+static inline uint64_t io_neon_mask(uint8x16_t cmp)
+{
+    return vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+#endif
+
+IO_DEF size_t io_find_line(const char *s, size_t len, bool valid[static 1])
+{
+    size_t i = 0;
+    bool ok = true;
+
+    /* Every block yields a mask of its newlines and a mask of its nul bytes.
+     * The line ends at the lowest bit of the former, and is valid if no bit of
+     * the latter is below it.
+     */
+#if defined(IO_SIMD_AVX2)
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i nul = _mm256_setzero_si256();
+
+    for (; len - i >= 32; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *) (s + i));
+        const uint32_t nl_mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        uint32_t bad_mask = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nul));
+
+        if (nl_mask) {
+            const unsigned pos = (unsigned) __builtin_ctz(nl_mask);
+
+            bad_mask &= (UINT32_C(1) << pos) - 1;
+            *valid = ok && !bad_mask;
+            return i + pos;
+        }
+        ok = ok && !bad_mask;
+    }
+#elif defined(IO_SIMD_SSE2)
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i nul = _mm_setzero_si128();
+
+    for (; len - i >= 16; i += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i *) (s + i));
+        const unsigned nl_mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        unsigned bad_mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nul));
+
+        if (nl_mask) {
+            const unsigned pos = (unsigned) __builtin_ctz(nl_mask);
+
+            bad_mask &= (1u << pos) - 1;
+            *valid = ok && !bad_mask;
+            return i + pos;
+        }
+        ok = ok && !bad_mask;
+    }
+#elif defined(IO_SIMD_NEON)
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    const uint8x16_t nul = vdupq_n_u8(0);
+
+    for (; len - i >= 16; i += 16) {
+        const uint8x16_t v = vld1q_u8((const uint8_t *) (s + i));
+        const uint64_t nl_mask = io_neon_mask(vceqq_u8(v, nl));
+        uint64_t bad_mask = io_neon_mask(vceqq_u8(v, nul));
+
+        if (nl_mask) {
+            const unsigned pos = (unsigned) __builtin_ctzll(nl_mask) / 4;
+
+            bad_mask &= (UINT64_C(1) << (4 * pos)) - 1;
+            *valid = ok && !bad_mask;
+            return i + pos;
+        }
+        ok = ok && !bad_mask;
+    }
+#endif
+
+    for (; i < len && s[i] != '\n'; ++i) {
+        ok = ok && s[i] != '\0';
+    }
+
+    *valid = ok;
+    return i;
+}
+
+IO_DEF char **io_split_lines_valid(char *s, size_t len, size_t *nlines,
+    size_t *nskipped)
+{
+    size_t capacity = IO_TOKEN_CHUNK_SIZE;
+    size_t count = 0;
+    size_t skipped = 0;
+    char **lines = IO_MALLOC(sizeof *lines * capacity);
+
+    if (nlines) {
+        *nlines = 0;
+    }
+
+    if (nskipped) {
+        *nskipped = 0;
+    }
+
+    if (lines == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < len; ) {
+        bool valid = true;
+        const size_t n = io_find_line(s + i, len - i, &valid);
+
+        if (!valid) {
+            ++skipped;
+        } else {
+            if (count >= capacity) {
+                capacity = GROW_CAPACITY(capacity, IO_TOKEN_CHUNK_SIZE);
+                char **const tmp = IO_REALLOC(lines, sizeof *lines * capacity);
+
+                if (tmp == NULL) {
+                    IO_FREE(lines);
+                    return NULL;
+                }
+                lines = tmp;
+            }
+            lines[count++] = s + i;
+        }
+
+        s[i + n] = '\0';
+        i += n + 1;
+    }
+
+    if (nlines) {
+        *nlines = count;
+    }
+
+    if (nskipped) {
+        *nskipped = skipped;
+    }
+    return lines;
+}
+
 IO_DEF size_t io_read_next_chunk(FILE stream[static 1], 
                                  char chunk[static IO_CHUNK_SIZE])
 {
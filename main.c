@@ -0,0 +1,1381 @@
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+#define _POSIX_C_SOURCE 200819L
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <getopt.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_GVC
+#include <graphviz/gvc.h>
+#endif
+
+#define IO_IMPLEMENTATION
+#define IO_STATIC
+#include "io.h"
+
+#include "trie.h"
+#include "server.h"
+#include "shard.h"
+
+#define PROGRAM_NAME    "auto-complete"
+#define OUTPUT_DOT_FILE "graph.dot"
+#define DEFAULT_FORMAT  "svg"
+
+/* Completions are written out a buffer at a time, rather than a key at a time. */
+#define PAGE_BUFFER_SIZE (1024 * 64)
+
+extern char **environ;
+
+typedef struct {
+    bool kflag;                 /* Keep the transient .DOT file. */
+    bool hflag;                 /* Help message. */
+    bool sflag;                 /* Generate a .SVG file. */
+    bool cflag;                 /* Suggest autocompletions. */
+    bool pflag;                 /* Prefix for the .DOT file. */
+    bool rflag;                 /* Build a path-compressed (radix) trie. */
+    bool Hflag;                 /* Back the trie with huge pages. */
+    bool mflag;                 /* Minimize the trie into a DAWG. */
+    bool Rflag;                 /* Renumber the nodes for locality. */
+    bool Dflag;                 /* Lay the trie out as a double array. */
+    bool bflag;                 /* Build from a word list in sorted order. */
+    bool tflag;                 /* Report statistics as JSON on stderr. */
+    bool Wflag;                 /* Follow every completion with its weight. */
+    const char *save_path;      /* Write a binary image of the trie here. */
+    const char *load_path;      /* Map the trie from this binary image. */
+    const char *delta_path;     /* Apply the updates in this file. */
+    const char *serve_path;     /* Answer queries on this Unix socket. */
+    const char *queries_path;   /* Answer the prefixes listed in this file. */
+    const char *route_path;     /* Route queries to the shards listed here. */
+    const char *graph_path;     /* Render the graph here, if not NULL. */
+    const char *graph_format;   /* Render the graph in this format. */
+    size_t top_k;               /* Only the K best completions, if non-zero. */
+    size_t max_edits;           /* Complete prefixes this many edits away. */
+    size_t jobs;                /* Build with this many threads. */
+    size_t limit;               /* Only this many completions, if non-zero. */
+    size_t offset;              /* Skip this many completions first. */
+    const char *after;          /* Only the completions after this key. */
+    size_t shards;              /* Split the trie into this many images. */
+    size_t cache_mb;            /* Cache this many MiB of answers. */
+} flags;
+
+/* The phases timed by --stats. A streaming build reads and splits the word
+ * list as it inserts it, so all of that is timed as insertion.
+ */
+enum {
+    PHASE_LOAD,
+    PHASE_READ,
+    PHASE_SPLIT,
+    PHASE_INSERT,
+    PHASE_DELTA,
+    PHASE_FINISH,               /* Shrinking, minimizing, relaying out, freezing. */
+    PHASE_SAVE,
+    PHASE_QUERY,
+    PHASE_DOT,
+    PHASE_SVG,
+    PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "load", "read", "split", "insert", "delta", "finish", "save", "query", "dot", "svg",
+};
+
+typedef struct {
+    double phases[PHASE_COUNT]; /* Seconds spent in each phase. */
+    size_t queries;
+    size_t visits;              /* Nodes descended to, over all queries. */
+    size_t max_visits;
+    CacheStats cache;
+} Stats;
+
+#ifdef DEBUG
+#include "size.h"
+#define debug_printf(fmt, ...) \
+    fprintf(stdout, "%s:%d:%s(): " fmt, __FILE__, __LINE__, \
+            __func__, __VA_ARGS__)
+#define D(x) x
+#else
+#define D(x) (void) 0
+#endif
+
+static void help(FILE *sink)
+{
+    fprintf(sink, "\nUSAGE\n"
+        "\t" PROGRAM_NAME " [OPTIONS] [filename]\n\n"
+        "DESCRIPTION\n"
+        "\t" PROGRAM_NAME
+        " is a program for auto-completion and graph visualization.\n\n"
+        "OPTIONS:\n" "\t-k, --keep\t\tKeep the transient .DOT file.\n"
+        "\t-h, --help\t\tDisplay this help message and exit.\n"
+        "\t-s, --svg \t\tGenerate a .SVG file (with optional prefix).\n"
+        "\t-c, --complete PREFIX   Suggest autocompletions for prefix.\n"
+        "\t-p, --prefix PREFIX\tPrefix for the .DOT file.\n"
+        "\t-o, --output FILE\tRender the graph to FILE (graph.dot.FORMAT).\n"
+        "\t-T, --format FORMAT\tRender the graph as FORMAT (svg, png, json...).\n"
+        "\t-n, --top K\t\tOnly suggest the K completions of highest weight.\n"
+        "\t-f, --fuzzy N\t\tAlso complete prefixes up to N edits away.\n"
+        "\t-l, --limit N\t\tOnly suggest the first N completions.\n"
+        "\t-O, --offset N\t\tSkip the first N completions.\n"
+        "\t-a, --after KEY\t\tOnly suggest the completions after KEY.\n"
+        "\t-r, --radix\t\tCollapse single-child chains into one edge.\n"
+        "\t-j, --jobs N\t\tBuild the trie, and serve it, with N threads.\n"
+        "\t-H, --huge-pages\tBack the trie with transparent huge pages.\n"
+        "\t-m, --minimize\t\tMerge equivalent subtrees into a DAWG.\n"
+        "\t-R, --relayout\t\tRenumber the nodes for faster lookups.\n"
+        "\t-D, --double-array\tLay the trie out as a double array.\n"
+        "\t-b, --sorted\t\tBuild in one pass from a sorted word list,\n"
+        "\t\t\t\tstraight into the image of --save.\n"
+        "\t-t, --stats\t\tReport timings and statistics as JSON on stderr.\n"
+        "\t-S, --save FILE\t\tWrite a binary image of the trie to FILE.\n"
+        "\t-L, --load FILE\t\tMap the trie from a binary image instead of\n"
+        "\t\t\t\treading a word list. Only load images from\n"
+        "\t\t\t\ta trusted writer.\n"
+        "\t-d, --delta FILE\tApply the updates in FILE (+key, -key) once the\n"
+        "\t\t\t\ttrie is built or loaded, and with --serve,\n"
+        "\t\t\t\twhat is appended to it on SIGHUP, in an\n"
+        "\t\t\t\toverlay that is folded into a copy of the\n"
+        "\t\t\t\ttrie in the background once it grows.\n"
+        "\t-q, --queries FILE\tAnswer every prefix listed in FILE (- for\n"
+        "\t\t\t\tstdin), one per line.\n"
+        "\t-u, --serve SOCKET\tAnswer newline-delimited prefix queries on\n"
+        "\t\t\t\tthe Unix socket SOCKET until interrupted.\n"
+        "\t-W, --weights\t\tFollow every completion of --queries and\n"
+        "\t\t\t\t--serve with its weight.\n"
+        "\t-P, --shards N\t\tSplit the trie by key range into N images\n"
+        "\t\t\t\tnext to the manifest written to --save.\n"
+        "\t-M, --route MANIFEST\tAnswer --queries and --serve by routing them\n"
+        "\t\t\t\tto the shards listed in MANIFEST.\n"
+        "\t-C, --cache MB\t\tCache up to MB MiB of the answers of --queries\n"
+        "\t\t\t\tand --serve.\n\n");
+    exit(EXIT_SUCCESS);
+}
+
+static void usage_err(const char *prog_name)
+{
+    fprintf(stderr, "The syntax of the command is incorrect.\n"
+        "Try %s -h for more information.\n", prog_name);
+    exit(EXIT_FAILURE);
+}
+
+/* Parses `arg` as a count of at least `min` and at most `max`. */
+static size_t parse_count_max(const char *arg, const char *name, size_t min,
+                              size_t max, const char *prog_name)
+{
+    char *end = NULL;
+
+    errno = 0;
+    const unsigned long long n = strtoull(arg, &end, 10);
+
+    if (errno || end == arg || *end != '\0' || *arg == '-' || n < min 
+        || n > max) {
+        fprintf(stderr, "Error: %s must be a %s integer.\n", name, 
+            min ? "positive" : "non-negative");
+        usage_err(prog_name);
+    }
+    return (size_t) n;
+}
+
+static size_t parse_count(const char *arg, const char *name, size_t min,
+                          const char *prog_name)
+{
+    return parse_count_max(arg, name, min, SIZE_MAX, prog_name);
+}
+
+static void parse_options(const struct option * long_options,
+                          flags *               opt_ptr, 
+                          int                   argc, 
+                          char **restrict       argv,
+                          const char **restrict prefix)
+{
+    int c = 0;
+    int err_flag = 0;
+
+    while (true) {
+        c = getopt_long(argc, argv, "shkrHmRDbtWc:p:o:T:n:f:j:l:O:a:q:S:L:d:u:P:M:C:", long_options, NULL);
+        
+        if (c == -1) {
+            break;
+        }
+
+        switch (c) {
+            case 'k':
+                ++err_flag;
+                opt_ptr->kflag = true;
+                break;
+            case 'h':
+                help(stdout);
+                break;
+            case 'r':
+                opt_ptr->rflag = true;
+                break;
+            case 'H':
+                opt_ptr->Hflag = true;
+                break;
+            case 'm':
+                opt_ptr->mflag = true;
+                break;
+            case 'R':
+                opt_ptr->Rflag = true;
+                break;
+            case 'D':
+                opt_ptr->Dflag = true;
+                break;
+            case 'b':
+                opt_ptr->bflag = true;
+                break;
+            case 't':
+                opt_ptr->tflag = true;
+                break;
+            case 'W':
+                opt_ptr->Wflag = true;
+                break;
+            case 'P':
+                opt_ptr->shards = parse_count(optarg, "N", 1, argv[0]);
+                break;
+            case 'M':
+                opt_ptr->route_path = optarg;
+                break;
+            case 'C':
+                /* The cache is sized in bytes, which must not overflow. */
+                opt_ptr->cache_mb = parse_count_max(optarg, "MB", 1, 
+                                                    SIZE_MAX / (1024 * 1024),
+                                                    argv[0]);
+                break;
+            case 'n':
+                opt_ptr->top_k = parse_count(optarg, "K", 1, argv[0]);
+                break;
+            case 'f':
+                opt_ptr->max_edits = parse_count(optarg, "N", 1, argv[0]);
+                break;
+            case 'j':
+                opt_ptr->jobs = parse_count(optarg, "N", 1, argv[0]);
+                break;
+            case 'l':
+                opt_ptr->limit = parse_count(optarg, "N", 1, argv[0]);
+                break;
+            case 'O':
+                opt_ptr->offset = parse_count(optarg, "N", 0, argv[0]);
+                break;
+            case 'a':
+                opt_ptr->after = optarg;
+                break;
+            case 'S':
+                opt_ptr->save_path = optarg;
+                break;
+            case 'L':
+                opt_ptr->load_path = optarg;
+                break;
+            case 'd':
+                opt_ptr->delta_path = optarg;
+                break;
+            case 'u':
+                opt_ptr->serve_path = optarg;
+                break;
+            case 'q':
+                opt_ptr->queries_path = optarg;
+                break;
+            case 's':
+                if (opt_ptr->cflag) {
+                    fprintf(stderr,
+                        "Error: -s/--svg specified after -c/--complete.\n");
+                    usage_err(argv[0]);
+                }
+
+                if (opt_ptr->pflag) {
+                    --err_flag;
+                }
+
+                if (opt_ptr->kflag) {
+                    --err_flag;
+                }
+
+                opt_ptr->sflag = true;
+                break;
+            case 'c':
+                if (opt_ptr->sflag) {
+                    fprintf(stderr,
+                        "Error: -c/--complete specified after -s/--svg.\n");
+                    usage_err(argv[0]);
+                }
+
+                *prefix = optarg;
+
+                if (strlen(*prefix) >= TRIE_PREFIX_MAX) {
+                    fprintf(stderr, "Error: PREFIX too long.\n");
+                    exit(EXIT_FAILURE);
+                }
+
+                opt_ptr->cflag = true;
+                break;
+            case 'p':
+                if (!opt_ptr->sflag) {
+                    err_flag = true;
+                }
+
+                *prefix = optarg;
+                opt_ptr->pflag = true;
+                break;
+            case 'o':
+                opt_ptr->graph_path = optarg;
+                break;
+            case 'T':
+                opt_ptr->graph_format = optarg;
+                break;
+
+                /* case '?' */
+            default:
+                usage_err(argv[0]);
+        }
+    }
+
+    /* If the -p or -k flag was specified without -s: */
+    /* Note: GNU provides an extension for optional arguments, which
+     *       can be used to provide an optional prefix for -s. */
+    if (err_flag) {
+        if (opt_ptr->pflag) {
+            fputs("Error: -p specified without -s.\n", stderr);
+        }
+
+        if (opt_ptr->kflag) {
+            fputs("Error: -k specified without -s.\n", stderr);
+        }
+        usage_err(argv[0]);
+    }
+
+    if (!opt_ptr->sflag && (opt_ptr->graph_path || opt_ptr->graph_format)) {
+        fputs("Error: -o or -T specified without -s.\n", stderr);
+        usage_err(argv[0]);
+    }
+}
+
+
+/* Returns the monotonic time in seconds, or 0 if `stats` is NULL, so that
+ * the probes cost no more than a branch without --stats.
+ */
+static double stats_clock(const Stats *stats)
+{
+    struct timespec ts;
+
+    if (stats == NULL) {
+        return 0.0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void stats_stop(Stats *stats, int phase, double start)
+{
+    if (stats) {
+        stats->phases[phase] += stats_clock(stats) - start;
+    }
+}
+
+/* Counts a query, whose lookup went through `cur`, or, if it was answered from
+ * the cache, through none.
+ */
+static void stats_query(Stats *stats, const trie_cursor_t *cur)
+{
+    if (stats) {
+        const size_t visits = cur ? trie_cursor_visits(cur) : 0;
+
+        ++stats->queries;
+        stats->visits += visits;
+
+        if (visits > stats->max_visits) {
+            stats->max_visits = visits;
+        }
+    }
+}
+
+/* Writes `hist` as an array of [bucket, count] pairs, empty buckets left out. */
+static void print_histogram(FILE *sink, const size_t *hist, size_t nbuckets)
+{
+    fputc('[', sink);
+
+    for (size_t i = 0, sep = 0; i < nbuckets; ++i) {
+        if (hist[i]) {
+            fprintf(sink, "%s[%zu,%zu]", sep++ ? "," : "", i, hist[i]);
+        }
+    }
+    fputc(']', sink);
+}
+
+/* Writes the statistics of the run as one JSON object on stderr, stdout being
+ * taken by the completions.
+ */
+static bool print_stats(const Stats *stats, const trie_t *trie, size_t nlines,
+                        size_t nskipped)
+{
+    trie_stats_t st;
+    trie_shape_t shape;
+
+    if (!trie_get_shape(trie, &shape)) {
+        return false;
+    }
+
+    trie_get_stats(trie, &st);
+    fputs("{\"phases_s\":{", stderr);
+
+    for (size_t i = 0; i < PHASE_COUNT; ++i) {
+        fprintf(stderr, "%s\"%s\":%.6f", i ? "," : "", phase_names[i],
+            stats->phases[i]);
+    }
+
+    fprintf(stderr, "},\"lines\":%zu,\"skipped\":%zu,\"keys\":%zu,"
+        "\"nodes\":%zu,\"nodes_allocated\":%zu,\"edges\":%zu,"
+        "\"edges_allocated\":%zu,\"text\":%zu,\"text_allocated\":%zu,"
+        "\"bytes_used\":%zu,\"bytes_allocated\":%zu,\"grows\":%zu,"
+        "\"radix\":%s,\"minimized\":%s,\"double_array\":%s,\"mapped\":%s,"
+        "\"fanout\":", nlines, nskipped, st.keys, st.nodes, st.nodes_allocated,
+        st.edges, st.edges_allocated, st.text, st.text_allocated,
+        st.bytes_used, st.bytes_allocated, st.grows,
+        st.radix ? "true" : "false", st.minimized ? "true" : "false",
+        st.double_array ? "true" : "false", st.mapped ? "true" : "false");
+    print_histogram(stderr, shape.fanout, TRIE_SHAPE_BUCKETS);
+    fputs(",\"depth\":", stderr);
+    print_histogram(stderr, shape.depth, TRIE_SHAPE_BUCKETS);
+    fprintf(stderr, ",\"queries\":%zu,\"visits\":{\"total\":%zu,"
+        "\"mean\":%.2f,\"max\":%zu},", stats->queries, stats->visits,
+        stats->queries ? (double) stats->visits / (double) stats->queries : 0.0,
+        stats->max_visits);
+
+    const CacheStats *const cache = &stats->cache;
+    const size_t lookups = cache->hits + cache->misses;
+
+    fprintf(stderr, "\"cache\":{\"hits\":%zu,\"misses\":%zu,\"hit_rate\":%.4f,"
+        "\"evictions\":%zu,\"entries\":%zu,\"bytes\":%zu}}\n", cache->hits,
+        cache->misses, lookups ? (double) cache->hits / (double) lookups : 0.0,
+        cache->evictions, cache->entries, cache->bytes);
+    return true;
+}
+
+static bool generate_dot(const trie_cursor_t *cur)
+{
+    FILE *const sink = fopen(OUTPUT_DOT_FILE, "w");
+
+    if (sink == NULL) {
+        perror("fopen()");
+        return false;
+    }
+
+    const bool rv = trie_dump_dot(cur, sink);
+
+    return !fclose(sink) && rv;
+}
+
+#ifdef HAVE_GVC
+/* Lays the graph out and renders it in-process with libgvc. The DOT text is
+ * built in memory, and is only written to disk if it is to be kept.
+ */
+static bool generate_graph(const trie_cursor_t *cur, const flags *options,
+                           const char *path, Stats *stats)
+{
+    char *dot = NULL;
+    size_t dot_len = 0;
+    FILE *const sink = open_memstream(&dot, &dot_len);
+    double start = stats_clock(stats);
+
+    if (sink == NULL) {
+        perror("open_memstream()");
+        return false;
+    }
+
+    bool rv = trie_dump_dot(cur, sink);
+
+    if (fclose(sink) || !rv) {
+        free(dot);
+        return false;
+    }
+
+    if (options->kflag) {
+        FILE *const out = fopen(OUTPUT_DOT_FILE, "w");
+
+        rv = out && io_write_file(out, dot_len, dot);
+
+        if ((out && fclose(out)) || !rv) {
+            perror(OUTPUT_DOT_FILE);
+            free(dot);
+            return false;
+        }
+    }
+
+    stats_stop(stats, PHASE_DOT, start);
+    start = stats_clock(stats);
+
+    GVC_t *const gvc = gvContext();
+    Agraph_t *const graph = agmemread(dot);
+
+    rv = graph && gvLayout(gvc, graph, "dot") == 0;
+
+    if (rv) {
+        rv = gvRenderFilename(gvc, graph, options->graph_format 
+                              ? options->graph_format : DEFAULT_FORMAT, path) == 0;
+        gvFreeLayout(gvc, graph);
+    }
+
+    if (!rv) {
+        fprintf(stderr, "Error: failed to render the graph to %s.\n", path);
+    }
+
+    if (graph) {
+        agclose(graph);
+    }
+
+    gvFreeContext(gvc);
+    free(dot);
+    stats_stop(stats, PHASE_SVG, start);
+    return rv;
+}
+#else
+/* Runs dot, rendering to `path`. Its input is the file at `in_path`, or, if
+ * that is NULL, a pipe, whose write end is stored in `*in_fd`. Returns the pid
+ * of dot, or -1 on failure.
+ */
+static pid_t spawn_dot(const flags *options, const char *path, 
+                       const char *in_path, int *in_fd)
+{
+    const char *const format = options->graph_format 
+                             ? options->graph_format : DEFAULT_FORMAT;
+    char *const format_arg = malloc(strlen(format) + 3);
+    int fds[2] = { -1, -1 };
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+
+    if (format_arg == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+
+    strcat(strcpy(format_arg, "-T"), format);
+
+    char *const argv[] = { 
+        (char *) "dot", format_arg, (char *) "-o", (char *) path, 
+        (char *) in_path, NULL 
+    };
+
+    if (in_path == NULL && pipe(fds) == -1) {
+        perror("pipe()");
+        free(format_arg);
+        return -1;
+    }
+
+    int err = posix_spawn_file_actions_init(&actions);
+
+    if (!err) {
+        if (in_path == NULL
+            && !(err = posix_spawn_file_actions_adddup2(&actions, fds[0], 
+                                                        STDIN_FILENO))
+            && !(err = posix_spawn_file_actions_addclose(&actions, fds[0]))) {
+            err = posix_spawn_file_actions_addclose(&actions, fds[1]);
+        }
+
+        if (!err) {
+            err = posix_spawnp(&pid, "dot", &actions, NULL, argv, environ);
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+
+    if (err) {
+        fprintf(stderr, "Error: failed to run dot, %s.\n", strerror(err));
+        pid = -1;
+    }
+
+    if (in_path == NULL) {
+        close(fds[0]);
+
+        if (pid == -1) {
+            close(fds[1]);
+        } else {
+            *in_fd = fds[1];
+        }
+    }
+
+    free(format_arg);
+    return pid;
+}
+
+static bool wait_dot(pid_t pid)
+{
+    int status = 0;
+
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid()");
+            return false;
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fputs("Error: dot failed to render the graph.\n", stderr);
+        return false;
+    }
+    return true;
+}
+
+/* Streams the DOT text into dot over a pipe, so that emission and layout
+ * overlap and nothing touches the disk but the rendered graph. The DOT text
+ * is only written to a file if it is to be kept, and dot then reads it from
+ * there.
+ */
+static bool generate_graph(const trie_cursor_t *cur, const flags *options,
+                           const char *path, Stats *stats)
+{
+    double start = stats_clock(stats);
+
+    if (options->kflag) {
+        if (!generate_dot(cur)) {
+            return false;
+        }
+
+        stats_stop(stats, PHASE_DOT, start);
+        start = stats_clock(stats);
+
+        const pid_t pid = spawn_dot(options, path, OUTPUT_DOT_FILE, NULL);
+        const bool rv = pid != -1 && wait_dot(pid);
+
+        stats_stop(stats, PHASE_SVG, start);
+        return rv;
+    }
+
+    /* If dot exits early, the write fails with EPIPE instead of the signal
+     * killing us.
+     */
+    const struct sigaction sa = { .sa_handler = SIG_IGN };
+    int fd = -1;
+
+    sigaction(SIGPIPE, &sa, NULL);
+
+    const pid_t pid = spawn_dot(options, path, NULL, &fd);
+
+    if (pid == -1) {
+        return false;
+    }
+
+    FILE *const sink = fdopen(fd, "w");
+    bool rv = sink && trie_dump_dot(cur, sink);
+
+    if (sink == NULL) {
+        perror("fdopen()");
+        close(fd);
+    } else if (fclose(sink)) {
+        rv = false;
+    }
+
+    stats_stop(stats, PHASE_DOT, start);
+    start = stats_clock(stats);
+    rv = wait_dot(pid) && rv;
+    stats_stop(stats, PHASE_SVG, start);
+    return rv;
+}
+#endif                          /* HAVE_GVC */
+
+/* Without -o, the graph goes where `dot -O` would put it. */
+static char *graph_default_path(const flags *options)
+{
+    const char *const format = options->graph_format 
+                             ? options->graph_format : DEFAULT_FORMAT;
+    char *const path = malloc(sizeof OUTPUT_DOT_FILE + 1 + strlen(format));
+
+    if (path == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    return strcat(strcpy(path, OUTPUT_DOT_FILE "."), format);
+}
+
+typedef struct {
+    FILE *sink;
+    size_t count;
+} Lines;
+
+static bool print_line(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Lines *const lines = ctx;
+
+    (void) weight;
+    ++lines->count;
+    return fwrite(key, 1, len, lines->sink) == len 
+        && fputc('\n', lines->sink) != EOF;
+}
+
+/* Writes the page of completions at `cur` that `options` asks for to `sink`,
+ * a buffer at a time. Every buffer but the first resumes after the last key
+ * of the one before.
+ */
+static bool print_page(trie_cursor_t *cur, const flags *options, FILE *sink)
+{
+    size_t size = PAGE_BUFFER_SIZE;
+    char *buf = malloc(size);
+    char *last = malloc(size);
+    trie_page_t page = {
+        .after = options->after,
+        .offset = options->offset,
+        .limit = options->limit,
+    };
+    bool rv = buf && last;
+
+    if (!rv) {
+        perror("malloc()");
+    }
+
+    while (rv) {
+        size_t len = 0;
+        size_t nkeys = 0;
+
+        if (!(rv = trie_complete_buffer(cur, &page, buf, size, &len, &nkeys))
+            || len == 0) {
+            break;
+        }
+
+        if (nkeys == 0) {
+            /* A key longer than the buffer; make room for it. */
+            char *const tmp = realloc(buf, len);
+            char *const tmp_last = tmp ? realloc(last, len) : NULL;
+
+            buf = tmp ? tmp : buf;
+            last = tmp_last ? tmp_last : last;
+
+            /* The key to resume after may be in `last`, which has moved. */
+            if (page.after != options->after) {
+                page.after = last;
+            }
+
+            if (!(rv = tmp_last != NULL)) {
+                perror("realloc()");
+            }
+            size = len;
+            continue;
+        }
+
+        if (fwrite(buf, 1, len, sink) != len) {
+            perror("fwrite()");
+            rv = false;
+        }
+
+        if (page.limit && (page.limit -= nkeys) == 0) {
+            break;
+        }
+
+        /* The last key is the one before the final newline. */
+        const char *const end = buf + len - 1;
+        const char *start = end;
+
+        while (start > buf && start[-1] != '\n') {
+            --start;
+        }
+
+        memcpy(last, start, (size_t) (end - start));
+        last[end - start] = '\0';
+        page.after = last;
+        page.offset = 0;
+    }
+
+    free(buf);
+    free(last);
+    return rv;
+}
+
+static bool process_args(const trie_t *         trie,
+                         const flags *          options, 
+                         const char *restrict   prefix,
+                         const char *restrict   graph_path,
+                         Stats *                stats)
+{
+    double start = 0.0;
+
+    bool rv = true;
+    trie_cursor_t *const cur = trie_cursor_create(trie);
+
+    if (cur == NULL) {
+        return false;
+    }
+
+    if (options->cflag && options->max_edits) {
+        Lines lines = { .sink = stdout };
+
+        start = stats_clock(stats);
+        rv = trie_complete_fuzzy(cur, prefix, options->max_edits, 
+                                 options->top_k, print_line, &lines);
+        stats_stop(stats, PHASE_QUERY, start);
+
+        if (rv && lines.count == 0) {
+            fprintf(stderr, "Error: Unable to find prefix.\n");
+            rv = !rv;
+            goto cleanup;
+        }
+    } else if (options->cflag) {
+        Lines lines = { .sink = stdout };
+
+        start = stats_clock(stats);
+
+        if (!trie_find_prefix(cur, prefix)) {
+            fprintf(stderr, "Error: Unable to find prefix.\n");
+            rv = !rv;
+            goto cleanup;
+        }
+
+        stats_query(stats, cur);
+        rv = options->top_k
+           ? trie_complete(cur, options->top_k, print_line, &lines)
+           : print_page(cur, options, stdout);
+        stats_stop(stats, PHASE_QUERY, start);
+    }
+
+    if (options->sflag) {
+        if (prefix && !trie_find_prefix(cur, prefix)) {
+            fprintf(stderr, "Error: Unable to find prefix.\n");
+            rv = !rv;
+            goto cleanup;
+        }
+
+        rv = generate_graph(cur, options, graph_path, stats);
+    }
+
+  cleanup:
+    trie_cursor_destroy(cur);
+    return rv;
+}
+
+static int compare_prefixes(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Answers every prefix listed in the file at `path` on stdout, in sorted
+ * order, so that consecutive lookups share most of their descent, and in
+ * batches, so that their cache misses overlap. Each answer is framed as by
+ * answer_query().
+ */
+static bool run_queries(const char *path, const trie_t *trie, 
+                        const QueryOptions *qopts, Stats *stats)
+{
+    const bool use_stdin = strcmp(path, "-") == 0;
+    FILE *const stream = use_stdin ? stdin : fopen(path, "r");
+
+    if (stream == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char *const content = io_read_file(stream, NULL);
+
+    if (!use_stdin) {
+        fclose(stream);
+    }
+
+    if (content == NULL) {
+        perror("fread()");
+        return false;
+    }
+
+    size_t nqueries = 0;
+    char **const queries = io_split_lines(content, &nqueries);
+    bool rv = true;
+
+    if (queries == NULL && *content != '\0') {
+        perror("malloc()");
+        rv = false;
+    }
+
+    for (size_t i = 0; i < nqueries; ++i) {
+        queries[i][strcspn(queries[i], "\r")] = '\0';
+    }
+
+    if (nqueries) {
+        qsort(queries, nqueries, sizeof *queries, compare_prefixes);
+    }
+
+    /* A router has no trie, and connections to the shards instead. */
+    trie_cursor_t *curs[TRIE_FIND_BATCH] = { NULL };
+    ShardLinks *links = NULL;
+    Cache *cache = NULL;
+    bool cached[TRIE_FIND_BATCH] = { false };
+    size_t nfailed = 0;
+
+    if (qopts->shards) {
+        rv = rv && (links = shard_links_create(qopts->shards)) != NULL;
+    }
+
+    if (rv && qopts->cache_size
+        && (cache = cache_create(qopts->cache_size)) == NULL) {
+        perror("cache_create()");
+        rv = false;
+    }
+
+    for (size_t i = 0; rv && trie && i < TRIE_FIND_BATCH; ++i) {
+        rv = (curs[i] = trie_cursor_create(trie)) != NULL;
+    }
+
+    for (size_t i = 0; rv && i < nqueries; i += TRIE_FIND_BATCH) {
+        const size_t n = nqueries - i < TRIE_FIND_BATCH 
+                       ? nqueries - i : TRIE_FIND_BATCH;
+        const char *const *const batch = (const char *const *) queries + i;
+
+        if (links) {
+            rv = shard_answer(links, stdout, batch, n, qopts, &nfailed);
+            continue;
+        }
+
+        rv = answer_queries(stdout, curs, cache, batch, n, qopts, cached);
+
+        for (size_t j = 0; j < n; ++j) {
+            stats_query(stats, cached[j] ? NULL : curs[j]);
+        }
+    }
+
+    if (nfailed) {
+        fprintf(stderr, "Error: %zu queries were not answered by the shards.\n",
+            nfailed);
+        rv = false;
+    }
+
+    if (cache && stats) {
+        cache_add_stats(cache, &stats->cache);
+    }
+
+    for (size_t i = 0; i < TRIE_FIND_BATCH; ++i) {
+        trie_cursor_destroy(curs[i]);
+    }
+    shard_links_destroy(links);
+    cache_destroy(cache);
+    free(queries);
+    free(content);
+    return rv;
+}
+
+/* Answers --queries and --serve by routing the queries to the shards listed in
+ * the manifest of --route.
+ */
+static bool run_router(const flags *options)
+{
+    Shards *const shards = shard_load(options->route_path);
+
+    if (shards == NULL) {
+        return false;
+    }
+
+    /* A shard that hangs up fails the batch it was answering, rather than
+     * killing the router.
+     */
+    const struct sigaction sa = { .sa_handler = SIG_IGN };
+    const QueryOptions qopts = {
+        .top_k = options->top_k,
+        .max_edits = options->max_edits,
+        .weights = options->Wflag,
+        .shards = shards,
+    };
+    bool rv = true;
+
+    sigaction(SIGPIPE, &sa, NULL);
+
+    if (options->queries_path) {
+        rv = run_queries(options->queries_path, NULL, &qopts, NULL);
+    }
+
+    if (rv && options->serve_path) {
+        trie_t *trie = NULL;
+
+        rv = serve(options->serve_path, &trie, &qopts, NULL, 0, options->jobs,
+                   NULL);
+    }
+
+    shard_destroy(shards);
+    return rv;
+}
+
+static void warn_skipped(size_t nskipped)
+{
+    if (nskipped) {
+        fprintf(stderr, "Warning: skipped %zu line%s holding a nul byte.\n",
+            nskipped, nskipped == 1 ? "" : "s");
+    }
+}
+
+/* Reads the whole word list, and splits it into the shards of --shards, whose
+ * images and manifest are written next to the path of --save.
+ */
+static bool build_shards(FILE *in_file, const flags *options,
+                         unsigned create_flags)
+{
+    size_t nbytes = 0;
+    size_t nlines = 0;
+    size_t nskipped = 0;
+    char *const content = io_read_file(in_file, &nbytes);
+    char **const lines = content
+                       ? io_split_lines_valid(content, nbytes, &nlines, &nskipped)
+                       : NULL;
+
+    if (lines == NULL) {
+        free(content);
+        perror("fread()");
+        return false;
+    }
+
+    const ShardBuildOptions opts = {
+        .flags = create_flags,
+        .minimize = options->mflag,
+        .relayout = options->Rflag,
+        .freeze = options->Dflag,
+    };
+    const bool rv = shard_build(lines, nlines, options->shards,
+                                options->save_path, &opts);
+
+    warn_skipped(nskipped);
+    free(lines);
+    free(content);
+    return rv;
+}
+
+int main(int argc, char *argv[])
+{
+
+    /* Sanity check. POSIX requires the invoking process to pass a non-NULL 
+     * argv[0]. 
+     */
+    if (!argv[0]) {
+        fprintf(stderr,
+            "A NULL argv[0] was passed through an exec system call.\n");
+        return EXIT_FAILURE;
+    }
+
+    static const struct option long_options[] = {
+        { "keep", no_argument, NULL, 'k' },
+        { "help", no_argument, NULL, 'h' },
+        { "svg", no_argument, NULL, 's' },
+        { "complete", required_argument, NULL, 'c' },
+        { "prefix", required_argument, NULL, 'p' },
+        { "output", required_argument, NULL, 'o' },
+        { "format", required_argument, NULL, 'T' },
+        { "top", required_argument, NULL, 'n' },
+        { "fuzzy", required_argument, NULL, 'f' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "limit", required_argument, NULL, 'l' },
+        { "offset", required_argument, NULL, 'O' },
+        { "after", required_argument, NULL, 'a' },
+        { "radix", no_argument, NULL, 'r' },
+        { "huge-pages", no_argument, NULL, 'H' },
+        { "minimize", no_argument, NULL, 'm' },
+        { "relayout", no_argument, NULL, 'R' },
+        { "double-array", no_argument, NULL, 'D' },
+        { "sorted", no_argument, NULL, 'b' },
+        { "stats", no_argument, NULL, 't' },
+        { "save", required_argument, NULL, 'S' },
+        { "load", required_argument, NULL, 'L' },
+        { "delta", required_argument, NULL, 'd' },
+        { "serve", required_argument, NULL, 'u' },
+        { "queries", required_argument, NULL, 'q' },
+        { "weights", no_argument, NULL, 'W' },
+        { "shards", required_argument, NULL, 'P' },
+        { "route", required_argument, NULL, 'M' },
+        { "cache", required_argument, NULL, 'C' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    FILE *in_file = stdin;
+    flags options = { 0 };
+    const char *search_prefix = NULL;
+
+    parse_options(long_options, &options, argc, argv, &search_prefix);
+
+    if (!options.sflag && !options.cflag && !options.save_path 
+        && !options.serve_path && !options.queries_path) {
+        usage_err(PROGRAM_NAME);
+    }
+
+    if ((options.limit || options.offset || options.after) 
+        && (options.top_k || options.max_edits)) {
+        fputs("Error: -l/--limit, -O/--offset and -a/--after page through the "
+            "completions in lexicographic order, and do not combine with "
+            "-n/--top or -f/--fuzzy.\n", stderr);
+        usage_err(PROGRAM_NAME);
+    }
+
+    if (options.shards
+        && (!options.save_path || options.load_path || options.bflag
+            || options.delta_path || options.jobs > 1 || options.cflag
+            || options.sflag || options.queries_path || options.serve_path
+            || options.route_path || options.tflag)) {
+        fputs("Error: -P/--shards builds the shards of a word list next to the "
+            "manifest of -S/--save, and does not combine with -L, -b, -d, -j, "
+            "-c, -s, -q, -u, -M or -t.\n", stderr);
+        usage_err(PROGRAM_NAME);
+    }
+
+    if (options.route_path
+        && ((optind + 1) == argc || options.load_path || options.save_path
+            || options.bflag || options.delta_path || options.cflag
+            || options.sflag || options.tflag || options.cache_mb)) {
+        fputs("Error: -M/--route answers -q/--queries and -u/--serve from the "
+            "shards alone, and does not combine with a word list, -L, -S, -b, "
+            "-d, -c, -s, -t or -C.\n", stderr);
+        usage_err(PROGRAM_NAME);
+    }
+
+    if (options.serve_path && options.delta_path
+        && (options.mflag || options.Dflag)) {
+        fputs("Error: -d/--delta with -u/--serve updates the trie on SIGHUP, "
+            "which -m/--minimize and -D/--double-array make read-only.\n",
+            stderr);
+        usage_err(PROGRAM_NAME);
+    }
+
+    if (options.route_path) {
+        return run_router(&options) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (options.queries_path && strcmp(options.queries_path, "-") == 0
+        && !options.load_path && (optind + 1) != argc) {
+        fputs("Error: the word list and the queries can not both be read "
+            "from stdin.\n", stderr);
+        usage_err(PROGRAM_NAME);
+    }
+
+    if ((optind + 1) == argc) {
+        if (options.load_path) {
+            fputs("Error: a word list specified with -L/--load.\n", stderr);
+            usage_err(PROGRAM_NAME);
+        }
+
+        in_file = fopen(argv[optind], "r");
+        if (in_file == NULL) {
+            perror(argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind > argc) {
+        usage_err(PROGRAM_NAME);
+    }
+
+    const unsigned create_flags = (options.rflag ? TRIE_RADIX : 0)
+                                | (options.Hflag ? TRIE_HUGE_PAGES : 0);
+    size_t nlines = 0;
+    size_t nskipped = 0;
+    bool rv = true;
+    trie_t *trie = NULL;
+    Stats stats_buf = { .queries = 0 };
+    Stats *const stats = options.tflag ? &stats_buf : NULL;
+    double start = stats_clock(stats);
+    /* A sorted build minimizes as it goes, unless a delta is to be applied
+     * first, and writes the image as it goes, unless the trie is to be changed
+     * before it is saved.
+     */
+    const bool minimized = options.bflag && options.mflag && !options.delta_path;
+    const bool saved = options.bflag && options.save_path && !options.delta_path
+                    && (minimized || !options.mflag) && !options.Rflag
+                    && !options.Dflag;
+
+    if (options.shards) {
+        rv = build_shards(in_file, &options, create_flags);
+        goto cleanup;
+    }
+
+    if (options.load_path) {
+        if ((trie = trie_load(options.load_path)) == NULL) {
+            rv = !rv;
+            goto cleanup;
+        }
+        stats_stop(stats, PHASE_LOAD, start);
+
+        trie_stats_t st;
+
+        trie_get_stats(trie, &st);
+
+        if (options.serve_path && options.delta_path
+            && (st.minimized || st.double_array)) {
+            fprintf(stderr, "Error: %s is a minimized or frozen image, which "
+                "is read-only, so -d/--delta can not update it on SIGHUP.\n",
+                options.load_path);
+            rv = !rv;
+            goto cleanup;
+        }
+    } else if (options.bflag) {
+        const unsigned sorted_flags = create_flags | (minimized ? TRIE_MINIMIZE : 0);
+
+        if ((trie = trie_build_sorted(in_file, sorted_flags,
+                                      saved ? options.save_path : NULL,
+                                      &nlines, &nskipped)) == NULL) {
+            rv = !rv;
+            goto cleanup;
+        }
+        stats_stop(stats, PHASE_INSERT, start);
+    } else if (options.jobs > 1) {
+        /* A parallel build partitions all the lines up front, so it needs
+         * the whole word list in memory.
+         */
+        size_t nbytes = 0;
+        char *const content = io_read_file(in_file, &nbytes);
+
+        stats_stop(stats, PHASE_READ, start);
+        start = stats_clock(stats);
+
+        char **lines = content 
+                     ? io_split_lines_valid(content, nbytes, &nlines, &nskipped)
+                     : NULL;
+
+        if (lines == NULL) {
+            free(content);
+            perror("fread()");
+            return EXIT_FAILURE;
+        }
+
+        stats_stop(stats, PHASE_SPLIT, start);
+        start = stats_clock(stats);
+
+        if ((trie = trie_create(create_flags)) == NULL
+            || !trie_insert_lines(trie, lines, nlines, options.jobs)) {
+            rv = !rv;
+            goto cleanup;
+        }
+        stats_stop(stats, PHASE_INSERT, start);
+    } else {
+        if ((trie = trie_create(create_flags)) == NULL
+            || !trie_insert_stream(trie, in_file, &nlines, &nskipped)) {
+            rv = !rv;
+            goto cleanup;
+        }
+        stats_stop(stats, PHASE_INSERT, start);
+    }
+
+    /* The updates go in before the trie is made read-only below. Without
+     * --serve, the delta is applied whole, a last line without a newline
+     * included. With --serve alone, serve() records it in an overlay instead,
+     * as it does what is appended to it later, so that a loaded image is not
+     * copied out of its mapping for it; -q needs it applied here.
+     */
+    size_t delta_offset = 0;
+
+    start = stats_clock(stats);
+
+    if (options.delta_path && (!options.serve_path || options.queries_path)
+        && !apply_delta_file(trie, options.delta_path, &delta_offset, 
+                             !options.serve_path)) {
+        rv = !rv;
+        goto cleanup;
+    }
+
+    stats_stop(stats, PHASE_DELTA, start);
+    start = stats_clock(stats);
+
+    /* Give back the slack of the last doubling of the pools. */
+    trie_shrink_to_fit(trie);
+
+    if ((options.mflag && !minimized && !trie_minimize(trie))
+        || (options.Rflag && !trie_relayout(trie))
+        || (options.Dflag && !trie_freeze(trie))) {
+        rv = !rv;
+        goto cleanup;
+    }
+
+    stats_stop(stats, PHASE_FINISH, start);
+
+    warn_skipped(nskipped);
+
+    D(
+        trie_stats_t st;
+
+        trie_get_stats(trie, &st);
+
+        /* What the same trie took with the former fixed 95-slot layout. */
+        const size_t fixed_sz = st.nodes 
+                              * (sizeof (int32_t) * 95 + sizeof (bool));
+        const size_t keys = st.keys ? st.keys : 1;
+        char *const total = calculate_size(st.bytes_allocated);
+        char *const used = calculate_size(st.bytes_used);
+
+        debug_printf("Total lines read: %zu.\n" "Total keys: %zu.\n" 
+                    "Total nodes allocated: %zu.\n" 
+                    "Total nodes used: %zu.\n"
+                    "Total edges allocated: %zu.\n" 
+                    "Total edges used: %zu.\n"
+                    "Total edge text: %zu bytes.\n"
+                    "Total memory allocated: %s.\n" "Total memory used: %s.\n"
+                    "Bytes per key: %.1f (fixed 95-slot layout: %.1f).\n",
+                    nlines, 
+                    st.keys,
+                    st.nodes_allocated, 
+                    st.nodes, 
+                    st.edges_allocated,
+                    st.edges,
+                    st.text,
+                    total, 
+                    used,
+                    (double) st.bytes_used / (double) keys,
+                    (double) fixed_sz / (double) keys); 
+        /* free(total); */
+        /* free(used); */
+    );
+    
+    start = stats_clock(stats);
+
+    if (options.save_path && !saved && !trie_save(trie, options.save_path)) {
+        rv = !rv;
+        goto cleanup;
+    }
+
+    stats_stop(stats, PHASE_SAVE, start);
+
+    if (options.sflag || options.cflag) {
+        const char *graph_path = options.graph_path;
+        char *default_path = NULL;
+
+        if (options.sflag && graph_path == NULL) {
+            graph_path = default_path = graph_default_path(&options);
+        }
+
+        rv = (!options.sflag || graph_path)
+            && process_args(trie, &options, search_prefix, graph_path, stats);
+        free(default_path);
+    }
+
+    const QueryOptions qopts = { 
+        .top_k = options.top_k, 
+        .max_edits = options.max_edits,
+        .weights = options.Wflag,
+        .cache_size = options.cache_mb * 1024 * 1024,
+    };
+
+    start = stats_clock(stats);
+
+    if (rv && options.queries_path) {
+        rv = run_queries(options.queries_path, trie, &qopts, stats);
+    }
+
+    if (rv && options.serve_path) {
+        rv = serve(options.serve_path, &trie, &qopts, options.delta_path, 
+                   delta_offset, options.jobs, stats ? &stats->cache : NULL);
+    }
+
+    stats_stop(stats, PHASE_QUERY, start);
+
+    if (rv && stats) {
+        rv = print_stats(stats, trie, nlines, nskipped);
+    }
+
+  cleanup:
+    /* We're exiting. There's no need of freeing memory. */
+    /* trie_destroy(trie); */
+    /* free(content); */
+    /* free(lines); */
+
+    if (in_file != stdin) {
+        fclose(in_file);
+    }
+
+    return rv ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,1559 @@
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+#define _POSIX_C_SOURCE 200819L
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#define IO_IMPLEMENTATION
+#define IO_STATIC
+#include "io.h"
+
+#include "server.h"
+#include "shard.h"
+
+typedef struct {
+    FILE *sink;
+    size_t count;
+    bool weights;
+} Answer;
+
+static bool answer_line(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Answer *const ans = ctx;
+
+    ++ans->count;
+
+    if (fwrite(key, 1, len, ans->sink) != len) {
+        return false;
+    }
+    return ans->weights ? fprintf(ans->sink, "\t%" PRIu32 "\n", weight) > 0
+                        : fputc('\n', ans->sink) != EOF;
+}
+
+/* A version of the trie a server answers from: a base that nothing modifies
+ * while it is served, and the updates applied since, recorded in an overlay of
+ * two small tries by trie_record_delta().
+ */
+typedef struct {
+    trie_t *base;
+    trie_t *adds;               /* The keys inserted, with the weight they add. */
+    trie_t *dels;               /* The keys removed from the base. */
+} Snapshot;
+
+/* A completion held for merging. The key is at `offset` of the text of the
+ * overlay until they are all collected, and at `key` then.
+ */
+typedef struct {
+    size_t offset;
+    const char *key;
+    size_t len;
+    uint32_t weight;
+} Completion;
+
+/* What a worker needs to answer from a snapshot on top of the cursors on its
+ * base: a cursor on each trie of the overlay, and the completions of the query
+ * being merged, the first `nadded` of which are those of the overlay.
+ */
+typedef struct {
+    const Snapshot *snap;
+    trie_cursor_t *adds;
+    trie_cursor_t *dels;
+    Completion *keys;
+    size_t nkeys;
+    size_t nadded;
+    size_t capacity;
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+    size_t next;                /* The next added key to merge in. */
+    Answer *ans;
+} Overlay;
+
+/* Appends the key of `len` bytes at `key` and its weight to the completions of
+ * `ov`.
+ */
+static bool keep_key(Overlay *ov, const char *key, size_t len, uint32_t weight)
+{
+    if (ov->nkeys >= ov->capacity) {
+        const size_t cap = ov->capacity ? ov->capacity * 2 : 64;
+        Completion *const tmp = realloc(ov->keys, sizeof *tmp * cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+        ov->keys = tmp;
+        ov->capacity = cap;
+    }
+
+    if (ov->text == NULL || ov->text_len + len > ov->text_capacity) {
+        size_t cap = ov->text_capacity ? ov->text_capacity : 1024;
+
+        while (ov->text_len + len > cap) {
+            cap *= 2;
+        }
+
+        char *const tmp = realloc(ov->text, cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+        ov->text = tmp;
+        ov->text_capacity = cap;
+    }
+
+    memcpy(ov->text + ov->text_len, key, len);
+    ov->keys[ov->nkeys++] = (Completion) { ov->text_len, NULL, len, weight };
+    ov->text_len += len;
+    return true;
+}
+
+/* Keeps a key of the overlay, with the weight it has in the updated trie. */
+static bool keep_added(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Overlay *const ov = ctx;
+    uint32_t base = 0;
+
+    if (!trie_lookup(ov->snap->dels, key, len, NULL)
+        && trie_lookup(ov->snap->base, key, len, &base)) {
+        weight = base > UINT32_MAX - weight ? UINT32_MAX : weight + base;
+    }
+    return keep_key(ov, key, len, weight);
+}
+
+/* Keeps a key of the base, unless the overlay removes it, or has it already. */
+static bool keep_base(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Overlay *const ov = ctx;
+
+    return trie_lookup(ov->snap->dels, key, len, NULL)
+        || trie_lookup(ov->snap->adds, key, len, NULL)
+        || keep_key(ov, key, len, weight);
+}
+
+static bool count_key(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    (void) key;
+    (void) len;
+    (void) weight;
+    ++*(size_t *) ctx;
+    return true;
+}
+
+/* Orders keys as trie_complete() passes them: bytes first, then length. */
+static int compare_keys(const char *a, size_t a_len, const char *b, 
+                        size_t b_len)
+{
+    const int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    return cmp ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_completions(const void *a, const void *b)
+{
+    const Completion *const x = a;
+    const Completion *const y = b;
+
+    if (x->weight != y->weight) {
+        return x->weight > y->weight ? -1 : 1;
+    }
+    return compare_keys(x->key, x->len, y->key, y->len);
+}
+
+/* Answers a key of the base, after the added keys before it, unless the
+ * overlay removes it, or has it among its own.
+ */
+static bool merge_base(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Overlay *const ov = ctx;
+
+    for (; ov->next < ov->nadded; ++ov->next) {
+        const Completion *const c = ov->keys + ov->next;
+        const int cmp = compare_keys(c->key, c->len, key, len);
+
+        if (cmp == 0) {
+            return true;
+        }
+
+        if (cmp > 0) {
+            break;
+        }
+
+        if (!answer_line(ov->ans, c->key, c->len, c->weight)) {
+            return false;
+        }
+    }
+    return trie_lookup(ov->snap->dels, key, len, NULL)
+        || answer_line(ov->ans, key, len, weight);
+}
+
+/* Passes the `k` best completions of `prefix` in the base, the position of
+ * `cur` if the query is not fuzzy, or all of them if `k` is zero, to `emit`.
+ */
+static bool complete_base(trie_cursor_t *cur, const char *prefix,
+                          const QueryOptions *qopts, size_t k, 
+                          trie_emit_fn *emit, void *ctx)
+{
+    return qopts->max_edits
+         ? trie_complete_fuzzy(cur, prefix, qopts->max_edits, k, emit, ctx)
+         : trie_complete(cur, k, emit, ctx);
+}
+
+/* Answers `prefix` with the completions of the base, on `cur`, with the
+ * updates of the overlay of `ov` applied, unless it is NULL. The completions
+ * of the overlay are all collected, which is cheap as long as it is small, and
+ * a query it has none for, nor removals, is answered from the base alone.
+ * Otherwise, all the completions are merged in key order, the added keys with
+ * those of the base the overlay leaves as they are; or, for the `top_k` best,
+ * the base is asked for as many more of its best as the overlay has keys that
+ * could push them out, for the best of those that are left to be sorted with
+ * the added keys.
+ */
+static bool complete(trie_cursor_t *cur, Overlay *ov, const char *prefix,
+                     const QueryOptions *qopts, Answer *ans)
+{
+    if (ov == NULL) {
+        return complete_base(cur, prefix, qopts, qopts->top_k, answer_line, 
+                             ans);
+    }
+
+    size_t ndels = 0;
+    bool ok = true;
+
+    ov->nkeys = 0;
+    ov->text_len = 0;
+
+    if (qopts->max_edits) {
+        ok = trie_complete_fuzzy(ov->adds, prefix, qopts->max_edits, 0, 
+                                 keep_added, ov)
+          && trie_complete_fuzzy(ov->dels, prefix, qopts->max_edits, 0, 
+                                 count_key, &ndels);
+    } else {
+        trie_find_prefix(ov->adds, prefix);
+        trie_find_prefix(ov->dels, prefix);
+        ok = trie_complete(ov->adds, 0, keep_added, ov);
+        ndels = trie_count_completions(ov->dels);
+    }
+
+    ov->nadded = ov->nkeys;
+
+    if (!ok || (ov->nadded == 0 && ndels == 0)) {
+        return ok && complete_base(cur, prefix, qopts, qopts->top_k, 
+                                   answer_line, ans);
+    }
+
+    if (qopts->top_k) {
+        const size_t extra = ov->nadded + ndels;
+        const size_t k = qopts->top_k > SIZE_MAX - extra 
+                       ? SIZE_MAX : qopts->top_k + extra;
+
+        if (!complete_base(cur, prefix, qopts, k, keep_base, ov)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ov->nkeys; ++i) {
+        ov->keys[i].key = ov->text + ov->keys[i].offset;
+    }
+
+    if (qopts->top_k) {
+        qsort(ov->keys, ov->nkeys, sizeof *ov->keys, compare_completions);
+
+        const size_t n = qopts->top_k < ov->nkeys ? qopts->top_k : ov->nkeys;
+
+        for (size_t i = 0; i < n; ++i) {
+            if (!answer_line(ans, ov->keys[i].key, ov->keys[i].len, 
+                             ov->keys[i].weight)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    ov->next = 0;
+    ov->ans = ans;
+    ok = complete_base(cur, prefix, qopts, 0, merge_base, ov);
+
+    for (; ok && ov->next < ov->nadded; ++ov->next) {
+        const Completion *const c = ov->keys + ov->next;
+
+        ok = answer_line(ans, c->key, c->len, c->weight);
+    }
+    return ok;
+}
+
+/* The longest key of an answer in a cache: a prefix, a nul byte, and the
+ * options it is answered with.
+ */
+#define ANSWER_KEY_MAX (TRIE_PREFIX_MAX + 64)
+
+/* Answers `prefix` with the completions at the position of `cur`, or of the 
+ * prefixes within `qopts->max_edits` of it, with the updates of the overlay of
+ * `ov` applied, unless it is NULL. If `frame` is not NULL, the answer is also
+ * copied to a buffer at `*frame`, of `*frame_len` bytes, for the caller to
+ * cache and free; `*frame` is NULL if there was no memory for it.
+ */
+static bool answer_at(FILE *sink, trie_cursor_t *cur, Overlay *ov,
+                      const char *prefix, const QueryOptions *qopts, 
+                      char **frame, size_t *frame_len)
+{
+    char *body = NULL;
+    size_t body_len = 0;
+    Answer ans = {
+        .sink = open_memstream(&body, &body_len),
+        .weights = qopts->weights
+    };
+
+    if (ans.sink == NULL) {
+        perror("open_memstream()");
+        return false;
+    }
+
+    const bool ok = complete(cur, ov, prefix, qopts, &ans);
+
+    if (fclose(ans.sink) || !ok) {
+        if (ok) {
+            perror("fclose()");
+        }
+        free(body);
+        return false;
+    }
+
+    const int head_len = fprintf(sink, "%zu\t%s\n", ans.count, prefix);
+    const bool rv = head_len > 0 && io_write_file(sink, body_len, body);
+
+    if (rv && frame) {
+        *frame = malloc((size_t) head_len + 1 + body_len);
+
+        if (*frame) {
+            sprintf(*frame, "%zu\t%s\n", ans.count, prefix);
+            memcpy(*frame + head_len, body, body_len);
+            *frame_len = (size_t) head_len + body_len;
+        }
+    }
+
+    free(body);
+    return rv;
+}
+
+/* Writes the key of the answer to `prefix` in a cache to `key`, and returns
+ * its length, or 0 if the prefix is too long to have completions, and to be
+ * worth caching.
+ */
+static size_t answer_key(char *key, const char *prefix,
+                         const QueryOptions *qopts)
+{
+    const size_t len = strlen(prefix);
+
+    if (len >= TRIE_PREFIX_MAX) {
+        return 0;
+    }
+
+    memcpy(key, prefix, len);
+    key[len] = '\0';
+    return len + 1 + (size_t) sprintf(key + len + 1, "%zu %zu %d",
+                                      qopts->top_k, qopts->max_edits,
+                                      qopts->weights);
+}
+
+bool answer_query(FILE *sink, trie_cursor_t *cur, const char *prefix,
+                  const QueryOptions *qopts)
+{
+    /* An unknown prefix leaves the cursor positioned nowhere, where there are 
+     * no completions.
+     */
+    if (!qopts->max_edits) {
+        trie_find_prefix(cur, prefix);
+    }
+    return answer_at(sink, cur, NULL, prefix, qopts, NULL, NULL);
+}
+
+/* Answers queries as answer_queries() does, with the updates of the overlay of
+ * `ov` applied, unless it is NULL.
+ */
+static bool answer_batch(FILE *sink, trie_cursor_t *const *curs, Overlay *ov,
+                         Cache *cache, const char *const *prefixes, size_t n,
+                         const QueryOptions *qopts, bool *cached)
+{
+    const char *hits[TRIE_FIND_BATCH] = { NULL };
+    size_t hit_lens[TRIE_FIND_BATCH];
+    size_t key_lens[TRIE_FIND_BATCH] = { 0 };
+    trie_cursor_t *miss_curs[TRIE_FIND_BATCH];
+    const char *misses[TRIE_FIND_BATCH];
+    size_t nmisses = 0;
+    char key[ANSWER_KEY_MAX];
+
+    /* Only the queries that miss the cache are looked up. */
+    for (size_t i = 0; i < n; ++i) {
+        if (cache && (key_lens[i] = answer_key(key, prefixes[i], qopts))) {
+            hits[i] = cache_get(cache, key, key_lens[i], hit_lens + i);
+        }
+
+        if (hits[i] == NULL) {
+            miss_curs[nmisses] = curs[i];
+            misses[nmisses++] = prefixes[i];
+        }
+
+        if (cached) {
+            cached[i] = hits[i] != NULL;
+        }
+    }
+
+    if (!qopts->max_edits && nmisses) {
+        trie_find_prefixes(miss_curs, misses, nmisses, NULL);
+    }
+
+    /* The answers are only cached once the whole batch is written, for
+     * caching one could evict a hit that is yet to be written.
+     */
+    char *frames[TRIE_FIND_BATCH] = { NULL };
+    size_t frame_lens[TRIE_FIND_BATCH];
+    bool rv = true;
+
+    for (size_t i = 0; rv && i < n; ++i) {
+        rv = hits[i]
+           ? io_write_file(sink, hit_lens[i], hits[i])
+           : answer_at(sink, curs[i], ov, prefixes[i], qopts,
+                       key_lens[i] ? frames + i : NULL, frame_lens + i);
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (frames[i]) {
+            if (rv) {
+                cache_put(cache, key, answer_key(key, prefixes[i], qopts),
+                          frames[i], frame_lens[i]);
+            }
+            free(frames[i]);
+        }
+    }
+    return rv;
+}
+
+bool answer_queries(FILE *sink, trie_cursor_t *const *curs, Cache *cache,
+                    const char *const *prefixes, size_t n,
+                    const QueryOptions *qopts, bool *cached)
+{
+    return answer_batch(sink, curs, NULL, cache, prefixes, n, qopts, cached);
+}
+
+/* Returns what was appended to the delta file at `path` past its first
+ * `*offset` bytes, as apply_delta_file() takes it, in a buffer for the caller
+ * to free, and sets `*len` to its length; or returns NULL on failure. A file
+ * shorter than `*offset` sets it to 0.
+ */
+static char *read_delta(const char *path, size_t *offset, bool all, 
+                        size_t *len)
+{
+    const int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+
+        if (fd != -1) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    const size_t size = (size_t) st.st_size;
+
+    if (size < *offset) {
+        *offset = 0;
+    }
+
+    /* Only what was appended since the last time is read. */
+    const size_t want = size - *offset;
+    char *const buf = malloc(want ? want : 1);
+    size_t got = 0;
+
+    if (buf == NULL) {
+        perror("malloc()");
+        close(fd);
+        return NULL;
+    }
+
+    while (got < want) {
+        const ssize_t n = pread(fd, buf + got, want - got, 
+                                (off_t) (*offset + got));
+
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t) n;
+    }
+
+    close(fd);
+
+    size_t end = got;
+
+    if (!all) {
+        while (end && buf[end - 1] != '\n') {
+            --end;
+        }
+    }
+
+    *len = end;
+    return buf;
+}
+
+bool apply_delta_file(trie_t *trie, const char *path, size_t *offset, bool all)
+{
+    size_t end = 0;
+    char *const buf = read_delta(path, offset, all, &end);
+    bool rv = buf != NULL;
+
+    if (rv && end) {
+        FILE *const stream = fmemopen(buf, end, "r");
+
+        if (stream == NULL) {
+            perror("fmemopen()");
+            rv = false;
+        } else {
+            rv = trie_apply_delta(trie, stream, NULL, NULL);
+            fclose(stream);
+        }
+    }
+
+    /* A delta that failed is applied again next time, from the start, which
+     * the caller makes sure is to a trie it has not changed halfway.
+     */
+    if (rv) {
+        *offset += end;
+    }
+    free(buf);
+    return rv;
+}
+
+/* The server runs an epoll loop on each of its worker threads. Every loop
+ * polls the listening socket, so connections are spread across the workers,
+ * and a client is served by the worker that accepted it until it leaves.
+ * Every client has a buffer for the partial line it is sending and a buffer
+ * for the answers that are yet to be sent; a client is only polled for output
+ * while the latter is non-empty. Once more than SERVE_OUT_MAX bytes of answers
+ * are pending, a client is no longer polled for input until they are all sent,
+ * so one that sends queries without reading the answers can not make the
+ * server buffer them without bound; and a worker reads at most
+ * SERVE_READ_BURST chunks from a client before it turns to the others. The
+ * complete lines of what a client sent are
+ * looked up TRIE_FIND_BATCH at a time, on as many cursors of the worker, so
+ * that the cache misses of their lookups overlap. A router has no trie, and
+ * its workers pass every batch on to the shards instead, over connections of
+ * their own, each of which only ever carries one batch at a time. With a
+ * cache, every worker has a cache of its own, of an equal share of its size,
+ * so that hits take no lock either. A worker empties its cache whenever the
+ * epoch has moved on since the batch before, for the snapshot may have too.
+ *
+ * The workers query a snapshot of the trie that nothing modifies, without
+ * taking any lock. A snapshot is a base trie and an overlay of the updates
+ * applied since (see Snapshot). An update is recorded by the main thread in a
+ * copy of the overlay, and a snapshot of the same base with the new overlay is
+ * then published by swapping a pointer atomically, so queries neither wait for
+ * an update nor see one halfway, and an update costs time and memory in
+ * proportion to the overlay, never to the base. The snapshot it replaced is
+ * reclaimed once no worker can still be reading it, which epochs tell: a
+ * worker records the global epoch when it starts on a batch of events, after
+ * which it loads the snapshot, and clears the record when it is done. After
+ * the swap, the main thread bumps the epoch, and waits for every worker to be
+ * either idle or on a batch started since, with the new snapshot.
+ *
+ * Every query pays for the overlay, so once it holds more than SERVE_FOLD_KEYS
+ * keys, a thread of its own folds it into a copy of the base, while the
+ * workers go on answering from the snapshot. The updates recorded in the
+ * meantime are kept aside, and once the fold is done, the main thread
+ * publishes its result with an overlay of those alone, and the old base is
+ * reclaimed as any snapshot is.
+ */
+#define SERVE_MAX_EVENTS 64
+#define SERVE_READ_CHUNK (1024 * 16)
+#define SERVE_READ_BURST 16
+#define SERVE_OUT_MAX (1024 * 1024)
+#define SERVE_FOLD_KEYS 4096
+
+/* Wake only one of the workers polling for a connection, where supported. */
+#ifdef EPOLLEXCLUSIVE
+#define SERVE_EXCLUSIVE EPOLLEXCLUSIVE
+#else
+#define SERVE_EXCLUSIVE 0
+#endif
+
+typedef struct Server Server;
+
+typedef struct {
+    Server *server;
+    pthread_t thread;
+    uint64_t epoch;             /* When the current batch started; 0 if idle. */
+    CacheStats cache;           /* Those of its cache, once it has stopped. */
+    bool ok;
+} Worker;
+
+/* A fold of the overlay of a snapshot into a copy of its base. */
+typedef struct {
+    pthread_t thread;
+    bool running;               /* Started, and yet to be joined. */
+    bool done;                  /* Set by the thread once it is done. */
+    bool lost;                  /* An update failed to be kept aside. */
+    const trie_t *base;
+    trie_t *adds;               /* A copy of the overlay to fold. */
+    trie_t *dels;
+    trie_t *result;             /* The folded trie; NULL on failure. */
+    FILE *pending;              /* The delta lines recorded since it started. */
+    char *pending_buf;
+    size_t pending_len;
+} Fold;
+
+struct Server {
+    int listen_fd;
+    int wake_fd;                /* Readable once the workers are to stop. */
+    pthread_t main;
+    const QueryOptions *qopts;
+    Snapshot *snap;             /* The current snapshot; NULL in a router. */
+    uint64_t epoch;
+    Worker *workers;
+    size_t nworkers;
+    Fold fold;
+};
+
+/* The queries of a client a worker has yet to answer, and its cursors, or
+ * its connections to the shards.
+ */
+typedef struct {
+    trie_cursor_t *curs[TRIE_FIND_BATCH];
+    Overlay overlay;
+    Cache *cache;               /* NULL without a cache. */
+    ShardLinks *links;
+    const char *prefixes[TRIE_FIND_BATCH];
+    size_t n;
+} Batch;
+
+typedef struct {
+    int fd;
+    bool eof;                   /* The client has shut down its end. */
+    bool throttled;             /* Not read from until `out` is sent. */
+    QueryOptions qopts;         /* As set by the client, or by the server. */
+    char in[TRIE_PREFIX_MAX];
+    size_t in_len;
+    FILE *out;                  /* NULL if there is nothing to send. */
+    char *out_buf;
+    size_t out_len;
+    size_t out_off;
+} Client;
+
+static bool set_nonblocking(int fd)
+{
+    const int fl = fcntl(fd, F_GETFL);
+
+    return fl != -1 && fcntl(fd, F_SETFL, fl | O_NONBLOCK) != -1;
+}
+
+static int serve_listen(const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Error: socket path too long.\n");
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        perror("socket()");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        /* A socket left behind by a server that is no longer running refuses
+         * connections. Take it over.
+         */
+        if (errno == EADDRINUSE) {
+            const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            const bool stale = probe != -1
+                && connect(probe, (struct sockaddr *) &addr, sizeof addr) == -1
+                && errno == ECONNREFUSED;
+
+            close(probe);
+
+            if (stale && unlink(path) == 0
+                && bind(fd, (struct sockaddr *) &addr, sizeof addr) == 0) {
+                goto bound;
+            }
+            errno = EADDRINUSE;
+        }
+
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+  bound:
+    if (listen(fd, SOMAXCONN) == -1 || !set_nonblocking(fd)) {
+        perror("listen()");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+static void client_close(int epfd, Client *client)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+
+    if (client->out) {
+        fclose(client->out);
+    }
+
+    free(client->out_buf);
+    free(client);
+}
+
+/* Sends as much pending output as the socket takes. Returns false if the
+ * client should be dropped.
+ */
+static bool client_flush(int epfd, Client *client)
+{
+    if (client->out == NULL) {
+        return true;
+    }
+
+    if (fflush(client->out)) {
+        return false;
+    }
+
+    while (client->out_off < client->out_len) {
+        const ssize_t n = send(client->fd, client->out_buf + client->out_off,
+                              client->out_len - client->out_off, MSG_NOSIGNAL);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return false;
+            }
+            
+            struct epoll_event ev = { 
+                .events = client->eof || client->throttled 
+                        ? EPOLLOUT : EPOLLIN | EPOLLOUT,
+                .data.ptr = client 
+            };
+            return epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev) == 0;
+        }
+        client->out_off += (size_t) n;
+    }
+
+    fclose(client->out);
+    free(client->out_buf);
+    client->out = NULL;
+    client->out_buf = NULL;
+    client->out_len = client->out_off = 0;
+    client->throttled = false;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, client->fd, &ev) == 0;
+}
+
+/* Queues the answers to the queries in `batch`, and empties it. */
+static bool client_answer(Client *client, Batch *batch)
+{
+    if (client->out == NULL) {
+        FILE *const out = open_memstream(&client->out_buf, &client->out_len);
+
+        if (out == NULL) {
+            return false;
+        }
+        client->out = out;
+    }
+
+    const size_t n = batch->n;
+
+    batch->n = 0;
+
+    if (batch->links == NULL) {
+        return answer_batch(client->out, batch->curs, &batch->overlay,
+                            batch->cache, batch->prefixes, n, &client->qopts,
+                            NULL);
+    }
+
+    /* The queries the shards failed to answer are answered with errors, so
+     * the client is only dropped if its answers could not be written.
+     */
+    if (!shard_answer(batch->links, client->out, batch->prefixes, n,
+                      &client->qopts, NULL)) {
+        return false;
+    }
+    return true;
+}
+
+/* Sets the options of the queries that follow from the `K N W` at `line`. */
+static bool client_configure(Client *client, const char *line)
+{
+    size_t top_k = 0;
+    size_t max_edits = 0;
+    unsigned weights = 0;
+    char extra = '\0';
+
+    if (sscanf(line, "%zu %zu %u%c", &top_k, &max_edits, &weights, &extra) != 3
+        || weights > 1) {
+        return false;
+    }
+
+    client->qopts.top_k = top_k;
+    client->qopts.max_edits = max_edits;
+    client->qopts.weights = weights;
+    return true;
+}
+
+/* Adds the `len` bytes of the line at `line`, which has room for a nul byte
+ * after them, to `batch`, and answers the batch once it is full. A line that
+ * starts with a nul byte sets options instead, once the queries before it are
+ * answered.
+ */
+static bool client_queue(Client *client, Batch *batch, char *line, size_t len)
+{
+    if (len && line[len - 1] == '\r') {
+        --len;
+    }
+
+    line[len] = '\0';
+
+    if (len && line[0] == '\0') {
+        return (batch->n == 0 || client_answer(client, batch))
+            && client_configure(client, line + 1);
+    }
+
+    batch->prefixes[batch->n++] = line;
+    return batch->n < TRIE_FIND_BATCH || client_answer(client, batch);
+}
+
+/* Returns the number of bytes of answers the client is yet to be sent, or
+ * SIZE_MAX if they could not be flushed.
+ */
+static size_t client_pending(Client *client)
+{
+    if (client->out == NULL) {
+        return 0;
+    }
+    return fflush(client->out) ? SIZE_MAX : client->out_len - client->out_off;
+}
+
+/* Reads what the client has sent and answers every complete line, until it
+ * has sent nothing more, SERVE_READ_BURST chunks are read, or more than
+ * SERVE_OUT_MAX bytes of answers are pending, in which case the client is
+ * throttled. Returns false if the client should be dropped.
+ */
+static bool client_read(Client *client, Batch *batch)
+{
+    char chunk[SERVE_READ_CHUNK];
+
+    for (size_t chunks = 0; chunks < SERVE_READ_BURST; ++chunks) {
+        if (client_pending(client) > SERVE_OUT_MAX) {
+            client->throttled = true;
+            break;
+        }
+
+        const ssize_t n = recv(client->fd, chunk, sizeof chunk, 0);
+
+        if (n == 0) {
+            /* Answer a last query that is not terminated by a newline. */
+            const size_t len = client->in_len;
+
+            client->eof = true;
+            client->in_len = 0;
+            return len == 0 
+                || (client_queue(client, batch, client->in, len)
+                    && client_answer(client, batch));
+        }
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        /* The lines that came in whole are looked up where they are, and the
+         * batch is answered before the buffers it points into are reused.
+         */
+        for (char *p = chunk, *const end = chunk + n; p < end; ) {
+            char *const nl = memchr(p, '\n', (size_t) (end - p));
+            size_t len = (size_t) ((nl ? nl : end) - p);
+            char *line = p;
+
+            /* A query can not be longer than a prefix given on the command 
+             * line.
+             */
+            if (client->in_len + len >= sizeof client->in) {
+                return false;
+            }
+
+            if (nl == NULL || client->in_len) {
+                if (batch->n && !client_answer(client, batch)) {
+                    return false;
+                }
+
+                memcpy(client->in + client->in_len, p, len);
+                client->in_len += len;
+
+                if (nl == NULL) {
+                    break;
+                }
+
+                line = client->in;
+                len = client->in_len;
+                client->in_len = 0;
+            }
+
+            p = nl + 1;
+
+            if (!client_queue(client, batch, line, len)) {
+                return false;
+            }
+        }
+
+        if (batch->n && !client_answer(client, batch)) {
+            return false;
+        }
+    }
+
+    /* What is left is read when the client is polled next. */
+    return true;
+}
+
+static bool serve_accept(int epfd, int listen_fd, const QueryOptions *qopts)
+{
+    for (;;) {
+        const int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        Client *const client = calloc(1, sizeof *client);
+
+        if (client == NULL || !set_nonblocking(fd)) {
+            free(client);
+            close(fd);
+            continue;
+        }
+
+        client->fd = fd;
+        client->qopts = *qopts;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("epoll_ctl()");
+            free(client);
+            close(fd);
+        }
+    }
+}
+
+/* Handles the `events` polled for `client`, and drops it if it is done. */
+static void serve_client(int epfd, Client *client, uint32_t events, 
+                         Batch *batch)
+{
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)) {
+        client_close(epfd, client);
+        return;
+    }
+
+    if (events & EPOLLIN && !client_read(client, batch)
+        || !client_flush(epfd, client)
+        || client->eof && client->out == NULL) {
+        client_close(epfd, client);
+    }
+}
+
+/* Positions `*cur` at the root of `trie`, and creates it first if it is NULL. */
+static bool bind_cursor(trie_cursor_t **cur, const trie_t *trie)
+{
+    if (*cur == NULL) {
+        return (*cur = trie_cursor_create(trie)) != NULL;
+    }
+
+    trie_cursor_rebind(*cur, trie);
+    return true;
+}
+
+static void *serve_worker(void *arg)
+{
+    Worker *const w = arg;
+    Server *const srv = w->server;
+    const int epfd = epoll_create1(0);
+    struct epoll_event ev = { 
+        .events = EPOLLIN | SERVE_EXCLUSIVE, 
+        .data.ptr = NULL 
+    };
+    struct epoll_event wake = { .events = EPOLLIN, .data.ptr = srv };
+
+    if (epfd == -1 || epoll_ctl(epfd, EPOLL_CTL_ADD, srv->listen_fd, &ev) == -1
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, srv->wake_fd, &wake) == -1) {
+        perror("epoll()");
+
+        if (epfd != -1) {
+            close(epfd);
+        }
+
+        /* Have the main thread stop the others. */
+        pthread_kill(srv->main, SIGTERM);
+        return NULL;
+    }
+
+    /* Every worker has cursors of its own, bound to the snapshot it last
+     * answered queries on, or, in a router, connections to the shards of its
+     * own.
+     */
+    Batch batch = { .n = 0 };
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    const size_t cache_size = srv->qopts->cache_size / srv->nworkers;
+    uint64_t cache_epoch = 0;
+    const Snapshot *cache_snap = NULL;
+
+    w->ok = srv->qopts->shards == NULL
+         || (batch.links = shard_links_create(srv->qopts->shards)) != NULL;
+
+    if (w->ok && cache_size && (batch.cache = cache_create(cache_size)) == NULL) {
+        perror("cache_create()");
+        w->ok = false;
+    }
+
+    for (bool stop = !w->ok; !stop; ) {
+        const int n = epoll_wait(epfd, events, SERVE_MAX_EVENTS, -1);
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait()");
+            w->ok = false;
+            break;
+        }
+
+        const uint64_t epoch = __atomic_load_n(&srv->epoch, __ATOMIC_SEQ_CST);
+
+        __atomic_store_n(&w->epoch, epoch, __ATOMIC_SEQ_CST);
+
+        const Snapshot *const snap = __atomic_load_n(&srv->snap, 
+                                                     __ATOMIC_SEQ_CST);
+
+        /* The answers cached before an update may predate it. An update
+         * swaps the snapshot in before it moves the epoch on, so a batch can
+         * start with the new snapshot and the old epoch, and both are
+         * compared. A snapshot is only freed once no worker can be reading it,
+         * so a new one never has the address of the last within an epoch.
+         */
+        if (batch.cache && (epoch != cache_epoch || snap != cache_snap)) {
+            cache_clear(batch.cache);
+            cache_epoch = epoch;
+            cache_snap = snap;
+        }
+
+        bool bound = true;
+
+        for (size_t i = 0; snap && i < TRIE_FIND_BATCH; ++i) {
+            bound = bind_cursor(batch.curs + i, snap->base) && bound;
+        }
+
+        if (snap) {
+            batch.overlay.snap = snap;
+            bound = bound && bind_cursor(&batch.overlay.adds, snap->adds)
+                && bind_cursor(&batch.overlay.dels, snap->dels);
+        }
+
+        if (!bound) {
+            __atomic_store_n(&w->epoch, 0, __ATOMIC_RELEASE);
+            w->ok = false;
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == srv) {
+                stop = true;
+                continue;
+            }
+
+            Client *const client = events[i].data.ptr;
+
+            /* The listening socket is the only one without a client. */
+            if (client == NULL) {
+                if (!serve_accept(epfd, srv->listen_fd, srv->qopts)) {
+                    perror("accept()");
+                }
+                continue;
+            }
+
+            serve_client(epfd, client, events[i].events, &batch);
+        }
+
+        __atomic_store_n(&w->epoch, 0, __ATOMIC_RELEASE);
+    }
+
+    if (!w->ok) {
+        pthread_kill(srv->main, SIGTERM);
+    }
+
+    /* Clients still connected at this point are reclaimed by the exit. */
+    close(epfd);
+
+    for (size_t i = 0; i < TRIE_FIND_BATCH; ++i) {
+        trie_cursor_destroy(batch.curs[i]);
+    }
+
+    trie_cursor_destroy(batch.overlay.adds);
+    trie_cursor_destroy(batch.overlay.dels);
+    free(batch.overlay.keys);
+    free(batch.overlay.text);
+
+    if (batch.cache) {
+        cache_add_stats(batch.cache, &w->cache);
+        cache_destroy(batch.cache);
+    }
+    shard_links_destroy(batch.links);
+    return NULL;
+}
+
+/* Returns once no worker can be reading a snapshot swapped out before. */
+static void serve_synchronize(Server *srv)
+{
+    const uint64_t epoch = __atomic_add_fetch(&srv->epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (size_t i = 0; i < srv->nworkers; ++i) {
+        for (;;) {
+            const uint64_t e = __atomic_load_n(&srv->workers[i].epoch, 
+                                               __ATOMIC_SEQ_CST);
+
+            if (e == 0 || e >= epoch) {
+                break;
+            }
+            sched_yield();
+        }
+    }
+}
+
+/* Releases the overlay of `snap`, and its base as well if `base`. A null
+ * pointer is ignored.
+ */
+static void snapshot_destroy(Snapshot *snap, bool base)
+{
+    if (snap) {
+        if (base) {
+            trie_destroy(snap->base);
+        }
+
+        trie_destroy(snap->adds);
+        trie_destroy(snap->dels);
+        free(snap);
+    }
+}
+
+/* Returns a snapshot of `base` with an overlay of its own that holds the
+ * updates of that of `from`, if it is not NULL, and the delta lines of
+ * `stream`, if it is not NULL; or NULL on failure.
+ */
+static Snapshot *snapshot_create(trie_t *base, const Snapshot *from, 
+                                 FILE *stream)
+{
+    Snapshot *const snap = malloc(sizeof *snap);
+
+    if (snap == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    snap->base = base;
+    snap->adds = from ? trie_clone(from->adds) : trie_create(0);
+    snap->dels = from ? trie_clone(from->dels) : trie_create(0);
+
+    if (snap->adds == NULL || snap->dels == NULL
+        || (stream 
+            && !trie_record_delta(snap->adds, snap->dels, stream, NULL, NULL))) {
+        snapshot_destroy(snap, false);
+        return NULL;
+    }
+    return snap;
+}
+
+/* Returns the number of keys in the overlay of `snap`. */
+static size_t overlay_keys(const Snapshot *snap)
+{
+    trie_stats_t adds;
+    trie_stats_t dels;
+
+    trie_get_stats(snap->adds, &adds);
+    trie_get_stats(snap->dels, &dels);
+    return adds.keys + dels.keys;
+}
+
+/* Applies the updates of a trie, or removes its keys, as they are passed. */
+typedef struct {
+    trie_t *trie;
+    bool remove;
+    bool ok;
+    char *key;
+    size_t cap;
+} Folder;
+
+static bool fold_key(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    Folder *const f = ctx;
+
+    if (len >= f->cap) {
+        char *const tmp = realloc(f->key, len * 2 + 1);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return f->ok = false;
+        }
+        f->key = tmp;
+        f->cap = len * 2 + 1;
+    }
+
+    memcpy(f->key, key, len);
+    f->key[len] = '\0';
+    f->ok = f->remove ? trie_remove(f->trie, f->key)
+                      : trie_insert(f->trie, f->key, weight);
+    return f->ok;
+}
+
+/* Applies the updates recorded in `adds` and `dels` (see trie_record_delta())
+ * to `trie`.
+ */
+static bool fold_overlay(trie_t *trie, const trie_t *adds, const trie_t *dels)
+{
+    Folder f = { .trie = trie, .remove = true, .ok = true };
+    trie_cursor_t *const cur = trie_cursor_create(dels);
+    bool rv = cur && trie_complete(cur, 0, fold_key, &f) && f.ok;
+
+    if (rv) {
+        trie_cursor_rebind(cur, adds);
+        f.remove = false;
+        rv = trie_complete(cur, 0, fold_key, &f) && f.ok;
+    }
+
+    trie_cursor_destroy(cur);
+    free(f.key);
+    return rv;
+}
+
+/* Has the workers answer from `next` instead of the current snapshot, which
+ * is released once no worker reads it anymore, with its base unless `next`
+ * shares it.
+ */
+static void serve_publish(Server *srv, Snapshot *next)
+{
+    Snapshot *const prev = srv->snap;
+
+    __atomic_store_n(&srv->snap, next, __ATOMIC_SEQ_CST);
+    serve_synchronize(srv);
+    snapshot_destroy(prev, prev->base != next->base);
+}
+
+/* Records what was appended to the delta file in a copy of the overlay of the
+ * current snapshot, and publishes a snapshot of the same base with it. The
+ * base is neither copied nor modified, however big it is. If no whole line
+ * was appended, nothing is. Returns false on failure, in which case the
+ * workers go on with the snapshot they have.
+ */
+static bool serve_update(Server *srv, const char *delta_path, size_t *offset)
+{
+    size_t len = 0;
+    char *const buf = read_delta(delta_path, offset, false, &len);
+
+    if (buf == NULL || len == 0) {
+        free(buf);
+        return buf != NULL;
+    }
+
+    FILE *const stream = fmemopen(buf, len, "r");
+    Snapshot *next = NULL;
+
+    if (stream == NULL) {
+        perror("fmemopen()");
+    } else {
+        next = snapshot_create(srv->snap->base, srv->snap, stream);
+        fclose(stream);
+    }
+
+    /* The fold in progress misses what it is not given here. */
+    if (next && srv->fold.running 
+        && fwrite(buf, 1, len, srv->fold.pending) != len) {
+        srv->fold.lost = true;
+    }
+
+    free(buf);
+
+    if (next == NULL) {
+        return false;
+    }
+
+    *offset += len;
+    serve_publish(srv, next);
+    return true;
+}
+
+static void *serve_fold(void *arg)
+{
+    Server *const srv = arg;
+    Fold *const f = &srv->fold;
+    trie_t *const trie = trie_clone(f->base);
+
+    if (trie && fold_overlay(trie, f->adds, f->dels)) {
+        f->result = trie;
+    } else {
+        trie_destroy(trie);
+    }
+
+    __atomic_store_n(&f->done, true, __ATOMIC_SEQ_CST);
+
+    /* Have the main thread publish the result. */
+    pthread_kill(srv->main, SIGHUP);
+    return NULL;
+}
+
+static void fold_release(Fold *f)
+{
+    if (f->pending) {
+        fclose(f->pending);
+    }
+
+    free(f->pending_buf);
+    trie_destroy(f->adds);
+    trie_destroy(f->dels);
+    trie_destroy(f->result);
+    *f = (Fold) { .running = false };
+}
+
+/* Starts folding the overlay of the current snapshot into a copy of its base,
+ * unless it is small, or a fold is in progress already.
+ */
+static void serve_start_fold(Server *srv)
+{
+    Fold *const f = &srv->fold;
+
+    if (f->running || overlay_keys(srv->snap) <= SERVE_FOLD_KEYS) {
+        return;
+    }
+
+    *f = (Fold) {
+        .base = srv->snap->base,
+        .adds = trie_clone(srv->snap->adds),
+        .dels = trie_clone(srv->snap->dels),
+    };
+    f->pending = open_memstream(&f->pending_buf, &f->pending_len);
+
+    if (f->pending == NULL) {
+        perror("open_memstream()");
+    }
+
+    if (f->adds && f->dels && f->pending) {
+        errno = pthread_create(&f->thread, NULL, serve_fold, srv);
+        f->running = errno == 0;
+
+        if (errno) {
+            perror("pthread_create()");
+        }
+    }
+
+    if (!f->running) {
+        fold_release(f);
+    }
+}
+
+/* Once the fold in progress is done, or at once if `wait`, joins it, and
+ * publishes its result with an overlay of the delta lines recorded since it
+ * started. If it failed, the overlay is left as it is, and folded again with
+ * the next update.
+ */
+static void serve_finish_fold(Server *srv, bool wait)
+{
+    Fold *const f = &srv->fold;
+
+    if (!f->running || (!wait && !__atomic_load_n(&f->done, __ATOMIC_SEQ_CST))) {
+        return;
+    }
+
+    pthread_join(f->thread, NULL);
+
+    Snapshot *next = NULL;
+
+    if (f->result && !f->lost && fflush(f->pending) == 0) {
+        FILE *const stream = f->pending_len 
+                           ? fmemopen(f->pending_buf, f->pending_len, "r") 
+                           : NULL;
+
+        if (f->pending_len && stream == NULL) {
+            perror("fmemopen()");
+        } else {
+            next = snapshot_create(f->result, NULL, stream);
+        }
+
+        if (stream) {
+            fclose(stream);
+        }
+    }
+
+    if (next) {
+        f->result = NULL;
+        serve_publish(srv, next);
+    }
+    fold_release(f);
+}
+
+bool serve(const char *path, trie_t **trie, const QueryOptions *qopts,
+           const char *delta_path, size_t delta_offset, size_t nworkers,
+           CacheStats *cache_stats)
+{
+    /* The signals are blocked before the workers start, for them to inherit
+     * the mask, so that they are all taken by the sigwait() below.
+     */
+    sigset_t set;
+    sigset_t old;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+
+    if (delta_path) {
+        sigaddset(&set, SIGHUP);
+    }
+
+    errno = pthread_sigmask(SIG_BLOCK, &set, &old);
+
+    if (errno) {
+        perror("pthread_sigmask()");
+        return false;
+    }
+
+    Server srv = { 
+        .listen_fd = serve_listen(path),
+        .main = pthread_self(),
+        .qopts = qopts, 
+        .epoch = 1,
+        .nworkers = nworkers ? nworkers : 1,
+    };
+    int wake[2] = { -1, -1 };
+    bool rv = srv.listen_fd != -1;
+
+    if (rv && (pipe(wake) == -1 
+               || (srv.workers = calloc(srv.nworkers, sizeof *srv.workers)) == NULL)) {
+        perror("serve()");
+        rv = false;
+    }
+
+    /* The delta as it is before the workers start is recorded the same way as
+     * what is appended to it later, so that the base is never copied.
+     */
+    if (rv && *trie 
+        && ((srv.snap = snapshot_create(*trie, NULL, NULL)) == NULL
+            || (delta_path && !serve_update(&srv, delta_path, &delta_offset)))) {
+        rv = false;
+    }
+
+    if (rv && srv.snap) {
+        serve_start_fold(&srv);
+    }
+
+    srv.wake_fd = wake[0];
+
+    size_t started = 0;
+
+    for (; rv && started < srv.nworkers; ++started) {
+        Worker *const w = srv.workers + started;
+
+        w->server = &srv;
+        errno = pthread_create(&w->thread, NULL, serve_worker, w);
+
+        if (errno) {
+            perror("pthread_create()");
+            rv = false;
+            break;
+        }
+    }
+
+    for (int sig = 0; rv; ) {
+        if (sigwait(&set, &sig) || sig != SIGHUP) {
+            break;
+        }
+        serve_finish_fold(&srv, false);
+        serve_update(&srv, delta_path, &delta_offset);
+        serve_start_fold(&srv);
+    }
+
+    /* The pipe is never read, so it stays readable, and wakes every worker. */
+    if (wake[1] != -1 && write(wake[1], "", 1) == -1) {
+        perror("write()");
+    }
+
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(srv.workers[i].thread, NULL);
+        rv = rv && srv.workers[i].ok;
+
+        if (cache_stats) {
+            const CacheStats *const st = &srv.workers[i].cache;
+
+            cache_stats->hits += st->hits;
+            cache_stats->misses += st->misses;
+            cache_stats->evictions += st->evictions;
+            cache_stats->entries += st->entries;
+            cache_stats->bytes += st->bytes;
+        }
+    }
+
+    if (srv.listen_fd != -1) {
+        close(srv.listen_fd);
+        unlink(path);
+    }
+
+    if (wake[0] != -1) {
+        close(wake[0]);
+        close(wake[1]);
+    }
+
+    /* What is left of the overlay is applied to the base, which no worker
+     * reads anymore, for the caller to have the last version of the trie.
+     */
+    if (srv.snap) {
+        serve_finish_fold(&srv, true);
+        rv = fold_overlay(srv.snap->base, srv.snap->adds, srv.snap->dels) 
+            && rv;
+        *trie = srv.snap->base;
+        snapshot_destroy(srv.snap, false);
+    }
+
+    free(srv.workers);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return rv;
+}
@@ -0,0 +1,78 @@
+#ifndef SERVER_H
+#define SERVER_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "trie.h"
+#include "cache.h"
+
+struct Shards;
+
+typedef struct {
+    size_t top_k;               /* Zero for all completions. */
+    size_t max_edits;           /* Complete prefixes this many edits away. */
+    bool weights;               /* Follow every completion with its weight. */
+    const struct Shards *shards;    /* Route the queries here, if not NULL. */
+    size_t cache_size;          /* Bytes of answers to cache; 0 for none. */
+} QueryOptions;
+
+/* Writes the answer to the query `prefix` to `sink` as a frame: a line 
+ * holding the number of completions and the prefix, separated by a tab, 
+ * followed by that many lines of completions. An unknown prefix has no
+ * completions. The lookup goes through `cur`, so answering prefixes in sorted
+ * order is cheaper than answering them at random. With `max_edits`, the
+ * completions are those of every prefix within that many edits of `prefix`.
+ * With `weights`, every completion is followed by a tab and its weight.
+ */
+bool answer_query(FILE *sink, trie_cursor_t *cur, const char *prefix,
+                  const QueryOptions *qopts);
+
+/* Writes the answers to the `n` queries at `prefixes` to `sink`, in order, as
+ * answer_query() does, with the lookups of the query at index i on curs[i].
+ * They are run as one batch (see trie_find_prefixes()), which is cheaper than
+ * answering the queries one at a time. If `cache` is not NULL, the answers it
+ * holds are taken from it, and those it does not are looked up and added to
+ * it; if `cached` is not NULL as well, cached[i] is set to whether the answer
+ * to the query at index i was taken from the cache.
+ */
+bool answer_queries(FILE *sink, trie_cursor_t *const *curs, Cache *cache,
+                    const char *const *prefixes, size_t n,
+                    const QueryOptions *qopts, bool *cached);
+
+/* Applies the updates in the delta file at `path` past its first `*offset`
+ * bytes (see trie_apply_delta()), and moves `*offset` past them, unless they
+ * failed to apply. Only lines ending with a newline are applied, for the last
+ * one may still be being written, unless `all`. A file shorter than `*offset`
+ * was replaced, and is applied from the start.
+ */
+bool apply_delta_file(trie_t *trie, const char *path, size_t *offset, bool all);
+
+/* Answers queries on the Unix socket at `path` with `nworkers` threads, until
+ * SIGINT or SIGTERM. If `delta_path` is not NULL, the delta file there past
+ * its first `delta_offset` bytes is applied, and on SIGHUP, what was appended
+ * to it since: it is recorded in an overlay of the keys inserted and removed,
+ * which the workers switch to once it is complete, and consult alongside
+ * `*trie`, which is never modified while it is served. The cost of an update
+ * is thus proportional to the overlay. Once the overlay grows past a few
+ * thousand keys, it is folded into a copy of the trie by a thread of its own,
+ * and the workers switch to that copy; the trie it replaces is destroyed once
+ * no worker reads it anymore. On return, `*trie` is the last version of the
+ * trie, with what is left of the overlay applied. If `qopts->shards` is not NULL,
+ * `*trie` is NULL instead, and every worker routes the queries to the shards
+ * over connections of its own (see shard_answer()).
+ *
+ * A client may send a line starting with a nul byte, which no prefix holds,
+ * followed by `K N W`, to answer the queries after it with a `top_k` of K, a
+ * `max_edits` of N and, if W is 1, `weights`.
+ *
+ * With `qopts->cache_size`, every worker caches answers in a cache of its own
+ * of an equal share of it, emptied whenever the trie is updated; if
+ * `cache_stats` is not NULL, the counts of all the caches are added to it.
+ */
+bool serve(const char *path, trie_t **trie, const QueryOptions *qopts,
+           const char *delta_path, size_t delta_offset, size_t nworkers,
+           CacheStats *cache_stats);
+
+#endif                          /* SERVER_H */
@@ -0,0 +1,717 @@
+#undef _POSIX_C_SOURCE
+#undef _XOPEN_SOURCE
+
+#define _POSIX_C_SOURCE 200819L
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define IO_IMPLEMENTATION
+#define IO_STATIC
+#include "io.h"
+
+#include "trie.h"
+#include "shard.h"
+
+/* Room for the suffix of the image or the socket of any shard. */
+#define SHARD_SUFFIX_MAX sizeof ".18446744073709551615.sock"
+
+typedef struct {
+    const char *socket;
+    const char *lower;          /* The least key of the shard. */
+} Shard;
+
+struct Shards {
+    Shard *shards;
+    size_t n;
+    char *content;              /* The manifest, which the shards point into. */
+};
+
+typedef struct {
+    FILE *in;                   /* NULL while not connected. */
+    FILE *out;
+    bool configured;            /* The options below were sent. */
+    size_t top_k;
+    size_t max_edits;
+} Link;
+
+/* A completion read from a shard. The key is at `offset` of the text of the
+ * links until they are all read, and at `key` then.
+ */
+typedef struct {
+    size_t offset;
+    const char *key;
+    size_t len;
+    uint32_t weight;
+} Completion;
+
+struct ShardLinks {
+    const Shards *shards;
+    Link *links;
+    size_t *counts;             /* Completions of the query, by shard. */
+    char *line;
+    size_t line_size;
+    Completion *best;           /* The completions of a top-K query. */
+    size_t nbest;
+    size_t best_capacity;
+    char *text;
+    size_t text_len;
+    size_t text_capacity;
+};
+
+typedef struct {
+    const char *key;
+    uint32_t weight;
+} Entry;
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const Entry *) a)->key, ((const Entry *) b)->key);
+}
+
+/* Builds the trie of the `n` entries at `entries`, and saves it to `path`. */
+static bool build_shard(const Entry *entries, size_t n, const char *path,
+                        const ShardBuildOptions *opts)
+{
+    trie_t *const trie = trie_create(opts->flags);
+    bool rv = trie != NULL;
+
+    for (size_t i = 0; rv && i < n; ++i) {
+        rv = trie_insert(trie, entries[i].key, entries[i].weight);
+    }
+
+    if (rv) {
+        trie_shrink_to_fit(trie);
+        rv = (!opts->minimize || trie_minimize(trie))
+            && (!opts->relayout || trie_relayout(trie))
+            && (!opts->freeze || trie_freeze(trie))
+            && trie_save(trie, path);
+    }
+
+    trie_destroy(trie);
+    return rv;
+}
+
+bool shard_build(char **lines, size_t nlines, size_t nshards, const char *path,
+                 const ShardBuildOptions *opts)
+{
+    Entry *const entries = malloc(sizeof *entries * (nlines ? nlines : 1));
+    char *const name = malloc(strlen(path) + SHARD_SUFFIX_MAX);
+
+    if (entries == NULL || name == NULL) {
+        perror("malloc()");
+        free(entries);
+        free(name);
+        return false;
+    }
+
+    for (size_t i = 0; i < nlines; ++i) {
+        entries[i].weight = trie_split_weight(lines[i]);
+        entries[i].key = lines[i];
+    }
+
+    /* Repeated keys end up next to each other, so that none of them is split
+     * across shards.
+     */
+    if (nlines) {
+        qsort(entries, nlines, sizeof *entries, compare_entries);
+    }
+
+    FILE *const manifest = fopen(path, "w");
+    bool rv = manifest != NULL;
+
+    if (!rv) {
+        perror(path);
+    }
+
+    /* Every shard takes its share of the lines left, and at least one, so an
+     * empty word list still makes one shard.
+     */
+    for (size_t i = 0, start = 0; rv && (start < nlines || i == 0); ++i) {
+        size_t end = i + 1 >= nshards
+                   ? nlines : start + (nlines - start) / (nshards - i);
+
+        if (end <= start) {
+            end = start + 1 > nlines ? nlines : start + 1;
+        }
+
+        while (end < nlines && strcmp(entries[end].key, entries[end - 1].key) == 0) {
+            ++end;
+        }
+
+        sprintf(name, "%s.%zu", path, i);
+        rv = build_shard(entries + start, end - start, name, opts);
+
+        if (rv && fprintf(manifest, "%s.sock\t%s\n", name,
+                          i ? entries[start].key : "") < 0) {
+            perror(path);
+            rv = false;
+        }
+        start = end;
+    }
+
+    if (manifest && fclose(manifest) && rv) {
+        perror(path);
+        rv = false;
+    }
+
+    free(entries);
+    free(name);
+    return rv;
+}
+
+Shards *shard_load(const char *path)
+{
+    FILE *const stream = fopen(path, "r");
+
+    if (stream == NULL) {
+        perror(path);
+        return NULL;
+    }
+
+    char *const content = io_read_file(stream, NULL);
+
+    fclose(stream);
+
+    if (content == NULL) {
+        perror("fread()");
+        return NULL;
+    }
+
+    size_t nlines = 0;
+    char **const lines = io_split_lines(content, &nlines);
+    Shards *const shards = malloc(sizeof *shards);
+    Shard *const list = malloc(sizeof *list * (nlines ? nlines : 1));
+
+    if ((lines == NULL && *content != '\0') || shards == NULL || list == NULL) {
+        perror("malloc()");
+        free(lines);
+        free(shards);
+        free(list);
+        free(content);
+        return NULL;
+    }
+
+    /* The first shard starts at the empty key, and every other one after the
+     * one before, so that every key has exactly one shard.
+     */
+    bool rv = nlines > 0;
+
+    for (size_t i = 0; rv && i < nlines; ++i) {
+        char *const tab = strchr(lines[i], '\t');
+
+        if (tab == NULL) {
+            rv = false;
+            break;
+        }
+
+        *tab = '\0';
+        list[i] = (Shard) { .socket = lines[i], .lower = tab + 1 };
+        rv = i ? strcmp(list[i - 1].lower, list[i].lower) < 0
+               : *list[i].lower == '\0';
+    }
+
+    free(lines);
+
+    if (!rv) {
+        fprintf(stderr, "Error: %s does not list shards in key order.\n", path);
+        free(shards);
+        free(list);
+        free(content);
+        return NULL;
+    }
+
+    *shards = (Shards) { .shards = list, .n = nlines, .content = content };
+    return shards;
+}
+
+void shard_destroy(Shards *shards)
+{
+    if (shards) {
+        free(shards->shards);
+        free(shards->content);
+        free(shards);
+    }
+}
+
+ShardLinks *shard_links_create(const Shards *shards)
+{
+    ShardLinks *const links = calloc(1, sizeof *links);
+
+    if (links) {
+        links->shards = shards;
+        links->links = calloc(shards->n, sizeof *links->links);
+        links->counts = calloc(shards->n, sizeof *links->counts);
+    }
+
+    if (links == NULL || links->links == NULL || links->counts == NULL) {
+        perror("calloc()");
+        shard_links_destroy(links);
+        return NULL;
+    }
+    return links;
+}
+
+static void link_close(Link *link)
+{
+    if (link->in) {
+        fclose(link->in);
+        fclose(link->out);
+    }
+
+    link->in = link->out = NULL;
+    link->configured = false;
+}
+
+void shard_links_destroy(ShardLinks *links)
+{
+    if (links) {
+        for (size_t i = 0; links->links && i < links->shards->n; ++i) {
+            link_close(links->links + i);
+        }
+
+        free(links->links);
+        free(links->counts);
+        free(links->line);
+        free(links->best);
+        free(links->text);
+        free(links);
+    }
+}
+
+/* Connects `link` to the server on the socket at `path`. Queries are written
+ * and answers read through streams of their own over the connection.
+ */
+static bool link_open(Link *link, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Error: socket path too long.\n");
+        return false;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        perror("socket()");
+        return false;
+    }
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof addr) == -1) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+
+    const int out_fd = dup(fd);
+    FILE *const in = fdopen(fd, "r");
+    FILE *const out = out_fd == -1 ? NULL : fdopen(out_fd, "w");
+
+    if (in == NULL || out == NULL) {
+        perror("fdopen()");
+
+        if (in) {
+            fclose(in);
+        } else {
+            close(fd);
+        }
+
+        if (out) {
+            fclose(out);
+        } else if (out_fd != -1) {
+            close(out_fd);
+        }
+        return false;
+    }
+
+    link->in = in;
+    link->out = out;
+    return true;
+}
+
+/* Writes `prefix` to `link`, after the options it is to be answered with if
+ * they have changed.
+ */
+static bool link_send(Link *link, const char *prefix, const QueryOptions *qopts)
+{
+    if (!link->configured || link->top_k != qopts->top_k
+        || link->max_edits != qopts->max_edits) {
+        if (fputc('\0', link->out) == EOF
+            || fprintf(link->out, "%zu %zu 1\n", qopts->top_k,
+                       qopts->max_edits) < 0) {
+            return false;
+        }
+
+        link->configured = true;
+        link->top_k = qopts->top_k;
+        link->max_edits = qopts->max_edits;
+    }
+    return fputs(prefix, link->out) != EOF && fputc('\n', link->out) != EOF;
+}
+
+/* Sends shard `s` the queries of the batch in its range, connecting to it
+ * first if need be. A connection that the shard has closed since the batch
+ * before, as it does when it is restarted, is opened again, once. On failure,
+ * the connection is left closed.
+ */
+static void send_queries(ShardLinks *links, size_t s,
+                         const char *const *prefixes, size_t n,
+                         const size_t *first, const size_t *end,
+                         const QueryOptions *qopts)
+{
+    Link *const link = links->links + s;
+    const char *const path = links->shards->shards[s].socket;
+    bool any = false;
+
+    for (size_t i = 0; i < n; ++i) {
+        any = any || (first[i] <= s && s < end[i]);
+    }
+
+    for (bool retry = any; retry; ) {
+        const bool reused = link->in != NULL;
+
+        if (!reused && !link_open(link, path)) {
+            return;
+        }
+
+        bool ok = true;
+
+        for (size_t i = 0; ok && i < n; ++i) {
+            if (first[i] <= s && s < end[i]) {
+                ok = link_send(link, prefixes[i], qopts);
+            }
+        }
+
+        if (ok && fflush(link->out) == 0) {
+            break;
+        }
+
+        retry = reused && (errno == EPIPE || errno == ECONNRESET);
+
+        if (!retry) {
+            perror(path);
+        }
+        link_close(link);
+    }
+}
+
+/* Reads the next line from shard `s` into the line buffer of `links`, and
+ * returns its length, less the newline, or -1 if there is none.
+ */
+static ssize_t link_read(ShardLinks *links, size_t s)
+{
+    const ssize_t len = getline(&links->line, &links->line_size,
+                                links->links[s].in);
+
+    if (len <= 0 || links->line[len - 1] != '\n') {
+        fprintf(stderr, "Error: shard %s hung up.\n",
+            links->shards->shards[s].socket);
+        return -1;
+    }
+
+    links->line[len - 1] = '\0';
+    return len - 1;
+}
+
+/* Reads the next completion of shard `s` into `*c`, its key at `*key`. */
+static bool link_read_completion(ShardLinks *links, size_t s, Completion *c,
+                                 const char **key)
+{
+    const ssize_t len = link_read(links, s);
+
+    if (len < 0) {
+        return false;
+    }
+
+    const char *const line = links->line;
+    const char *tab = line + len;
+
+    while (tab > line && *tab != '\t') {
+        --tab;
+    }
+
+    char *end = NULL;
+    const unsigned long w = *tab == '\t' && tab[1] >= '0' && tab[1] <= '9'
+                          ? strtoul(tab + 1, &end, 10) : 0;
+
+    if (end == NULL || *end != '\0' || w > UINT32_MAX) {
+        fprintf(stderr, "Error: shard %s answered without weights.\n",
+            links->shards->shards[s].socket);
+        return false;
+    }
+
+    *key = line;
+    c->len = (size_t) (tab - line);
+    c->weight = (uint32_t) w;
+    return true;
+}
+
+/* Returns the range of shards that might hold completions of `prefix`, from
+ * `*first` up to, but not including, `*end`.
+ */
+static void shard_range(const Shards *shards, const char *prefix,
+                        const QueryOptions *qopts, size_t *first, size_t *end)
+{
+    const size_t len = strlen(prefix);
+
+    /* A shard would hang up on a query too long for a prefix, which has no
+     * completions anyway.
+     */
+    if (len >= TRIE_PREFIX_MAX) {
+        *first = *end = 0;
+        return;
+    }
+
+    if (qopts->max_edits) {
+        *first = 0;
+        *end = shards->n;
+        return;
+    }
+
+    /* The completions of the prefix are the keys from the prefix up to the
+     * first key after the prefix that does not start with it. They start in
+     * the last shard whose least key is not after the prefix, and run on
+     * through every shard whose least key starts with it.
+     */
+    size_t lo = 0;
+    size_t hi = shards->n;
+
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(shards->shards[mid].lower, prefix) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (hi = lo + 1; hi < shards->n
+         && strncmp(shards->shards[hi].lower, prefix, len) == 0; ++hi) {
+        ;
+    }
+
+    *first = lo;
+    *end = hi;
+}
+
+static int compare_completions(const void *a, const void *b)
+{
+    const Completion *const x = a;
+    const Completion *const y = b;
+
+    if (x->weight != y->weight) {
+        return x->weight > y->weight ? -1 : 1;
+    }
+
+    const int cmp = memcmp(x->key, y->key, x->len < y->len ? x->len : y->len);
+
+    return cmp ? cmp : (x->len > y->len) - (x->len < y->len);
+}
+
+/* Reads the count of the answer of shard `s` into the counts of `links`, or
+ * closes the connection to it.
+ */
+static bool read_count(ShardLinks *links, size_t s)
+{
+    if (link_read(links, s) < 0) {
+        link_close(links->links + s);
+        return false;
+    }
+
+    char *tab = NULL;
+
+    errno = 0;
+    links->counts[s] = strtoull(links->line, &tab, 10);
+
+    if (errno || *tab != '\t') {
+        fprintf(stderr, "Error: shard %s sent a malformed answer.\n",
+            links->shards->shards[s].socket);
+        link_close(links->links + s);
+        return false;
+    }
+    return true;
+}
+
+/* Appends the completion at `*c`, whose key is at `key`, to those of `links`. */
+static bool keep_completion(ShardLinks *links, const Completion *c,
+                            const char *key)
+{
+    if (links->nbest >= links->best_capacity) {
+        const size_t cap = links->best_capacity
+                         ? links->best_capacity * 2 : 64;
+        Completion *const tmp = realloc(links->best, sizeof *tmp * cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+        links->best = tmp;
+        links->best_capacity = cap;
+    }
+
+    if (links->text_len + c->len > links->text_capacity) {
+        size_t cap = links->text_capacity ? links->text_capacity : 1024;
+
+        while (links->text_len + c->len > cap) {
+            cap *= 2;
+        }
+
+        char *const tmp = realloc(links->text, cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+        links->text = tmp;
+        links->text_capacity = cap;
+    }
+
+    memcpy(links->text + links->text_len, key, c->len);
+    links->best[links->nbest] = *c;
+    links->best[links->nbest++].offset = links->text_len;
+    links->text_len += c->len;
+    return true;
+}
+
+/* Reads the completions of shard `s`, whose count is read already, and
+ * appends them to those of `links` while `*keep`, which is cleared if there
+ * is no memory for them. On failure, the connection to the shard is closed.
+ */
+static bool read_completions(ShardLinks *links, size_t s, bool *keep)
+{
+    for (size_t i = 0; i < links->counts[s]; ++i) {
+        Completion c;
+        const char *key = NULL;
+
+        if (!link_read_completion(links, s, &c, &key)) {
+            link_close(links->links + s);
+            return false;
+        }
+
+        *keep = *keep && keep_completion(links, &c, key);
+    }
+    return true;
+}
+
+/* Reads the answers of the shards from `first` up to `end` to `prefix`, and
+ * writes the answer of the whole trie to `sink`: the `top_k` best of their
+ * completions, or all of them, which are in key order one shard after the
+ * other, since every shard holds a range of keys. If a shard failed to
+ * answer, the query is answered with an error instead, and what the other
+ * shards answered is read all the same, for their connections to stay in step
+ * with the queries. Returns false if `sink` could not be written to, and sets
+ * `*answered` to whether the query was.
+ */
+static bool merge_answer(ShardLinks *links, FILE *sink, const char *prefix,
+                         size_t first, size_t end, const QueryOptions *qopts,
+                         bool *answered)
+{
+    bool keep = true;
+
+    links->nbest = 0;
+    links->text_len = 0;
+
+    /* The counts come first on every connection, so they are all read before
+     * any of the completions. A shard that is not connected failed to be sent
+     * the query.
+     */
+    for (size_t s = first; s < end; ++s) {
+        keep = links->links[s].in && read_count(links, s) && keep;
+    }
+
+    for (size_t s = first; s < end; ++s) {
+        if (links->links[s].in && !read_completions(links, s, &keep)) {
+            keep = false;
+        }
+    }
+
+    *answered = keep;
+
+    if (!keep) {
+        return fprintf(sink, "-\t%s\n", prefix) > 0;
+    }
+
+    for (size_t i = 0; i < links->nbest; ++i) {
+        links->best[i].key = links->text + links->best[i].offset;
+    }
+
+    if (qopts->top_k && links->nbest) {
+        qsort(links->best, links->nbest, sizeof *links->best,
+              compare_completions);
+    }
+
+    const size_t k = qopts->top_k && qopts->top_k < links->nbest
+                   ? qopts->top_k : links->nbest;
+
+    if (fprintf(sink, "%zu\t%s\n", k, prefix) < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < k; ++i) {
+        const Completion *const c = links->best + i;
+
+        if (fwrite(c->key, 1, c->len, sink) != c->len
+            || (qopts->weights
+                ? fprintf(sink, "\t%" PRIu32 "\n", c->weight) < 0
+                : fputc('\n', sink) == EOF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool shard_answer(ShardLinks *links, FILE *sink, const char *const *prefixes,
+                  size_t n, const QueryOptions *qopts, size_t *nfailed)
+{
+    const Shards *const shards = links->shards;
+    size_t first[TRIE_FIND_BATCH];
+    size_t end[TRIE_FIND_BATCH];
+    bool rv = true;
+
+    for (size_t i = 0; i < n; ++i) {
+        shard_range(shards, prefixes[i], qopts, first + i, end + i);
+    }
+
+    /* Every shard is sent all its queries of the batch before any answer is
+     * read, so that the shards work on them at the same time. A shard that
+     * could not be sent them is left closed, which fails its queries.
+     */
+    for (size_t s = 0; s < shards->n; ++s) {
+        send_queries(links, s, prefixes, n, first, end, qopts);
+    }
+
+    for (size_t i = 0; rv && i < n; ++i) {
+        bool answered = true;
+
+        rv = merge_answer(links, sink, prefixes[i], first[i], end[i], qopts,
+                          &answered);
+
+        if (!answered && nfailed) {
+            ++*nfailed;
+        }
+    }
+
+    /* What is left of the answers to a batch that could not be written is
+     * dropped along with the connections.
+     */
+    if (!rv) {
+        for (size_t s = 0; s < shards->n; ++s) {
+            link_close(links->links + s);
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,77 @@
+#ifndef SHARD_H
+#define SHARD_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "server.h"
+
+/*
+ * A sharded trie is split by key range into images of their own, each served
+ * by a server of its own, and queried through a router, which passes every
+ * query on to the shards whose range holds keys it might complete to, and
+ * merges their answers into the answer a single trie would have given.
+ *
+ * The manifest of a sharded trie lists its shards in key order, one per line:
+ * the path of the socket the shard is served on, a tab, and the least key of
+ * the shard, which is empty for the first one. A shard holds the keys from its
+ * least key up to, but not including, that of the next one.
+ */
+typedef struct Shards Shards;
+
+/* The connections of one thread to the servers of the shards. */
+typedef struct ShardLinks ShardLinks;
+
+typedef struct {
+    unsigned flags;             /* For trie_create(). */
+    bool minimize;              /* See trie_minimize(). */
+    bool relayout;              /* See trie_relayout(). */
+    bool freeze;                /* See trie_freeze(). */
+} ShardBuildOptions;
+
+/* Splits the keys of the `nlines` lines at `lines` (see trie_insert_lines())
+ * into at most `nshards` ranges of about as many lines each, builds a trie of
+ * each range as `opts` says, and saves it to the image `path.i`, i counting
+ * from 0. The manifest is written to `path`, with `path.i.sock` as the socket
+ * of shard i. The lines are split and sorted in place. A key is never split
+ * across shards, so there are fewer of them if there are fewer keys.
+ */
+bool shard_build(char **lines, size_t nlines, size_t nshards, const char *path,
+                 const ShardBuildOptions *opts);
+
+/* Reads the manifest at `path`. Returns NULL on failure, or if the shards are
+ * not listed in key order.
+ */
+Shards *shard_load(const char *path);
+
+/* Releases `shards`. A null pointer is ignored. */
+void shard_destroy(Shards *shards);
+
+/* Returns connections to the shards, which are only opened once they are
+ * first needed, or NULL on memory allocation failure.
+ */
+ShardLinks *shard_links_create(const Shards *shards);
+
+/* Closes the connections of `links`, and releases it. A null pointer is
+ * ignored.
+ */
+void shard_links_destroy(ShardLinks *links);
+
+/* Writes the answers to the `n` queries at `prefixes`, at most TRIE_FIND_BATCH
+ * of them, to `sink`, framed as by answer_query(), by passing every query on
+ * to the shards that might hold its completions, all of them if it is fuzzy.
+ * Every shard is sent its queries at once before the first answer is read, so
+ * the shards answer them in parallel, and a round trip is paid once a batch.
+ * The shards answer with weights, by which the `qopts->top_k` best completions
+ * of all the shards are picked; the others are in key order already. A query
+ * bound for a shard that could not be reached, or that hung up, is answered
+ * with an error frame, `-`, a tab and the prefix, and counted in `*nfailed`
+ * unless it is NULL; the connection to the shard is opened again on the next
+ * call. Returns false if `sink` could not be written to, in which case all the
+ * connections are closed.
+ */
+bool shard_answer(ShardLinks *links, FILE *sink, const char *const *prefixes,
+                  size_t n, const QueryOptions *qopts, size_t *nfailed);
+
+#endif                          /* SHARD_H */
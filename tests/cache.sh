@@ -0,0 +1,106 @@
+#!/bin/sh
+
+# Answers queries with a cache: asked again, they are to be answered from it;
+# once it is full, older answers are to be evicted; and once the server swaps
+# in an update, the answers cached before it are not to be served. The answers
+# must be those of a run without a cache every time.
+
+set -u
+
+bin=${1:-./trie}
+words=${2:-c-symbols.txt}
+dir=$(mktemp -d) || exit 1
+pid=
+
+cleanup() {
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+# Prints the count named $1 out of the --stats line in $2.
+stat() {
+    sed -n "s/.*\"cache\":{.*\"$1\":\([0-9]*\).*/\1/p" "$2"
+}
+
+# Answers the queries in $1 on the words in $2 with a cache of 1 MB, and
+# checks the answers against those of a run without one.
+run() {
+    "$bin" -q "$1" "$2" > "$dir/expected.txt" || exit 1
+
+    if ! "$bin" -C 1 -t -q "$1" "$2" > "$dir/got.txt" 2> "$dir/stats.txt" \
+        || ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+        echo "cache: the answers differ from those without a cache" >&2
+        exit 1
+    fi
+}
+
+# The queries are answered 16 at a time, and only cached once their batch is,
+# so a query repeated more often than that is bound to hit.
+for _ in $(seq 40); do
+    printf 'abor\nstr\n'
+done > "$dir/queries.txt"
+
+run "$dir/queries.txt" "$words"
+
+if [ "$(stat hits "$dir/stats.txt")" -eq 0 ]; then
+    echo "cache: repeated queries did not hit" >&2
+    exit 1
+fi
+
+# 100 answers of about 50 KB each do not fit in 1 MB.
+awk 'BEGIN {
+    for (p = 0; p < 100; ++p)
+        for (i = 0; i < 2000; ++i)
+            printf "p%03d_%06d_key_to_pad_with\n", p, i
+}' > "$dir/big.txt"
+awk 'BEGIN { for (p = 0; p < 100; ++p) printf "p%03d\n", p }' \
+    > "$dir/queries.txt"
+
+run "$dir/queries.txt" "$dir/big.txt"
+
+if [ "$(stat evictions "$dir/stats.txt")" -eq 0 ]; then
+    echo "cache: a full cache evicted nothing" >&2
+    exit 1
+fi
+
+# A router of one shard is the client of the server.
+printf 'apple\ncherry\n' > "$dir/words.txt"
+: > "$dir/delta.txt"
+printf '%s\t\n' "$dir/s.sock" > "$dir/manifest"
+printf 'ap\n' > "$dir/queries.txt"
+
+"$bin" -C 1 -d "$dir/delta.txt" -u "$dir/s.sock" "$dir/words.txt" &
+pid=$!
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$dir/s.sock" ] && break
+    sleep 0.1
+done
+
+"$bin" -M "$dir/manifest" -q "$dir/queries.txt" > "$dir/got.txt"
+printf '1\tap\napple\n' > "$dir/expected.txt"
+
+if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+    echo "cache: unexpected answer before the update:" >&2
+    cat "$dir/got.txt" >&2
+    exit 1
+fi
+
+printf '+apricot\n' >> "$dir/delta.txt"
+kill -HUP "$pid"
+printf '2\tap\napple\napricot\n' > "$dir/expected.txt"
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    sleep 0.1
+    "$bin" -M "$dir/manifest" -q "$dir/queries.txt" > "$dir/got.txt"
+    cmp -s "$dir/expected.txt" "$dir/got.txt" && break
+done
+
+if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+    echo "cache: the answer cached before the update was served after it:" >&2
+    cat "$dir/got.txt" >&2
+    exit 1
+fi
+
+echo "cache: ok"
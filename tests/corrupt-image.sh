@@ -0,0 +1,39 @@
+#!/bin/sh
+
+# Loads images whose pools were overwritten after the header, which are to be
+# rejected rather than looked up out of bounds, and checks that the images
+# they were made from still load, in every layout.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+words=${2:-c-symbols.txt}
+
+for opts in "" -r -m -D "-r -m" "-r -D"; do
+    "$bin" $opts -S "$dir/img" "$words" || exit 1
+
+    if [ "$("$bin" -L "$dir/img" -c abort_)" != abort_handler_s ]; then
+        echo "corrupt-image: $opts: the image does not load" >&2
+        exit 1
+    fi
+
+    size=$(wc -c < "$dir/img")
+
+    # The header takes less than 512 bytes, and every index after them runs
+    # out of bounds.
+    head -c 512 "$dir/img" > "$dir/bad"
+    head -c $((size - 512)) /dev/zero | tr '\0' '\377' >> "$dir/bad"
+
+    "$bin" -L "$dir/bad" -c a > /dev/null 2> "$dir/err"
+    status=$?
+
+    if [ $status -ne 1 ] || ! grep -q corrupt "$dir/err"; then
+        echo "corrupt-image: $opts: a corrupt image was not rejected" >&2
+        exit 1
+    fi
+done
+
+echo "corrupt-image: ok"
@@ -0,0 +1,158 @@
+#!/bin/sh
+
+# Updates a served trie through its overlay: a small delta on a large trie is
+# not to copy the trie, which its peak memory tells; a delta file that only
+# grew by a partial line is not to publish anything, which the cache, emptied
+# by every update, tells; and once the overlay is big enough to be folded into
+# the trie in the background, the answers are to be those of the delta
+# applied directly, lines appended while the fold runs included.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+pid=
+
+cleanup() {
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+# Serves the words in $1 with the options after it, and the delta file.
+start() {
+    words=$1
+    shift
+    rm -f "$dir/s.sock"
+    "$bin" "$@" -d "$dir/delta.txt" -u "$dir/s.sock" "$words" \
+        2> "$dir/stats.txt" &
+    pid=$!
+
+    for _ in $(seq 100); do
+        [ -S "$dir/s.sock" ] && return 0
+        sleep 0.1
+    done
+
+    echo "delta-overlay: the server did not start" >&2
+    exit 1
+}
+
+stop() {
+    kill "$pid"
+    wait "$pid" 2>/dev/null
+    pid=
+}
+
+# Asks the server the queries in $2 with the options after them, through a
+# router of one shard, into $1.
+ask() {
+    out=$1
+    queries=$2
+    shift 2
+    "$bin" -W "$@" -M "$dir/manifest" -q "$queries" > "$out"
+}
+
+# Prints the peak resident memory of the server in kB.
+peak() {
+    sed -n 's/^VmHWM:[^0-9]*\([0-9]*\).*/\1/p' "/proc/$pid/status"
+}
+
+printf '%s\t\n' "$dir/s.sock" > "$dir/manifest"
+
+awk 'BEGIN {
+    for (i = 0; i < 200000; ++i)
+        printf "k%07d_%d\n", (i * 7919) % 10000000, i % 97
+}' > "$dir/big.txt"
+: > "$dir/delta.txt"
+printf 'zz\n' > "$dir/queries.txt"
+printf '1\tzz\nzzz\t5\n' > "$dir/expected.txt"
+
+start "$dir/big.txt"
+before=$(peak)
+
+printf -- '-k0000000_0\n+zzz\t5\n' >> "$dir/delta.txt"
+kill -HUP "$pid"
+
+for _ in $(seq 20); do
+    sleep 0.1
+    ask "$dir/got.txt" "$dir/queries.txt"
+    cmp -s "$dir/expected.txt" "$dir/got.txt" && break
+done
+
+after=$(peak)
+
+if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+    echo "delta-overlay: the update was not answered from" >&2
+    exit 1
+fi
+
+# A copy of the trie would about double the peak.
+if [ $((after - before)) -gt $((before / 4)) ]; then
+    echo "delta-overlay: a delta of two lines took the peak memory" \
+        "from $before kB to $after kB" >&2
+    exit 1
+fi
+
+stop
+
+printf 'apple\nbanana\n' > "$dir/words.txt"
+: > "$dir/delta.txt"
+printf 'ap\n' > "$dir/queries.txt"
+
+start "$dir/words.txt" -C 1 -t
+ask "$dir/got.txt" "$dir/queries.txt"
+printf -- '-app' >> "$dir/delta.txt"
+kill -HUP "$pid"
+sleep 0.3
+ask "$dir/got.txt" "$dir/queries.txt"
+stop
+
+if ! grep -q '"cache":{"hits":1,' "$dir/stats.txt"; then
+    echo "delta-overlay: a partial line emptied the cache:" >&2
+    cat "$dir/stats.txt" >&2
+    exit 1
+fi
+
+# More keys than SERVE_FOLD_KEYS, some removed, and some with their weights
+# added to those of the trie.
+awk 'BEGIN {
+    for (i = 0; i < 3000; ++i)
+        printf "w%05d\t%d\n", i * 7, i % 13 + 1
+}' > "$dir/words.txt"
+awk 'BEGIN {
+    for (i = 0; i < 6000; ++i)
+        if (i % 5 == 0)
+            printf "-w%05d\n", i * 3
+        else
+            printf "+w%05d\t%d\n", i * 2, i % 11 + 1
+}' > "$dir/delta.txt"
+printf '\nw0\nw01\nw1\nw2\nw99\n' > "$dir/queries.txt"
+
+for opts in "" -r; do
+    start "$dir/words.txt" $opts
+
+    # Lines appended while the fold is running are applied after it.
+    printf -- '-w00014\n+w00021\t100\nw99999\n' >> "$dir/delta.txt"
+    kill -HUP "$pid"
+
+    for query in "" "-n 3" "-f 1 -n 5"; do
+        "$bin" -W $query -d "$dir/delta.txt" -q "$dir/queries.txt" \
+            "$dir/words.txt" > "$dir/expected.txt" || exit 1
+
+        for _ in $(seq 50); do
+            ask "$dir/got.txt" "$dir/queries.txt" $query
+            cmp -s "$dir/expected.txt" "$dir/got.txt" && break
+            sleep 0.1
+        done
+
+        if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+            echo "delta-overlay: $opts: $query: the answers differ from" \
+                "those of the delta applied directly" >&2
+            exit 1
+        fi
+    done
+
+    stop
+done
+
+echo "delta-overlay: ok"
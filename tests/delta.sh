@@ -0,0 +1,98 @@
+#!/bin/sh
+
+# Applies deltas to plain and radix tries: removals are to give the trie the
+# shape a build without the removed keys has, and a server is to answer from
+# what was appended to its delta file once it is sent SIGHUP, and only from
+# complete lines, applying each line once however often it is signalled. A
+# delta file that is truncated is applied again from its start, which removals
+# survive unchanged.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+pid=
+
+cleanup() {
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+# Prints the count of nodes and the histograms out of the --stats line in $1.
+shape() {
+    sed 's/.*\("nodes":[0-9]*\).*\("fanout":[^a-z]*\),\("depth":[^a-z]*\),.*/\1 \2 \3/' "$1"
+}
+
+# Asks the server for the completions of $1, with weights, through a router of
+# one shard.
+ask() {
+    printf '%s\n' "$1" > "$dir/queries.txt"
+    "$bin" -W -M "$dir/manifest" -q "$dir/queries.txt"
+}
+
+# Sends the server SIGHUP, and waits until it answers $1 with $2.
+expect() {
+    kill -HUP "$pid"
+
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        sleep 0.1
+        [ "$(ask "$1")" = "$(printf "$2")" ] && return 0
+    done
+
+    echo "delta: $opts: after SIGHUP, $1 was answered with:" >&2
+    ask "$1" >&2
+    exit 1
+}
+
+printf 'apple\napplesauce\napply\nbanana\nbandana\n' > "$dir/words.txt"
+printf -- '-apply\n-applesauce\n-bandana\n-cherry\n' > "$dir/removals.txt"
+printf 'apple\nbanana\n' > "$dir/left.txt"
+
+for opts in "" -r; do
+    "$bin" $opts -t -d "$dir/removals.txt" -c a "$dir/words.txt" \
+        > "$dir/got.txt" 2> "$dir/stats.txt" || exit 1
+    "$bin" $opts -t -c a "$dir/left.txt" > "$dir/expected.txt" \
+        2> "$dir/fresh.txt" || exit 1
+
+    if ! cmp -s "$dir/expected.txt" "$dir/got.txt" \
+        || [ "$(shape "$dir/stats.txt")" != "$(shape "$dir/fresh.txt")" ]; then
+        echo "delta: $opts: removals left another trie than a fresh build" >&2
+        exit 1
+    fi
+
+    : > "$dir/delta.txt"
+    printf '%s\t\n' "$dir/s.sock" > "$dir/manifest"
+    rm -f "$dir/s.sock"
+
+    "$bin" $opts -d "$dir/delta.txt" -u "$dir/s.sock" "$dir/words.txt" &
+    pid=$!
+
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        [ -S "$dir/s.sock" ] && break
+        sleep 0.1
+    done
+
+    printf -- '-apply\n+apricot\t5\n' >> "$dir/delta.txt"
+    expect ap '3\tap\napple\t1\napplesauce\t1\napricot\t5'
+
+    # Nothing new is applied again.
+    expect ap '3\tap\napple\t1\napplesauce\t1\napricot\t5'
+
+    # Nor is a line that is not complete yet.
+    printf -- '-applesa' >> "$dir/delta.txt"
+    expect ap '3\tap\napple\t1\napplesauce\t1\napricot\t5'
+
+    printf 'uce\n' >> "$dir/delta.txt"
+    expect ap '2\tap\napple\t1\napricot\t5'
+
+    # A truncated file is applied from the start.
+    printf -- '-apply\n-applesauce\n-apricot\n' > "$dir/delta.txt"
+    expect ap '1\tap\napple\t1'
+
+    kill "$pid"
+    wait "$pid" 2>/dev/null
+    pid=
+done
+
+echo "delta: ok"
@@ -0,0 +1,50 @@
+#!/bin/sh
+
+# Enumerates keys of 100 KB that branch halfway, in a plain trie, where the
+# subtree is 100000 nodes deep, and in a radix one, where the edges are longer
+# than TRIE_PREFIX_MAX.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+long() {
+    head -c "$2" /dev/zero | tr '\0' "$1"
+}
+
+half=$(long q 50000)
+
+{
+    echo "$half$half"
+    echo "$half$half"r
+    echo "$half$(long z 50000)"
+} > "$dir/words.txt"
+
+LC_ALL=C sort "$dir/words.txt" > "$dir/sorted.txt"
+
+for opts in "" -r; do
+    if ! "$bin" $opts -c q "$dir/words.txt" > "$dir/got.txt" \
+        || ! cmp -s "$dir/sorted.txt" "$dir/got.txt"; then
+        echo "long-key: $opts -c q: unexpected keys" >&2
+        exit 1
+    fi
+
+    # Keys of the same weight come out in order.
+    if ! "$bin" $opts -n 3 -c q "$dir/words.txt" > "$dir/got.txt" \
+        || ! cmp -s "$dir/sorted.txt" "$dir/got.txt"; then
+        echo "long-key: $opts -n 3 -c q: unexpected keys" >&2
+        exit 1
+    fi
+
+    sed -n 2p "$dir/sorted.txt" > "$dir/expected.txt"
+
+    if ! "$bin" $opts -O 1 -l 1 -c qq "$dir/words.txt" > "$dir/got.txt" \
+        || ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+        echo "long-key: $opts -O 1 -l 1 -c qq: unexpected keys" >&2
+        exit 1
+    fi
+done
+
+echo "long-key: ok"
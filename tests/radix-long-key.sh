@@ -0,0 +1,42 @@
+#!/bin/sh
+
+# Completes prefixes that end on radix edges longer than TRIE_PREFIX_MAX, which
+# a cursor takes whole, and checks that the keys come out as in a plain trie.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+long() {
+    head -c "$2" /dev/zero | tr '\0' "$1"
+}
+
+{ printf 'a'; long b 3000; echo; } > "$dir/words.txt"
+{ long x 200000; echo; } > "$dir/big.txt"
+
+for opts in "" -m -D; do
+    for prefix in a ab abbb; do
+        "$bin" $opts -c "$prefix" "$dir/words.txt" > "$dir/expected.txt" \
+            || exit 1
+
+        if ! "$bin" -r $opts -c "$prefix" "$dir/words.txt" > "$dir/got.txt"; then
+            echo "radix-long-key: -r $opts -c $prefix failed" >&2
+            exit 1
+        fi
+
+        if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+            echo "radix-long-key: -r $opts -c $prefix: unexpected keys" >&2
+            exit 1
+        fi
+    done
+
+    if ! "$bin" -r $opts -c x "$dir/big.txt" > "$dir/got.txt" \
+        || ! cmp -s "$dir/big.txt" "$dir/got.txt"; then
+        echo "radix-long-key: -r $opts -c x on a 200000-byte key failed" >&2
+        exit 1
+    fi
+done
+
+echo "radix-long-key: ok"
@@ -0,0 +1,46 @@
+#!/bin/sh
+
+# Routes queries to two shards while the first one is down. The queries bound
+# for it are to be answered with errors, and the others as usual.
+
+set -u
+
+bin=${1:-./trie}
+dir=$(mktemp -d) || exit 1
+pid=
+
+cleanup() {
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    rm -rf "$dir"
+}
+trap cleanup EXIT
+
+printf 'apple\navocado\ncherry\ndate\n' > "$dir/words.txt"
+printf 'a\nc\nd\nav\nda\n' > "$dir/queries.txt"
+
+"$bin" -P 2 -S "$dir/w" "$dir/words.txt" || exit 1
+
+# Only the second shard, which holds the keys from `cherry` up, is served.
+"$bin" -L "$dir/w.1" -u "$dir/w.1.sock" &
+pid=$!
+
+for _ in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$dir/w.1.sock" ] && break
+    sleep 0.1
+done
+
+# A query for `c` might complete to keys of either shard, so it fails too.
+printf -- '-\ta\n-\tav\n-\tc\n1\td\ndate\n1\tda\ndate\n' > "$dir/expected.txt"
+
+if "$bin" -M "$dir/w" -q "$dir/queries.txt" > "$dir/got.txt" 2>/dev/null; then
+    echo "shard-down: a run with failed queries succeeded" >&2
+    exit 1
+fi
+
+if ! cmp -s "$dir/expected.txt" "$dir/got.txt"; then
+    echo "shard-down: unexpected answers:" >&2
+    cat "$dir/got.txt" >&2
+    exit 1
+fi
+
+echo "shard-down: ok"
@@ -3,6 +3,7 @@
 
 #define _POSIX_C_SOURCE 200819L
 #define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE         /* madvise() */
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,533 +12,4779 @@
 #include <stdint.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 
-#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define IO_IMPLEMENTATION
 #define IO_STATIC
 #include "io.h"
 
-#define PROGRAM_NAME    "auto-complete"
-#define OUTPUT_DOT_FILE "graph.dot"
-#define AC_BUFFER_CAP   1024 * 2
+#include "trie.h"
 
-typedef struct {
-    bool kflag;                 /* Keep the transient .DOT file. */
-    bool hflag;                 /* Help message. */
-    bool sflag;                 /* Generate a .SVG file. */
-    bool cflag;                 /* Suggest autocompletions. */
-    bool pflag;                 /* Prefix for the .DOT file. */
-} flags;
-
-#ifdef DEBUG
-#include "size.h"
-#define debug_printf(fmt, ...) \
-    fprintf(stdout, "%s:%d:%s(): " fmt, __FILE__, __LINE__, \
-            __func__, __VA_ARGS__)
-#define D(x) x
-#else
-#define D(x) (void) 0
+/* Keys are strings of arbitrary bytes, UTF-8 included. An edge is labelled with
+ * the byte it stands for, so that children sorted by label enumerate keys in
+ * the order strcmp() sorts them in, which for UTF-8 is that of code points.
+ * A nul byte ends a key, which leaves 255 labels. A node does not reserve a
+ * slot for every one of them, which would take 2056 bytes a node with 64-bit
+ * integers; see the child blocks below.
+ *
+ * Once a trie is frozen, no byte can be added to its keys, and trie_freeze()
+ * renumbers the bytes they hold 1, 2, ... in byte order instead, so that its
+ * double array only has room for the labels the keys use. A lookup maps every
+ * byte of the prefix through a table either way.
+ */
+#define ALPHABET_SIZE UINT8_MAX
+
+/* The label of a byte, and the byte of a label, in the alphabet of `t`. */
+#define LABEL_OF(t, ch)    ((t)->label_of[(unsigned char) (ch)])
+#define CHAR_OF(t, label)  ((char) (t)->byte_of[(label)])
+
+/* Node, edge and text indices are unsigned, with the largest value as the
+ * sentinel, so that no part of the range is wasted. Their width is chosen at
+ * compile time with TRIE_INDEX_BITS: 32 by default, which addresses up to
+ * UINT32_MAX - 1 nodes, or 64 (make index64) for tries beyond that, at the cost
+ * of bigger nodes and edges.
+ */
+#ifndef TRIE_INDEX_BITS
+#define TRIE_INDEX_BITS 32
 #endif
 
-static void help(FILE *sink)
-{
-    fprintf(sink, "\nUSAGE\n"
-        "\t" PROGRAM_NAME " [OPTIONS] [filename]\n\n"
-        "DESCRIPTION\n"
-        "\t" PROGRAM_NAME
-        " is a program for auto-completion and graph visualization.\n\n"
-        "OPTIONS:\n" "\t-k, --keep\t\tKeep the transient .DOT file.\n"
-        "\t-h, --help\t\tDisplay this help message and exit.\n"
-        "\t-s, --svg \t\tGenerate a .SVG file (with optional prefix).\n"
-        "\t-c, --complete PREFIX   Suggest autocompletions for prefix.\n"
-        "\t-p, --prefix PREFIX\tPrefix for the .DOT file.\n\n");
-    exit(EXIT_SUCCESS);
-}
+#if TRIE_INDEX_BITS == 64
+typedef uint64_t Index;
+#define INDEX_MAX UINT64_MAX
+#define PRI_INDEX PRIu64
+#elif TRIE_INDEX_BITS == 32
+typedef uint32_t Index;
+#define INDEX_MAX UINT32_MAX
+#define PRI_INDEX PRIu32
+#else
+#error "TRIE_INDEX_BITS must be 32 or 64."
+#endif
 
-static void usage_err(const char *prog_name)
-{
-    fprintf(stderr, "The syntax of the command is incorrect.\n"
-        "Try %s -h for more information.\n", prog_name);
-    exit(EXIT_FAILURE);
-}
+#define INVALID_OFFSET INDEX_MAX
 
-static void parse_options(const struct option * long_options,
-                          flags *               opt_ptr, 
-                          int                   argc, 
-                          char **restrict       argv,
-                          const char **restrict prefix)
-{
-    int c = 0;
-    int err_flag = 0;
+#define INITIAL_POOL_CAP 1024 * 2
 
-    while (true) {
-        c = getopt_long(argc, argv, "shkc:p:", long_options, NULL);
-        
-        if (c == -1) {
-            break;
-        }
+/* Children are not stored in a fixed array of ALPHABET_SIZE slots per node.
+ * Instead, every node owns a block of slots in two parallel arrays,
+ * `labels` and `targets`, which holds its children sorted by label.
+ * Blocks come in power-of-two size classes (1, 2, 4, ..., 256 slots), so a node
+ * with a single child costs 1 + sizeof (Index) bytes of edge storage, a label
+ * and a target, instead of a target for every possible label. When a
+ * block fills up, the node moves to a block of the next class and the old one
+ * is put on a per-class free list, to be reused by the next node that grows
+ * into that class.
+ */
+#define BLOCK_CLASS_COUNT 9
+#define TEXT_POOL_STEP    (1024 * 64)
+#define BLOCK_SIZE(cls)   ((Index) 1 << (cls))
 
-        switch (c) {
-            case 'k':
-                ++err_flag;
-                opt_ptr->kflag = true;
-                break;
-            case 'h':
-                help(stdout);
-                break;
-            case 's':
-                if (opt_ptr->cflag) {
-                    fprintf(stderr,
-                        "Error: -s/--svg specified after -c/--complete.\n");
-                    usage_err(argv[0]);
-                }
+typedef struct {
+    /* We shall store indices within the `pool` array instead of storing
+     * huge word size pointers. This also simplifies serializing and
+     * deserializing the structure.
+     *
+     * See also: A case where int32_t wasn't sufficient - bbc.com/news/world-asia-30288542
+     */
+    Index edges;                /* First slot of the child block, or INVALID_OFFSET. */
+    uint8_t nchildren;
+    uint8_t block_class;
+    bool terminal;
 
-                if (opt_ptr->pflag) {
-                    --err_flag;
-                }
+    /* The characters following the edge label on the way into this node, as a
+     * slice of `text`. Always empty unless the trie was built in radix
+     * mode, where a chain of single-child nodes is collapsed into one edge.
+     */
+    Index tail;
+    Index tail_len;
 
-                if (opt_ptr->kflag) {
-                    --err_flag;
-                }
+    /* The weight of the key ending here (if terminal), and the highest weight
+     * of any key in the subtree rooted here. The latter is what lets a top-K
+     * search pass over subtrees that can not make it into the results.
+     */
+    uint32_t weight;
+    uint32_t max_weight;
 
-                opt_ptr->sflag = true;
-                break;
-            case 'c':
-                if (opt_ptr->sflag) {
-                    fprintf(stderr,
-                        "Error: -c/--complete specified after -s/--svg.\n");
-                    usage_err(argv[0]);
-                }
+    /* The number of keys in the subtree rooted here, which is what lets a page
+     * of completions skip the subtrees before its offset without visiting them.
+     */
+    Index keys;
+} Node;
 
-                *prefix = optarg;
+struct trie {
+    Node *pool;
+    Index count;
+    Index capacity;
 
-                if (strlen(*prefix) >= AC_BUFFER_CAP) {
-                    fprintf(stderr, "Error: PREFIX too long.\n");
-                    exit(EXIT_FAILURE);
-                }
+    /* Nodes reclaimed by trie_remove(), for alloc_node() to reuse. The `edges`
+     * of a free node holds the next free node.
+     */
+    Index free_nodes;
+    Index free_node_count;
 
-                opt_ptr->cflag = true;
-                break;
-            case 'p':
-                if (!opt_ptr->sflag) {
-                    err_flag = true;
-                }
+    /* Child blocks. labels[i] is the byte on the edge to the child,
+     * targets[i] is its index in `pool`. For a block on a free list,
+     * targets[first slot] holds the next free block of the same class.
+     */
+    uint8_t *labels;
+    Index *targets;
+    Index edge_count;
+    Index edge_capacity;
+    Index free_blocks[BLOCK_CLASS_COUNT];
 
-                *prefix = optarg;
-                opt_ptr->pflag = true;
-                break;
+    /* Edge tails of a radix trie. Every key contributes its unmatched suffix
+     * at most once; splitting an edge only splits the slice, it never copies.
+     */
+    char *text;
+    Index text_len;
+    Index text_capacity;
 
-                /* case '?' */
-            default:
-                usage_err(argv[0]);
-        }
-    }
+    /* The label of every byte, 0 for a byte no key holds, and the byte of
+     * every label. Labels are the bytes themselves unless the trie is frozen.
+     */
+    uint8_t label_of[UCHAR_MAX + 1];
+    uint8_t byte_of[UCHAR_MAX + 1];
+    uint8_t alphabet_size;      /* Labels in use, from 1 on. */
 
-    /* If the -p or -k flag was specified without -s: */
-    /* Note: GNU provides an extension for optional arguments, which
-     *       can be used to provide an optional prefix for -s. */
-    if (err_flag) {
-        if (opt_ptr->pflag) {
-            fputs("Error: -p specified without -s.\n", stderr);
-        }
+    Index root;
+    size_t keys;                /* Number of distinct keys inserted. */
+    size_t grows;               /* Times a pool was reallocated to grow. */
+    bool radix;                 /* Collapse single-child chains on insertion. */
+    bool huge_pages;            /* Back the pools with transparent huge pages. */
+    bool minimized;             /* Subtrees are shared; see trie_minimize(). */
+    bool double_array;          /* Children are laid out by trie_freeze(). */
+    size_t generation;          /* Bumped whenever the trie is changed. */
 
-        if (opt_ptr->kflag) {
-            fputs("Error: -k specified without -s.\n", stderr);
-        }
-        usage_err(argv[0]);
-    }
-}
+    /* If the trie was loaded from an image, the pools above point into this
+     * read-only mapping and must not be modified or freed.
+     */
+    void *image;
+    size_t image_len;
+};
 
-/* Instead of using the whole ASCII charset, we'd only use the set of printable
- * characters. This cuts down the struct size from 2056 bytes to 768 bytes if 
- * using 64-bit integers, or from 1028 bytes to 384 bytes if using 32-bit integers.
- * (or so pahole outputs, there might be a slight difference in the size across 
- * different platforms).
+/* Asks for the pages of [p, p + len) to be backed by transparent huge pages,
+ * if the trie was created with TRIE_HUGE_PAGES. A random descent touches about
+ * one new page per node, so with 4 KiB pages a lookup in a big trie misses the
+ * TLB at nearly every step; with 2 MiB pages, a much larger part of the pools
+ * stays covered. This is only a hint, and failures are ignored.
  */
+static void advise_huge_pages(const struct trie *t, void *p, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    if (!t->huge_pages) {
+        return;
+    }
 
-#define CHILDREN_COUNT 95
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t start = ((uintptr_t) p + page - 1) & ~(page - 1);
+    const uintptr_t end = ((uintptr_t) p + len) & ~(page - 1);
 
-/* In the children array, 32 should map to 0, 65 should map to 33, and so on. */
-#define ASCII_OFFSET ' '        /* ASCII code: 32, start of printable characters. */
+    if (end > start) {
+        madvise((void *) start, end - start, MADV_HUGEPAGE);
+    }
+#else
+    (void) t;
+    (void) p;
+    (void) len;
+#endif
+}
 
-/* This wastes half the indexing range. Perhaps we can use uint32_t instead of
- * int32_t, and use UINT32_MAX as the sentinel value.
+/* Returns the capacity to grow a pool holding `len` of `cap` elements to, to
+ * make room for `need` more: twice the current capacity, or `min_step` more if
+ * that is larger, and no more than INDEX_MAX. Growing geometrically rather than
+ * by a fixed step keeps the total cost of the reallocs linear in the final size
+ * of the pool. Returns 0 if the pool can not hold `need` more elements.
  */
-#define INVALID_OFFSET -1
-
-#define INITIAL_POOL_CAP 1024 * 2
+static Index grow_capacity(Index len, Index cap, size_t need, 
+                             Index min_step)
+{
+    const size_t wanted = (size_t) len + need;
+    size_t new_cap = (size_t) cap + (size_t) (cap > min_step ? cap : min_step);
 
-typedef struct {
-    /* TODO: This still wastes a lot of memory. Something like Pythons's dict 
-     * would be better. Explore the idea of using a dynamically growing 
-     * hash-table for Node.children. 
-     */
+    if (new_cap < wanted) {
+        new_cap = wanted;
+    }
 
-    /* We shall store indices within the `Trie.pool` array instead of storing
-     * huge word size pointers. This also simplifies serializing and
-     * deserializing the structure.
-     *
-     * See also: A case where int32_t wasn't sufficient - bbc.com/news/world-asia-30288542
-     */
-    int32_t children[CHILDREN_COUNT];
-    bool terminal;
-} Node;
+    if (new_cap > INDEX_MAX) {
+        new_cap = INDEX_MAX;
+    }
+    return wanted > new_cap ? 0 : (Index) new_cap;
+}
 
-struct Trie {
-    Node *pool;
-    int32_t count;
-    int32_t capacity;
-} Trie; 
+/* Labels every byte with itself. */
+static void init_alphabet(struct trie *t)
+{
+    for (size_t i = 0; i <= UCHAR_MAX; ++i) {
+        t->label_of[i] = (uint8_t) i;
+        t->byte_of[i] = (uint8_t) i;
+    }
+    t->alphabet_size = ALPHABET_SIZE;
+}
 
-static bool init_pool(void)
+static bool init_pool(struct trie *t)
 {
-    Trie.pool = malloc(sizeof *Trie.pool * INITIAL_POOL_CAP);
+    t->pool = malloc(sizeof *t->pool * INITIAL_POOL_CAP);
+    t->labels = malloc(sizeof *t->labels * INITIAL_POOL_CAP);
+    t->targets = malloc(sizeof *t->targets * INITIAL_POOL_CAP);
+    t->text = malloc(INITIAL_POOL_CAP);
 
-    if (Trie.pool == NULL) {
+    if (t->pool == NULL || t->labels == NULL || t->targets == NULL
+        || t->text == NULL) {
         perror("malloc()");
+        free(t->pool);
+        free(t->labels);
+        free(t->targets);
+        free(t->text);
         return false;
     }
 
-    return Trie.capacity = INITIAL_POOL_CAP;
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; ++i) {
+        t->free_blocks[i] = INVALID_OFFSET;
+    }
+
+    init_alphabet(t);
+    t->free_nodes = INVALID_OFFSET;
+    t->edge_capacity = INITIAL_POOL_CAP;
+    t->text_capacity = INITIAL_POOL_CAP;
+    t->capacity = INITIAL_POOL_CAP;
+    advise_huge_pages(t, t->pool, sizeof *t->pool * INITIAL_POOL_CAP);
+    return true;
 }
 
-static inline void free_pool(void)
+static inline void free_pool(struct trie *t)
 {
-    Trie.capacity = 0;
-    Trie.count = 0;
-    free(Trie.pool);
-    Trie.pool = NULL;
+    if (t->image) {
+        munmap(t->image, t->image_len);
+        t->image = NULL;
+        t->image_len = 0;
+        t->pool = NULL;
+        t->labels = NULL;
+        t->targets = NULL;
+        t->text = NULL;
+    }
+
+    t->capacity = 0;
+    t->count = 0;
+    t->edge_capacity = 0;
+    t->edge_count = 0;
+    free(t->pool);
+    free(t->labels);
+    free(t->targets);
+    free(t->text);
+    t->pool = NULL;
+    t->labels = NULL;
+    t->targets = NULL;
+    t->text = NULL;
+    t->text_len = 0;
+    t->text_capacity = 0;
 }
 
-static int32_t alloc_node(void)
+static Index alloc_node(struct trie *t)
 {
-    if (Trie.count >= Trie.capacity) {
-        const int32_t remaining = INT32_MAX - Trie.capacity;
+    if (t->free_nodes != INVALID_OFFSET) {
+        const Index idx = t->free_nodes;
+
+        t->free_nodes = t->pool[idx].edges;
+        --t->free_node_count;
+        t->pool[idx].edges = INVALID_OFFSET;
+        return idx;
+    }
+
+    if (t->count >= t->capacity) {
+        const Index new_cap = grow_capacity(t->count, t->capacity, 1, 
+                                              INITIAL_POOL_CAP);
 
         /* We can no longer add more nodes. Bail out. */
-        if (remaining == 0) {
+        if (new_cap == 0) {
             /* Is this helpful? */
             fputs("Error: too many nodes. Consider recompiling the program "
-                "with a greater int width for more indexing range.\n", stderr);
+                "with 64-bit indices (make index64).\n", stderr);
             exit(EXIT_FAILURE);
         }
 
-        Trie.capacity += remaining < INITIAL_POOL_CAP ? remaining : INITIAL_POOL_CAP;
-        void *const tmp = realloc(Trie.pool, sizeof *Trie.pool * (size_t) Trie.capacity);
+        void *const tmp = realloc(t->pool, sizeof *t->pool * (size_t) new_cap);
 
         if (tmp == NULL) {
             perror("realloc()");
             return INVALID_OFFSET;
         }
 
-        Trie.pool = tmp;
+        t->pool = tmp;
+        t->capacity = new_cap;
+        ++t->grows;
+        advise_huge_pages(t, t->pool, sizeof *t->pool * (size_t) new_cap);
     }
 
-    Node *const tmp = Trie.pool + Trie.count; 
+    Node *const tmp = t->pool + t->count; 
 
-    memset(tmp->children, INVALID_OFFSET, sizeof tmp->children);
-    Trie.pool[Trie.count].terminal = false;
-    return Trie.count++;
+    /* Clear the padding as well, so that saved images are reproducible. */
+    memset(tmp, 0, sizeof *tmp);
+    tmp->edges = INVALID_OFFSET;
+    return t->count++;
 }
 
-static bool insert_text(int32_t root_idx, const char *text)
+/* Returns the first slot of a free block of class `cls`, or INVALID_OFFSET on
+ * allocation failure.
+ */
+static Index alloc_block(struct trie *t, uint8_t cls)
 {
-    for (; *text != '\0'; ++text) {
-        const int32_t idx = *text - ASCII_OFFSET;
+    const Index block = t->free_blocks[cls];
 
-        if (Trie.pool[root_idx].children[idx] == INVALID_OFFSET) {
-            const int32_t tmp = alloc_node();
+    if (block != INVALID_OFFSET) {
+        t->free_blocks[cls] = t->targets[block];
+        return block;
+    }
 
-            if (tmp == INVALID_OFFSET) {
-                return false;
-            }
+    const Index size = BLOCK_SIZE(cls);
+
+    if (t->edge_capacity - t->edge_count < size) {
+        const size_t new_cap = (size_t) grow_capacity(t->edge_count, 
+                                                      t->edge_capacity,
+                                                      (size_t) size, 
+                                                      INITIAL_POOL_CAP);
+
+        if (new_cap == 0) {
+            fputs("Error: too many edges. Consider recompiling the program "
+                "with 64-bit indices (make index64).\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        void *const labels = realloc(t->labels, sizeof *t->labels * new_cap);
+
+        if (labels == NULL) {
+            perror("realloc()");
+            return INVALID_OFFSET;
+        }
+
+        t->labels = labels;
+
+        void *const targets = realloc(t->targets, sizeof *t->targets * new_cap);
 
-            Trie.pool[root_idx].children[idx] = tmp;
+        if (targets == NULL) {
+            perror("realloc()");
+            return INVALID_OFFSET;
         }
-        root_idx = Trie.pool[root_idx].children[idx];
+
+        t->targets = targets;
+        t->edge_capacity = (Index) new_cap;
+        ++t->grows;
+        advise_huge_pages(t, t->targets, sizeof *t->targets * new_cap);
     }
 
-    Trie.pool[root_idx].terminal = true;
-    return true;
+    /* Clear the unused slots as well, so that saved images are reproducible. */
+    memset(t->labels + t->edge_count, 0, sizeof *t->labels * (size_t) size);
+    memset(t->targets + t->edge_count, 0, sizeof *t->targets * (size_t) size);
+    t->edge_count += size;
+    return t->edge_count - size;
 }
 
-static char ac_buffer[AC_BUFFER_CAP];
-static size_t ac_buffer_sz;
-
-static void ac_buffer_push(char ch)
+static void free_block(struct trie *t, Index block, uint8_t cls)
 {
-    /* No check here, for we would have exited in parse_options() if the length
-     * of the prefix was greater than AC_BUFFER_CAP.
-     */
-    ac_buffer[ac_buffer_sz++] = ch;
+    t->targets[block] = t->free_blocks[cls];
+    t->free_blocks[cls] = block;
 }
 
-static void ac_buffer_pop(void)
+/* Puts the node `idx`, which has no children left, on the free list. */
+static void free_node(struct trie *t, Index idx)
 {
-    if (ac_buffer_sz > 0) {
-        --ac_buffer_sz;
-    }
+    Node *const node = t->pool + idx;
+
+    memset(node, 0, sizeof *node);
+    node->edges = t->free_nodes;
+    t->free_nodes = idx;
+    ++t->free_node_count;
 }
 
-static int32_t find_prefix(int32_t root_idx, const char *prefix)
+/* A frozen trie can have its children laid out as a double array instead of
+ * in sparse blocks: the `edges` of a node is then the base of a window of
+ * slots, one for every label from 0 to `alphabet_size`, and its child labelled
+ * c, if any, sits at slot base + c. The windows of different nodes overlap, so
+ * every slot records the label of its edge, and no two nodes share a base. A
+ * slot at base + c holding c therefore belongs to the node with that base, and
+ * a transition is an add and a compare instead of a binary search over the
+ * block. Leaves all get the base 0, whose window is kept free, so that they
+ * need no test of their own.
+ *
+ * freeze_trie() packs the windows first fit, and the arrays stay about as large
+ * as the sparse blocks were, for those round up to a power of two.
+ */
+/* The label of a free slot is that of a nul byte, which no key holds. */
+#define DA_FREE   ((uint8_t) 0)
+
+/* Returns the position of the first child of `node` whose label is not less
+ * than `label`. It is the position of the child labelled `label` if there is
+ * one, and the position it should be inserted at otherwise.
+ */
+static uint8_t child_lower_bound(const struct trie *t, const Node *node,
+                                 uint8_t label)
 {
-    for (; *prefix != '\0'; ++prefix) {
-        const int32_t child_idx = *prefix - ASCII_OFFSET;
+    const uint8_t *const labels = t->labels + node->edges;
+    uint8_t lo = 0;
+    uint8_t hi = node->nchildren;
 
-        if (Trie.pool[root_idx].children[child_idx] == INVALID_OFFSET) {
-            return INVALID_OFFSET;
-        }
+    while (lo < hi) {
+        const uint8_t mid = (uint8_t) (lo + (hi - lo) / 2);
 
-        root_idx = Trie.pool[root_idx].children[child_idx];
-        ac_buffer_push(*prefix);
+        if (labels[mid] < label) {
+            lo = (uint8_t) (mid + 1);
+        } else {
+            hi = mid;
+        }
     }
-    return root_idx;
+    return lo;
 }
 
-static void dump_dot_prefix(FILE *sink, int32_t root_idx)
+/* Returns the slot of the edge labelled `label` out of `node`, or
+ * INVALID_OFFSET if there is none.
+ */
+static inline Index find_slot(const struct trie *t, const Node *node, 
+                                uint8_t label)
 {
-    for (size_t i = 0; i < CHILDREN_COUNT; ++i) {
-        if (Trie.pool[root_idx].children[i] != INVALID_OFFSET) {
-            const int32_t child_index = Trie.pool[root_idx].children[i];
+    if (t->double_array) {
+        const Index slot = node->edges + label;
 
-            if (Trie.pool[child_index].terminal) {
-                fprintf(sink,
-                    "\tNode_%" PRId32 " [label=%c,fillcolor=lightgreen]\n",
-                    child_index, (char) (i + ASCII_OFFSET));
-            } else {
-                fprintf(sink, "\tNode_%" PRId32 " [label=%c]\n", child_index,
-                    (char) (i + ASCII_OFFSET));
-            }
-
-            fprintf(sink, "\tNode_%" PRId32 " -> Node_%" PRId32 " [label=%c]\n",
-                root_idx, child_index, (char) (i + ASCII_OFFSET));
-            dump_dot_prefix(sink, Trie.pool[root_idx].children[i]);
-        }
+        /* A byte no key holds has the label of a free slot. */
+        return t->labels[slot] == label && label != DA_FREE 
+            ? slot 
+            : INVALID_OFFSET;
     }
+
+    const uint8_t pos = child_lower_bound(t, node, label);
+
+    return pos < node->nchildren && t->labels[node->edges + pos] == label
+        ? node->edges + pos
+        : INVALID_OFFSET;
 }
 
-static void dump_dot_whole(FILE *sink)
+static inline Index find_child(const struct trie *t, const Node *node, 
+                                 uint8_t label)
 {
-    for (int32_t i = 0; i < Trie.count; ++i) {
-        const int32_t index = i;
+    const Index slot = find_slot(t, node, label);
 
-        for (size_t j = 0; j < CHILDREN_COUNT; ++j) {
-            if (Trie.pool[i].children[j] != INVALID_OFFSET) {
-                const int32_t child_index = Trie.pool[i].children[j];
+    return slot == INVALID_OFFSET ? INVALID_OFFSET : t->targets[slot];
+}
 
-                if (Trie.pool[child_index].terminal) {
-                    fprintf(sink,
-                        "\tNode_%" PRId32 " [label=%c,fillcolor=lightgreen]\n",
-                        child_index, (char) (j + ASCII_OFFSET));
-                } else {
-                    fprintf(sink, "\tNode_%" PRId32 " [label=%c]\n",
-                        child_index, (char) (j + ASCII_OFFSET));
-                }
+/* Returns the slot of the child of `node` that follows the one in `slot` in
+ * label order, or of its first child if `slot` is INVALID_OFFSET. There must be
+ * such a child. In a sparse block, that is the next slot; in a double array,
+ * the next slot in use that holds its own label.
+ */
+static inline Index next_slot(const struct trie *t, const Node *node, 
+                              Index slot)
+{
+    Index next = slot == INVALID_OFFSET ? node->edges : slot + 1;
 
-                fprintf(sink,
-                    "\tNode_%" PRId32 " -> Node_%" PRId32 " [label=%c]\n",
-                    index, child_index, (char) (j + ASCII_OFFSET));
-            }
+    if (t->double_array) {
+        while (t->labels[next] != (uint8_t) (next - node->edges)
+               || t->labels[next] == DA_FREE) {
+            ++next;
         }
     }
+    return next;
 }
 
-static void print_suggestions(int32_t root_idx)
+/* Copies `len` bytes of `s` to the end of `t->text`, and returns the offset
+ * they were copied to, or INVALID_OFFSET on allocation failure.
+ */
+static Index append_text(struct trie *t, const char *s, size_t len)
 {
-    if (Trie.pool[root_idx].terminal) {
-        fwrite(ac_buffer, ac_buffer_sz, 1, stdout);
-        fputc('\n', stdout);
-    }
+    if ((size_t) (t->text_capacity - t->text_len) < len) {
+        const size_t new_cap = (size_t) grow_capacity(t->text_len, 
+                                                      t->text_capacity, len, 
+                                                      TEXT_POOL_STEP);
+
+        if (new_cap == 0) {
+            fputs("Error: too much edge text. Consider recompiling the program "
+                "with 64-bit indices (make index64).\n", stderr);
+            exit(EXIT_FAILURE);
+        }
 
-    for (size_t i = 0; i < CHILDREN_COUNT; ++i) {
-        if (Trie.pool[root_idx].children[i] != INVALID_OFFSET) {
-            ac_buffer_push((char) (i + ASCII_OFFSET));
-            print_suggestions(Trie.pool[root_idx].children[i]);
-            ac_buffer_pop();
+        void *const tmp = realloc(t->text, new_cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return INVALID_OFFSET;
         }
+
+        t->text = tmp;
+        t->text_capacity = (Index) new_cap;
+        ++t->grows;
     }
+
+    memcpy(t->text + t->text_len, s, len);
+    t->text_len += (Index) len;
+    return t->text_len - (Index) len;
 }
 
-static bool populate_trie(int32_t root_idx, char **lines, size_t num_lines)
+/* Links `child` under `t->pool[parent_idx]` with `label`, moving the parent
+ * to a bigger block if its current one is full. The label must not already be
+ * present.
+ */
+static bool add_child(struct trie *t, Index parent_idx, uint8_t label, 
+                      Index child)
 {
-    for (size_t i = 0; i < num_lines; ++i) {
-        if (!insert_text(root_idx, lines[i])) {
+    Node *const node = t->pool + parent_idx;
+    const uint8_t pos = child_lower_bound(t, node, label);
+
+    if (node->edges == INVALID_OFFSET
+        || node->nchildren == BLOCK_SIZE(node->block_class)) {
+        const uint8_t cls = node->edges == INVALID_OFFSET 
+                          ? 0 
+                          : (uint8_t) (node->block_class + 1);
+        const Index block = alloc_block(t, cls);
+
+        if (block == INVALID_OFFSET) {
             return false;
         }
+
+        if (node->edges != INVALID_OFFSET) {
+            memcpy(t->labels + block, t->labels + node->edges, node->nchildren);
+            memcpy(t->targets + block, t->targets + node->edges,
+                sizeof *t->targets * node->nchildren);
+            free_block(t, node->edges, node->block_class);
+        }
+
+        node->edges = block;
+        node->block_class = cls;
     }
+
+    uint8_t *const labels = t->labels + node->edges;
+    Index *const targets = t->targets + node->edges;
+    const size_t tail = (size_t) (node->nchildren - pos);
+
+    memmove(labels + pos + 1, labels + pos, tail);
+    memmove(targets + pos + 1, targets + pos, sizeof *targets * tail);
+    labels[pos] = label;
+    targets[pos] = child;
+    ++node->nchildren;
     return true;
 }
 
-static bool generate_graph(void)
+/* Unlinks the child in `slot` from `t->pool[parent_idx]`. A node left
+ * without children gives its block back.
+ */
+static void remove_child(struct trie *t, Index parent_idx, Index slot)
 {
-    if (system("dot -Tsvg " OUTPUT_DOT_FILE " -O")) {
-        fprintf(stderr, "Error: failed to generate the .SVG file, %s.\n",
-            strerror(errno));
-        return false;
+    Node *const node = t->pool + parent_idx;
+    const size_t pos = (size_t) (slot - node->edges);
+    const size_t tail = (size_t) node->nchildren - pos - 1;
+
+    memmove(t->labels + slot, t->labels + slot + 1, tail);
+    memmove(t->targets + slot, t->targets + slot + 1, sizeof *t->targets * tail);
+    --node->nchildren;
+
+    /* Clear the slot left over as well, so that saved images are
+     * reproducible.
+     */
+    t->labels[node->edges + node->nchildren] = 0;
+    t->targets[node->edges + node->nchildren] = 0;
+
+    if (node->nchildren == 0) {
+        free_block(t, node->edges, node->block_class);
+        node->edges = INVALID_OFFSET;
+        node->block_class = 0;
     }
+}
 
-    return true;
+/* Hangs the rest of `text` below `t->pool[root_idx]`, which has no child
+ * for `*text`. In radix mode this is a single edge; otherwise a chain of nodes,
+ * one per character. Returns the index of the new terminal node, or
+ * INVALID_OFFSET on allocation failure.
+ */
+static Index insert_suffix(struct trie *t, Index root_idx, const char *text)
+{
+    if (t->radix) {
+        const size_t len = strlen(text + 1);
+        const Index child = alloc_node(t);
+        const Index tail = len ? append_text(t, text + 1, len) : 0;
+
+        if (child == INVALID_OFFSET || tail == INVALID_OFFSET
+            || !add_child(t, root_idx, LABEL_OF(t, *text), child)) {
+            return INVALID_OFFSET;
+        }
+
+        t->pool[child].tail = tail;
+        t->pool[child].tail_len = (Index) len;
+        return child;
+    }
+
+    for (; *text != '\0'; ++text) {
+        const Index child = alloc_node(t);
+
+        if (child == INVALID_OFFSET
+            || !add_child(t, root_idx, LABEL_OF(t, *text), child)) {
+            return INVALID_OFFSET;
+        }
+        root_idx = child;
+    }
+    return root_idx;
 }
 
-static bool generate_dot(int32_t root_idx, const char *prefix)
+/* Splits the edge in `slot` after the first `len` characters of its target's
+ * tail, by putting a new node in between. Returns the index of the new node, 
+ * or INVALID_OFFSET on allocation failure.
+ */
+static Index split_edge(struct trie *t, Index slot, Index len)
 {
-    FILE *const sink = fopen(OUTPUT_DOT_FILE, "w");
+    const Index mid = alloc_node(t);
 
-    if (sink == NULL) {
-        perror("fopen()");
-        return false;
+    if (mid == INVALID_OFFSET) {
+        return INVALID_OFFSET;
     }
 
-    fprintf(sink, "digraph Trie {\n"
-        "\tnode [fillcolor=lightblue,style=filled,arrowhead=vee,color=black]\n"
-        "\tNode_%" PRId32 " [label=%s]\n", root_idx, prefix ? prefix : "root");
+    const Index child = t->targets[slot];
+    Node *const node = t->pool + child;
+
+    t->pool[mid].tail = node->tail;
+    t->pool[mid].tail_len = len;
+    t->pool[mid].max_weight = node->max_weight;
+    t->pool[mid].keys = node->keys;
 
-    root_idx == 0 ? dump_dot_whole(sink) : dump_dot_prefix(sink, root_idx);
-    fprintf(sink, "}\n");
-    return !fclose(sink);
+    const uint8_t label = LABEL_OF(t, t->text[node->tail + len]);
+
+    node->tail += len + 1;
+    node->tail_len -= len + 1;
+    t->targets[slot] = mid;
+    return add_child(t, mid, label, child) ? mid : INVALID_OFFSET;
 }
 
-static bool process_args(int32_t                root_idx,
-                         const flags *          options, 
-                         const char *restrict   prefix,
-                         const char *restrict   out_file)
+/* Raises `max_weight` on the path to the (existing) key `text` to `weight`,
+ * and counts the key in every subtree on the way if it is `added`.
+ */
+static void update_path(struct trie *t, Index root_idx, const char *text,
+                        uint32_t weight, bool added)
 {
-    bool rv = true;
+    for (;;) {
+        Node *const node = t->pool + root_idx;
 
-    /* Handle --complete first as we are going to modify root later in case
-     * prefix is not a null pointer. 
-     */
-    if (options->cflag) {
-        const int32_t subtree_idx = find_prefix(root_idx, prefix);
+        if (node->max_weight < weight) {
+            node->max_weight = weight;
+        }
+
+        node->keys += added;
 
-        if (subtree_idx == INVALID_OFFSET) {
-            fprintf(stderr, "Error: Unable to find prefix.\n");
-            rv = !rv;
-            goto cleanup;
+        if (*text == '\0') {
+            break;
         }
 
-        print_suggestions(subtree_idx);
+        root_idx = find_child(t, node, LABEL_OF(t, *text));
+        text += 1 + t->pool[root_idx].tail_len;
     }
+}
+
+/* Inserts the key `text`. Inserting a key again adds `weight` to its weight,
+ * so a key's weight is its frequency in an unweighted word list.
+ */
+static bool insert_text(struct trie *t, Index root_idx, const char *text, 
+                        uint32_t weight)
+{
+    const Index trie_root = root_idx;
+    const char *const key = text;
+
+    while (*text != '\0') {
+        const Index slot = find_slot(t, t->pool + root_idx, 
+                                 LABEL_OF(t, *text));
 
-    if (options->sflag) {
-        if (prefix) {
-            const int32_t subtree_idx = find_prefix(root_idx, prefix);
+        if (slot == INVALID_OFFSET) {
+            root_idx = insert_suffix(t, root_idx, text);
 
-            if (subtree_idx == INVALID_OFFSET) {
-                fprintf(stderr, "Error: Unable to find prefix.\n");
-                rv = !rv;
-                goto cleanup;
+            if (root_idx == INVALID_OFFSET) {
+                return false;
             }
-            root_idx = subtree_idx;
+            break;
+        }
+
+        const Index child = t->targets[slot];
+        const char *const tail = t->text + t->pool[child].tail;
+        const Index tail_len = t->pool[child].tail_len;
+        Index matched = 0;
+
+        ++text;
+
+        while (matched < tail_len && text[matched] == tail[matched]) {
+            ++matched;
         }
 
-        if (!generate_dot(root_idx, prefix)
-            || !generate_graph()) {
-            rv = !rv;
+        if (matched < tail_len) {
+            root_idx = split_edge(t, slot, matched);
+
+            if (root_idx == INVALID_OFFSET) {
+                return false;
+            }
+        } else {
+            root_idx = child;
         }
+        text += matched;
     }
 
-  cleanup:
-    if (!options->kflag) {
-        remove(out_file);
+    Node *const node = t->pool + root_idx;
+    const bool added = !node->terminal;
+
+    if (added) {
+        node->terminal = true;
+        ++t->keys;
     }
 
-    return rv;
+    node->weight = UINT32_MAX - node->weight < weight 
+                 ? UINT32_MAX 
+                 : node->weight + weight;
+    update_path(t, trie_root, key, node->weight, added);
+    return true;
 }
 
-int main(int argc, char *argv[])
+/* Replaces the node in `slot`, which is no key and has a single child, by
+ * that child, whose edge then takes the text of both. The text is usually
+ * still contiguous in `text`, from before an insertion split it, in which
+ * case nothing is copied. Returns false on allocation failure.
+ */
+static bool merge_edge(struct trie *t, Index slot)
 {
+    const Index mid = t->targets[slot];
+    const Index child_slot = t->pool[mid].edges;
+    const Index child = t->targets[child_slot];
+    Node *const m = t->pool + mid;
+    Node *const node = t->pool + child;
+    const char label = CHAR_OF(t, t->labels[child_slot]);
+    const size_t len = (size_t) m->tail_len + 1 + (size_t) node->tail_len;
+    /* Where the text would start if it were still contiguous. */
+    size_t start = (size_t) m->tail;
 
-    /* Sanity check. POSIX requires the invoking process to pass a non-NULL 
-     * argv[0]. 
-     */
-    if (!argv[0]) {
-        fprintf(stderr,
-            "A NULL argv[0] was passed through an exec system call.\n");
-        return EXIT_FAILURE;
-    }
-
-    static const struct option long_options[] = {
-        { "keep", no_argument, NULL, 'k' },
-        { "help", no_argument, NULL, 'h' },
-        { "svg", no_argument, NULL, 's' },
-        { "complete", required_argument, NULL, 'c' },
-        { "prefix", required_argument, NULL, 'p' },
-        { NULL, 0, NULL, 0 },
-    };
+    if (node->tail_len) {
+        start = node->tail > m->tail_len 
+              ? (size_t) (node->tail - m->tail_len - 1) 
+              : SIZE_MAX;
+    }
+
+    if (start == SIZE_MAX || start + len > (size_t) t->text_len
+        || memcmp(t->text + start, t->text + m->tail, (size_t) m->tail_len)
+        || t->text[start + m->tail_len] != label
+        || memcmp(t->text + start + m->tail_len + 1, t->text + node->tail,
+                  (size_t) node->tail_len)) {
+        /* The text is copied out first, for appending may move it. */
+        char *const buf = malloc(len);
 
-    FILE *in_file = stdin;
-    flags options = { false, false, false, false, false };
-    const char *search_prefix = NULL;
+        if (buf == NULL) {
+            perror("malloc()");
+            return false;
+        }
 
-    parse_options(long_options, &options, argc, argv, &search_prefix);
+        memcpy(buf, t->text + m->tail, (size_t) m->tail_len);
+        buf[m->tail_len] = label;
+        memcpy(buf + m->tail_len + 1, t->text + node->tail, (size_t) node->tail_len);
 
-    if (options.sflag || options.cflag) {
-        if ((optind + 1) == argc) {
-            in_file = fopen(argv[optind], "r");
-            if (in_file == NULL) {
-                perror(argv[optind]);
-                return EXIT_FAILURE;
-            }
+        const Index tail = append_text(t, buf, len);
+
+        free(buf);
+
+        if (tail == INVALID_OFFSET) {
+            return false;
         }
-    } else {
-        usage_err(PROGRAM_NAME);
+        start = (size_t) tail;
     }
 
-    if (optind > argc) {
-        usage_err(PROGRAM_NAME);
+    node->tail = (Index) start;
+    node->tail_len = (Index) len;
+    t->targets[slot] = child;
+    free_block(t, m->edges, m->block_class);
+    free_node(t, mid);
+    return true;
+}
+
+/* Removes the key `text`, if it is in the trie. The nodes that no longer lead
+ * to any key are unlinked and put on the free list, and in radix mode, a node
+ * left with a single child and no key is merged into the edge below it, so
+ * that the trie has the shape it would have had without the key. The highest
+ * weights on the path are lowered bottom-up, up to the first node where they
+ * no longer change, so the cost is bounded by the length of the key.
+ */
+static bool remove_text(struct trie *t, const char *text)
+{
+    const size_t len = strlen(text);
+    /* The nodes on the path to the key, and the slots of the edges into them. */
+    Index *const path = malloc(sizeof *path * 2 * (len + 1));
+
+    if (path == NULL) {
+        perror("malloc()");
+        return false;
     }
 
-    size_t nbytes = 0;
-    char *const content = io_read_file(in_file, &nbytes);
-    size_t nlines = 0;
-    char **lines = io_split_lines(content, &nlines);
+    Index *const slots = path + len + 1;
+    size_t depth = 0;
+    Index node_idx = t->root;
 
-    if (lines == NULL) {
-        free(content);
-        perror("fread()");
-        return EXIT_FAILURE;
+    path[depth] = node_idx;
+    slots[depth++] = INVALID_OFFSET;
+
+    while (*text != '\0' && node_idx != INVALID_OFFSET) {
+        const Index slot = find_slot(t, t->pool + node_idx, 
+                                     LABEL_OF(t, *text));
+
+        if (slot == INVALID_OFFSET) {
+            node_idx = INVALID_OFFSET;
+            break;
+        }
+
+        const Node *const child = t->pool + t->targets[slot];
+        Index matched = 0;
+
+        ++text;
+
+        while (matched < child->tail_len 
+               && text[matched] == t->text[child->tail + matched]) {
+            ++matched;
+        }
+
+        node_idx = matched == child->tail_len ? t->targets[slot] : INVALID_OFFSET;
+        text += matched;
+        path[depth] = node_idx;
+        slots[depth++] = slot;
     }
 
-    bool rv = true;
-    int32_t root_idx = INVALID_OFFSET;
+    if (node_idx == INVALID_OFFSET || !t->pool[node_idx].terminal) {
+        free(path);
+        return true;
+    }
 
-    if (!init_pool()
-        || (root_idx = alloc_node()) == INVALID_OFFSET
-        || !populate_trie(root_idx, lines, nlines)) {
-        rv = !rv;
-        goto cleanup;
+    t->pool[node_idx].terminal = false;
+    t->pool[node_idx].weight = 0;
+    --t->keys;
 
+    for (size_t i = 0; i < depth; ++i) {
+        --t->pool[path[i]].keys;
     }
 
-    D(
-        char *const total = calculate_size((size_t) Trie.capacity * sizeof *Trie.pool);
-        char *const used = calculate_size((size_t) Trie.count * sizeof *Trie.pool);
+    while (depth > 1 && !t->pool[path[depth - 1]].terminal
+           && t->pool[path[depth - 1]].nchildren == 0) {
+        remove_child(t, path[depth - 2], slots[depth - 1]);
+        free_node(t, path[depth - 1]);
+        --depth;
+    }
 
-        debug_printf("Total lines read: %zu.\n" "Total nodes allocated: %"
-                    PRId32 ".\n" "Total nodes used: %" PRId32 ".\n"
-                    "Total memory allocated: %s.\n" "Total memory used: %s.\n",
-                    nlines, 
-                    Trie.capacity, 
-                    Trie.count, 
-                    total, 
-                    used); 
-        /* free(total); */
-        /* free(used); */
-    );
-    
-    rv = process_args(root_idx, &options, search_prefix, OUTPUT_DOT_FILE);
+    bool rv = true;
 
-  cleanup:
-    /* We're exiting. There's no need of freeing memory. */
-    /* free_pool();                /1* NO-OP if init_pool() returns false. *1/ */
-    /* free(content); */
-    /* free(lines); */
+    if (t->radix && depth > 1 && !t->pool[path[depth - 1]].terminal
+        && t->pool[path[depth - 1]].nchildren == 1) {
+        /* The child keeps its highest weight; that of the parent may drop. */
+        rv = merge_edge(t, slots[depth - 1]);
+        depth -= rv;
+    }
+
+    while (depth--) {
+        Node *const node = t->pool + path[depth];
+        uint32_t max_weight = node->terminal ? node->weight : 0;
+        Index slot = INVALID_OFFSET;
+
+        for (uint8_t i = 0; i < node->nchildren; ++i) {
+            slot = next_slot(t, node, slot);
+
+            const uint32_t w = t->pool[t->targets[slot]].max_weight;
+
+            max_weight = w > max_weight ? w : max_weight;
+        }
 
-    if (in_file != stdin) {
-        fclose(in_file);
+        if (node->max_weight == max_weight) {
+            break;
+        }
+        node->max_weight = max_weight;
     }
 
-    return rv ? EXIT_SUCCESS : EXIT_FAILURE;
+    free(path);
+    return rv;
+}
+
+/* A cursor holds the path to the node it is positioned at, which is the
+ * prefix of every key below it, along with the scratch space of the searches
+ * that start there. Nothing in it is shared with other cursors.
+ */
+typedef struct {
+    uint32_t score;
+    Index node;                 /* INVALID_OFFSET for a key to be emitted. */
+    size_t key;                 /* Offset of the key in `top_keys`. */
+    size_t key_len;
+    size_t row;                 /* See fuzzy_search(); NO_ROW otherwise. */
+} Candidate;
+
+#define NO_ROW SIZE_MAX
+
+/* A node on the stack of a depth-first traversal. Traversals keep a stack of
+ * their own rather than recursing, for a key can be far longer than the call
+ * stack is deep.
+ */
+typedef struct {
+    Index node;
+    Index slot;                 /* Of the child visited last, initially INVALID_OFFSET. */
+    size_t key_len;             /* The length of the key at the node. */
+    uint8_t left;               /* Children not visited yet. */
+} Frame;
+
+struct trie_cursor {
+    const struct trie *trie;
+    Index node;                 /* INVALID_OFFSET if positioned nowhere. */
+
+    /* The path grows past TRIE_PREFIX_MAX bytes when a prefix ends on a long
+     * radix edge, which is taken whole.
+     */
+    char *path;
+    size_t path_len;
+    size_t path_cap;
+
+    /* trie_find_prefix() records every node it passes through, along with the
+     * length of the path to it, so that the next lookup can resume from the
+     * deepest node on the path it shares with the last one rather than from
+     * the root.
+     */
+    Index descent_nodes[TRIE_PREFIX_MAX + 1];
+    size_t descent_lens[TRIE_PREFIX_MAX + 1];
+    size_t descent_depth;
+    size_t visits;              /* Nodes the last lookup descended to. */
+    size_t generation;          /* That of the trie when they were recorded. */
+
+    /* The heap and key buffer of top-K searches, reused across queries. */
+    Candidate *top_heap;
+    size_t top_heap_len;
+    size_t top_heap_cap;
+    char *top_keys;
+    size_t top_keys_len;
+    size_t top_keys_cap;
+
+    /* The stack and key buffer of full enumerations. The key starts with the
+     * path.
+     */
+    Frame *dfs_stack;
+    size_t dfs_stack_cap;
+    char *dfs_key;
+    size_t dfs_key_cap;
+
+    /* The stack, key buffer and edit distance rows of fuzzy searches. */
+    Frame *fuzzy_stack;
+    size_t fuzzy_stack_cap;
+    char *fuzzy_key;
+    size_t fuzzy_key_cap;
+    uint16_t *fuzzy_rows;
+    size_t fuzzy_rows_len;
+    size_t fuzzy_rows_cap;
+};
+
+/* Makes room for a key of `len` bytes in the key buffer at `*key`. */
+static bool key_reserve(char **key, size_t *cap, size_t len)
+{
+    if (*key && *cap >= len) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap : TRIE_PREFIX_MAX;
+
+    while (new_cap < len) {
+        new_cap *= 2;
+    }
+
+    void *const tmp = realloc(*key, new_cap);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    *key = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+static void path_push(trie_cursor_t *cur, char ch)
+{
+    /* No check here, for enter_child() makes room for the whole edge first. */
+    cur->path[cur->path_len++] = ch;
+}
+
+static void path_append(trie_cursor_t *cur, const char *s, size_t len)
+{
+    memcpy(cur->path + cur->path_len, s, len);
+    cur->path_len += len;
+}
+
+/* Takes the edge into `child_idx`, which the prefix at `*prefix` starts, and
+ * moves `*prefix` past it. Returns false if the prefix leaves the trie on the
+ * way, or on memory allocation failure.
+ */
+static inline bool enter_child(trie_cursor_t *cur, Index child_idx, 
+                               const char **prefix)
+{
+    const struct trie *const t = cur->trie;
+    const Node *const child = t->pool + child_idx;
+    const char *const tail = t->text + child->tail;
+    const char *p = *prefix;
+
+    if (!key_reserve(&cur->path, &cur->path_cap,
+                     cur->path_len + 1 + (size_t) child->tail_len)) {
+        return false;
+    }
+
+    path_push(cur, *p++);
+
+    /* The prefix may end in the middle of an edge, in which case the
+     * whole edge is taken, since every completion goes through it.
+     */
+    for (Index i = 0; i < child->tail_len && *p != '\0'; ++i) {
+        if (*p++ != tail[i]) {
+            return false;
+        }
+    }
+
+    path_append(cur, tail, (size_t) child->tail_len);
+    cur->descent_nodes[cur->descent_depth] = child_idx;
+    cur->descent_lens[cur->descent_depth++] = cur->path_len;
+    *prefix = p;
+    return true;
+}
+
+static Index descend(trie_cursor_t *cur, Index root_idx, const char *prefix)
+{
+    const struct trie *const t = cur->trie;
+
+    while (*prefix != '\0') {
+        const Index child_idx = find_child(t, t->pool + root_idx,
+                                             LABEL_OF(t, *prefix));
+
+        if (child_idx == INVALID_OFFSET || !enter_child(cur, child_idx, &prefix)) {
+            return INVALID_OFFSET;
+        }
+        root_idx = child_idx;
+    }
+    return root_idx;
+}
+
+/* Starts a lookup of `prefix` from where the previous lookup on `cur` left
+ * off: keeps the nodes on the path the two share, and returns the deepest of
+ * them, with the path of the cursor cut back to it.
+ */
+static Index resume_descent(trie_cursor_t *cur, const char *prefix)
+{
+    /* The nodes recorded before the trie was changed may have been split,
+     * merged or reclaimed since.
+     */
+    if (cur->generation != cur->trie->generation) {
+        cur->generation = cur->trie->generation;
+        cur->descent_nodes[0] = cur->trie->root;
+        cur->descent_depth = 1;
+        cur->path_len = 0;
+    }
+
+    size_t common = 0;
+
+    while (common < cur->path_len && prefix[common] == cur->path[common]) {
+        ++common;
+    }
+
+    while (cur->descent_lens[cur->descent_depth - 1] > common) {
+        --cur->descent_depth;
+    }
+
+    cur->path_len = cur->descent_lens[cur->descent_depth - 1];
+    return cur->descent_nodes[cur->descent_depth - 1];
+}
+
+/* A batch of lookups is advanced a step of one lookup at a time, round-robin,
+ * and every step ends by prefetching what the next step of the same lookup
+ * reads, which is then loaded while the steps of the other lookups run: the
+ * child block of a node, before its children are searched, the child found,
+ * before it is entered, and in a radix trie, its edge text, before that is
+ * compared. A descent that runs alone waits for
+ * every one of these loads in turn; FIND_BATCH_WIDTH of them wait for about as
+ * long as one does.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr) ((void) (addr))
+#endif
+
+#define FIND_BATCH_WIDTH TRIE_FIND_BATCH
+
+/* What the next step of a lookup does. */
+enum { LANE_FIND, LANE_LOAD, LANE_ENTER };
+
+typedef struct {
+    trie_cursor_t *cur;
+    const char *prefix;         /* What is left of it to descend along. */
+    Index node;
+    Index child;                /* Found, unless the stage is LANE_FIND. */
+    size_t resumed;             /* descent_depth at the start. */
+    bool *found;
+    int stage;
+} FindLane;
+
+/* Prefetches the slots of the children of `node_idx`, where the search for
+ * the label of `ch`, which is the next byte of the prefix, goes first.
+ */
+static inline void prefetch_children(const struct trie *t, Index node_idx, 
+                                     char ch)
+{
+    const Node *const node = t->pool + node_idx;
+
+    if (node->edges != INVALID_OFFSET) {
+        const Index slot = t->double_array 
+                         ? node->edges + LABEL_OF(t, ch) 
+                         : node->edges;
+
+        PREFETCH(t->labels + slot);
+        PREFETCH(t->targets + slot);
+    }
+}
+
+static void finish_lane(FindLane *lane, Index node)
+{
+    trie_cursor_t *const cur = lane->cur;
+
+    cur->node = node;
+    cur->visits = cur->descent_depth - lane->resumed;
+
+    if (lane->found) {
+        *lane->found = node != INVALID_OFFSET;
+    }
+}
+
+/* Advances `lane` by a step. Returns false once its lookup is over. */
+static inline bool step_lane(FindLane *lane)
+{
+    const struct trie *const t = lane->cur->trie;
+
+    if (lane->stage == LANE_FIND) {
+        lane->child = find_child(t, t->pool + lane->node, 
+                                 LABEL_OF(t, *lane->prefix));
+
+        if (lane->child == INVALID_OFFSET) {
+            finish_lane(lane, INVALID_OFFSET);
+            return false;
+        }
+
+        PREFETCH(t->pool + lane->child);
+        lane->stage = LANE_LOAD;
+        return true;
+    }
+
+    if (lane->stage == LANE_LOAD && t->pool[lane->child].tail_len) {
+        PREFETCH(t->text + t->pool[lane->child].tail);
+        lane->stage = LANE_ENTER;
+        return true;
+    }
+
+    if (!enter_child(lane->cur, lane->child, &lane->prefix)) {
+        finish_lane(lane, INVALID_OFFSET);
+        return false;
+    }
+
+    lane->node = lane->child;
+    lane->stage = LANE_FIND;
+
+    if (*lane->prefix == '\0') {
+        finish_lane(lane, lane->node);
+        return false;
+    }
+
+    prefetch_children(t, lane->node, *lane->prefix);
+    return true;
+}
+
+/* DOT output goes through a buffer of its own, which integers are formatted
+ * into by hand, rather than through a few fprintf() calls per edge; for big
+ * tries, formatting was most of the cost of a dump.
+ */
+#define DOT_BUFFER_SIZE (1024 * 64)
+
+typedef struct {
+    FILE *sink;
+    char *buf;
+    size_t len;
+    bool failed;                /* A write to `sink` failed. */
+} DotWriter;
+
+static void dot_flush(DotWriter *w)
+{
+    if (!w->failed && w->len && !io_write_file(w->sink, w->len, w->buf)) {
+        w->failed = true;
+    }
+    w->len = 0;
+}
+
+static void dot_write(DotWriter *w, const char *s, size_t len)
+{
+    if (len > DOT_BUFFER_SIZE - w->len) {
+        dot_flush(w);
+
+        if (len > DOT_BUFFER_SIZE) {
+            w->failed = w->failed || !io_write_file(w->sink, len, s);
+            return;
+        }
+    }
+
+    memcpy(w->buf + w->len, s, len);
+    w->len += len;
+}
+
+static inline void dot_putc(DotWriter *w, char ch)
+{
+    if (w->len == DOT_BUFFER_SIZE) {
+        dot_flush(w);
+    }
+    w->buf[w->len++] = ch;
+}
+
+static inline void dot_puts(DotWriter *w, const char *s)
+{
+    dot_write(w, s, strlen(s));
+}
+
+static void dot_index(DotWriter *w, Index n)
+{
+    char digits[24];
+    size_t len = 0;
+
+    do {
+        digits[sizeof digits - ++len] = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n);
+
+    dot_write(w, digits + sizeof digits - len, len);
+}
+
+/* Writes the `head_len` bytes of `head` followed by the `tail_len` bytes of
+ * `tail`, the two halves of a label, as the body of a quoted DOT string.
+ * Graphviz reads its input as UTF-8, and a single edge of a key can hold part
+ * of a character, so only complete UTF-8 sequences and printable ASCII are
+ * written as they are. Any other byte is written as \xHH.
+ */
+static void dot_escape(DotWriter *w, const char *head, size_t head_len,
+                       const char *tail, size_t tail_len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    const size_t len = head_len + tail_len;
+
+#define LABEL_BYTE(i) \
+    ((unsigned char) ((i) < head_len ? head[(i)] : tail[(i) - head_len]))
+
+    for (size_t i = 0; i < len; ) {
+        const unsigned char ch = LABEL_BYTE(i);
+        size_t n = ch < 0x80 ? 1
+                 : ch >= 0xC2 && ch <= 0xDF ? 2
+                 : ch >= 0xE0 && ch <= 0xEF ? 3
+                 : ch >= 0xF0 && ch <= 0xF4 ? 4 : 0;
+
+        for (size_t j = 1; j < n; ++j) {
+            if (i + j >= len || (LABEL_BYTE(i + j) & 0xC0) != 0x80) {
+                n = 0;
+            }
+        }
+
+        if (n > 1) {
+            for (size_t j = 0; j < n; ++j) {
+                dot_putc(w, (char) LABEL_BYTE(i + j));
+            }
+            i += n;
+            continue;
+        }
+
+        if (n == 0 || ch < ' ' || ch == 0x7F) {
+            dot_puts(w, "\\\\x");
+            dot_putc(w, hex[ch >> 4]);
+            dot_putc(w, hex[ch & 0xF]);
+        } else {
+            if (ch == '"' || ch == '\\') {
+                dot_putc(w, '\\');
+            }
+            dot_putc(w, (char) ch);
+        }
+        ++i;
+    }
+
+#undef LABEL_BYTE
+}
+
+/* Writes the label of the edge in `slot` as a quoted DOT string. */
+static void dump_dot_label(const struct trie *t, DotWriter *w, Index slot)
+{
+    const Node *const child = t->pool + t->targets[slot];
+    const char first = CHAR_OF(t, t->labels[slot]);
+
+    dot_putc(w, '"');
+    dot_escape(w, &first, 1, t->text + child->tail, (size_t) child->tail_len);
+    dot_putc(w, '"');
+}
+
+/* Writes the edge in `slot` of the node at `index`, preceded by the line
+ * declaring its child if `declare` is true. A shared node of a minimized trie
+ * is declared only once, however many parents it has.
+ */
+static void dump_dot_edge(const struct trie *t, DotWriter *w, Index index,
+                          Index slot, bool declare)
+{
+    const Index child_index = t->targets[slot];
+
+    if (declare) {
+        dot_puts(w, "\tNode_");
+        dot_index(w, child_index);
+        dot_puts(w, " [label=");
+
+        /* A shared node has several incoming edges, so in a minimized trie
+         * only the edges are labeled.
+         */
+        if (t->minimized) {
+            dot_puts(w, "\"\"");
+        } else {
+            dump_dot_label(t, w, slot);
+        }
+        dot_puts(w, t->pool[child_index].terminal ? ",fillcolor=lightgreen]\n" 
+                                                  : "]\n");
+    }
+
+    dot_puts(w, "\tNode_");
+    dot_index(w, index);
+    dot_puts(w, " -> Node_");
+    dot_index(w, child_index);
+    dot_puts(w, " [label=");
+    dump_dot_label(t, w, slot);
+    dot_puts(w, "]\n");
+}
+
+/* Makes room for `depth` frames in the traversal stack at `*stack`. */
+static bool frames_reserve(Frame **stack, size_t *cap, size_t depth)
+{
+    if (*cap >= depth) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap : INITIAL_POOL_CAP;
+
+    while (new_cap < depth) {
+        new_cap *= 2;
+    }
+
+    void *const tmp = realloc(*stack, sizeof **stack * new_cap);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    *stack = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+/* In a minimized trie, a node can be reached along several edges. `seen`
+ * marks the nodes that have been declared, and whose edges have been written,
+ * so that a shared subtree is written once, and every edge into it shows up
+ * once.
+ */
+static bool dump_dot_prefix(const struct trie *t, DotWriter *w, Index root_idx,
+                            unsigned char *seen)
+{
+    Frame *stack = NULL;
+    size_t cap = 0;
+    size_t depth = 0;
+    bool rv = frames_reserve(&stack, &cap, 1);
+
+    if (rv) {
+        stack[depth++] = (Frame) { 
+            root_idx, INVALID_OFFSET, 0, t->pool[root_idx].nchildren 
+        };
+    }
+
+    while (rv && depth) {
+        Frame *const f = stack + depth - 1;
+
+        if (f->left == 0) {
+            --depth;
+            continue;
+        }
+
+        f->slot = next_slot(t, t->pool + f->node, f->slot);
+        --f->left;
+
+        const Index child = t->targets[f->slot];
+
+        dump_dot_edge(t, w, f->node, f->slot, !seen[child]);
+
+        if (!seen[child]) {
+            seen[child] = 1;
+
+            if ((rv = frames_reserve(&stack, &cap, depth + 1))) {
+                stack[depth++] = (Frame) { 
+                    child, INVALID_OFFSET, 0, t->pool[child].nchildren 
+                };
+            }
+        }
+    }
+
+    free(stack);
+    return rv;
+}
+
+/* Writes every edge of `t` in pool order. Only a minimized trie has nodes
+ * with more than one parent, so only then is `seen` needed to declare every
+ * node once.
+ */
+static void dump_dot_whole(const struct trie *t, DotWriter *w, 
+                           unsigned char *seen)
+{
+    for (Index i = 0; i < t->count; ++i) {
+        Index slot = INVALID_OFFSET;
+
+        for (uint8_t j = 0; j < t->pool[i].nchildren; ++j) {
+            slot = next_slot(t, t->pool + i, slot);
+
+            const Index child = t->targets[slot];
+
+            dump_dot_edge(t, w, i, slot, seen == NULL || !seen[child]);
+
+            if (seen) {
+                seen[child] = 1;
+            }
+        }
+    }
+}
+
+/* Passes every key below `root_idx`, the path to which is the `len` bytes at
+ * `key`, to `emit`, until it asks to stop, in which case `*stopped` is set.
+ * Returns false on memory allocation failure.
+ */
+static bool print_suggestions(trie_cursor_t *cur, Index root_idx, 
+                              const char *key, size_t len, bool *stopped,
+                              trie_emit_fn *emit, void *ctx)
+{
+    const struct trie *const t = cur->trie;
+    const Node *const root = t->pool + root_idx;
+    size_t depth = 0;
+
+    if (!key_reserve(&cur->dfs_key, &cur->dfs_key_cap, len) 
+        || !frames_reserve(&cur->dfs_stack, &cur->dfs_stack_cap, 1)) {
+        return false;
+    }
+
+    memcpy(cur->dfs_key, key, len);
+
+    if (root->terminal && !emit(ctx, cur->dfs_key, len, root->weight)) {
+        *stopped = true;
+        return true;
+    }
+
+    cur->dfs_stack[depth++] = (Frame) { 
+        root_idx, INVALID_OFFSET, len, root->nchildren 
+    };
+
+    while (depth) {
+        Frame *const f = cur->dfs_stack + depth - 1;
+
+        if (f->left == 0) {
+            --depth;
+            continue;
+        }
+
+        f->slot = next_slot(t, t->pool + f->node, f->slot);
+        --f->left;
+
+        const Index child_idx = t->targets[f->slot];
+        const Node *const child = t->pool + child_idx;
+        const size_t key_len = f->key_len + 1 + (size_t) child->tail_len;
+
+        if (!key_reserve(&cur->dfs_key, &cur->dfs_key_cap, key_len)) {
+            return false;
+        }
+
+        cur->dfs_key[f->key_len] = CHAR_OF(t, t->labels[f->slot]);
+        memcpy(cur->dfs_key + f->key_len + 1, t->text + child->tail, 
+               (size_t) child->tail_len);
+
+        if (child->terminal 
+            && !emit(ctx, cur->dfs_key, key_len, child->weight)) {
+            *stopped = true;
+            return true;
+        }
+
+        if (child->nchildren) {
+            if (!frames_reserve(&cur->dfs_stack, &cur->dfs_stack_cap, depth + 1)) {
+                return false;
+            }
+
+            cur->dfs_stack[depth++] = (Frame) { 
+                child_idx, INVALID_OFFSET, key_len, child->nchildren 
+            };
+        }
+    }
+    return true;
+}
+
+/* Where a key stands with respect to the key a page of completions starts
+ * after: before it, and so is every key below it; a proper prefix of it; the
+ * same key; or after it, and so is every key below it.
+ */
+typedef enum { PAGE_BEFORE, PAGE_PREFIX, PAGE_SAME, PAGE_AFTER } PagePlace;
+
+/* Compares the `len` bytes at `key` with the `after_len` bytes at `after`,
+ * the first `from` of which the two are known to share.
+ */
+static PagePlace page_place(const char *key, size_t len, const char *after,
+                            size_t after_len, size_t from)
+{
+    const size_t n = len < after_len ? len : after_len;
+    const int c = n > from ? memcmp(key + from, after + from, n - from) : 0;
+
+    if (c) {
+        return c < 0 ? PAGE_BEFORE : PAGE_AFTER;
+    }
+    return len < after_len ? PAGE_PREFIX : len == after_len ? PAGE_SAME : PAGE_AFTER;
+}
+
+/* Passes the keys below the position of `cur` that come after `page->after`,
+ * less the first `page->offset` of them, to `emit`, in lexicographic order,
+ * until `page->limit` of them are passed or it asks to stop.
+ *
+ * The traversal is that of print_suggestions(), but it first descends along
+ * `after`, passing over every subtree that comes before it, and then over every
+ * subtree that `keys` says lies before the offset, so it starts emitting after
+ * visiting the children of at most two paths. Returns false on memory
+ * allocation failure.
+ */
+static bool print_page(trie_cursor_t *cur, const trie_page_t *page, 
+                       trie_emit_fn *emit, void *ctx)
+{
+    const struct trie *const t = cur->trie;
+    const Node *const root = t->pool + cur->node;
+    const char *const after = page->after;
+    const size_t after_len = after ? strlen(after) : 0;
+    PagePlace place = after 
+                    ? page_place(cur->path, cur->path_len, after, after_len, 0)
+                    : PAGE_AFTER;
+    bool seeking = place == PAGE_PREFIX;
+    size_t skip = page->offset;
+    size_t left = page->limit ? page->limit : SIZE_MAX;
+    size_t depth = 0;
+
+    if (place == PAGE_BEFORE || (place == PAGE_AFTER && skip >= root->keys)) {
+        return true;
+    }
+
+    if (!key_reserve(&cur->dfs_key, &cur->dfs_key_cap, cur->path_len) 
+        || !frames_reserve(&cur->dfs_stack, &cur->dfs_stack_cap, 1)) {
+        return false;
+    }
+
+    memcpy(cur->dfs_key, cur->path, cur->path_len);
+
+    if (place == PAGE_AFTER && root->terminal) {
+        if (skip) {
+            --skip;
+        } else if (!emit(ctx, cur->dfs_key, cur->path_len, root->weight) 
+                   || --left == 0) {
+            return true;
+        }
+    }
+
+    /* Every key below `after` itself comes after it. */
+    place = place == PAGE_SAME ? PAGE_AFTER : place;
+    cur->dfs_stack[depth++] = (Frame) { 
+        cur->node, INVALID_OFFSET, cur->path_len, root->nchildren 
+    };
+
+    while (depth) {
+        Frame *const f = cur->dfs_stack + depth - 1;
+
+        if (f->left == 0) {
+            --depth;
+            continue;
+        }
+
+        f->slot = next_slot(t, t->pool + f->node, f->slot);
+        --f->left;
+
+        const Index child_idx = t->targets[f->slot];
+        const Node *const child = t->pool + child_idx;
+        const size_t key_len = f->key_len + 1 + (size_t) child->tail_len;
+
+        if (!key_reserve(&cur->dfs_key, &cur->dfs_key_cap, key_len)) {
+            return false;
+        }
+
+        cur->dfs_key[f->key_len] = CHAR_OF(t, t->labels[f->slot]);
+        memcpy(cur->dfs_key + f->key_len + 1, t->text + child->tail, 
+               (size_t) child->tail_len);
+
+        /* Until the traversal is past `after`, only the subtree it lies in is
+         * descended into, without emitting the key on top of it.
+         */
+        if (seeking) {
+            place = page_place(cur->dfs_key, key_len, after, after_len, 
+                               f->key_len);
+
+            if (place == PAGE_BEFORE) {
+                continue;
+            }
+            seeking = place == PAGE_PREFIX;
+        }
+
+        if (place == PAGE_AFTER) {
+            if (skip >= child->keys) {
+                skip -= child->keys;
+                continue;
+            }
+
+            if (child->terminal && skip) {
+                --skip;
+            } else if (child->terminal
+                       && (!emit(ctx, cur->dfs_key, key_len, child->weight)
+                           || --left == 0)) {
+                return true;
+            }
+        } else if (place == PAGE_SAME) {
+            place = PAGE_AFTER;
+        }
+
+        if (child->nchildren) {
+            if (!frames_reserve(&cur->dfs_stack, &cur->dfs_stack_cap, depth + 1)) {
+                return false;
+            }
+
+            cur->dfs_stack[depth++] = (Frame) { 
+                child_idx, INVALID_OFFSET, key_len, child->nchildren 
+            };
+        }
+    }
+    return true;
+}
+
+/* The state of trie_complete_buffer(). */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t nkeys;
+} PageBuffer;
+
+static bool buffer_key(void *ctx, const char *key, size_t len, uint32_t weight)
+{
+    PageBuffer *const b = ctx;
+
+    (void) weight;
+
+    if (b->size - b->len <= len) {
+        /* Tell the caller how much room the first key takes, if it is that. */
+        b->len = b->nkeys ? b->len : len + 1;
+        return false;
+    }
+
+    memcpy(b->buf + b->len, key, len);
+    b->buf[b->len + len] = '\n';
+    b->len += len + 1;
+    ++b->nkeys;
+    return true;
+}
+
+/* A top-K search is a best-first search over a heap of candidates, ordered
+ * by score, then by key. A candidate is either a subtree, scored by its
+ * `max_weight`, or a key to be emitted, scored by its weight. A subtree is only
+ * expanded once it is the best candidate left, and the search ends after K keys
+ * are emitted, so subtrees whose best key can not beat the K-th result are
+ * never visited. The work done is proportional to K and to the fan-out along
+ * the way, not to the size of the subtree below the prefix.
+ */
+static bool candidate_before(const trie_cursor_t *cur, const Candidate *a,
+                             const Candidate *b)
+{
+    if (a->score != b->score) {
+        return a->score > b->score;
+    }
+
+    const size_t len = a->key_len < b->key_len ? a->key_len : b->key_len;
+    const int cmp = memcmp(cur->top_keys + a->key, cur->top_keys + b->key, len);
+
+    if (cmp || a->key_len != b->key_len) {
+        return cmp ? cmp < 0 : a->key_len < b->key_len;
+    }
+
+    /* A key comes before the subtree rooted at its node. */
+    return a->node == INVALID_OFFSET && b->node != INVALID_OFFSET;
+}
+
+static bool heap_push(trie_cursor_t *cur, Candidate c)
+{
+    if (cur->top_heap_len >= cur->top_heap_cap) {
+        const size_t cap = cur->top_heap_cap ? cur->top_heap_cap * 2 : INITIAL_POOL_CAP;
+        void *const tmp = realloc(cur->top_heap, sizeof *cur->top_heap * cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+        cur->top_heap = tmp;
+        cur->top_heap_cap = cap;
+    }
+
+    Candidate *const heap = cur->top_heap;
+    size_t i = cur->top_heap_len++;
+
+    for (; i > 0 && candidate_before(cur, &c, heap + (i - 1) / 2); i = (i - 1) / 2) {
+        heap[i] = heap[(i - 1) / 2];
+    }
+
+    heap[i] = c;
+    return true;
+}
+
+static Candidate heap_pop(trie_cursor_t *cur)
+{
+    Candidate *const heap = cur->top_heap;
+    const Candidate top = heap[0];
+    const Candidate last = heap[--cur->top_heap_len];
+    const size_t len = cur->top_heap_len;
+    size_t i = 0;
+
+    for (;;) {
+        size_t best = 2 * i + 1;
+
+        if (best >= len) {
+            break;
+        }
+
+        if (best + 1 < len && candidate_before(cur, heap + best + 1, heap + best)) {
+            ++best;
+        }
+
+        if (!candidate_before(cur, heap + best, &last)) {
+            break;
+        }
+
+        heap[i] = heap[best];
+        i = best;
+    }
+
+    if (len) {
+        heap[i] = last;
+    }
+    return top;
+}
+
+/* Makes room for `len` more bytes in `cur->top_keys`. */
+static bool top_keys_reserve(trie_cursor_t *cur, size_t len)
+{
+    if (cur->top_keys && cur->top_keys_cap - cur->top_keys_len >= len) {
+        return true;
+    }
+
+    size_t cap = cur->top_keys_cap ? cur->top_keys_cap : TEXT_POOL_STEP;
+
+    while (cap - cur->top_keys_len < len) {
+        cap *= 2;
+    }
+
+    void *const tmp = realloc(cur->top_keys, cap);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    cur->top_keys = tmp;
+    cur->top_keys_cap = cap;
+    return true;
+}
+
+/* Pushes a candidate for the subtree at `node_idx`, the path to which is the
+ * `len` bytes at `key`.
+ */
+static bool top_push_subtree(trie_cursor_t *cur, Index node_idx, 
+                             const char *key, size_t len)
+{
+    if (!top_keys_reserve(cur, len)) {
+        return false;
+    }
+
+    const Candidate c = { 
+        cur->trie->pool[node_idx].max_weight, node_idx, cur->top_keys_len, len,
+        NO_ROW
+    };
+
+    memcpy(cur->top_keys + c.key, key, len);
+    cur->top_keys_len += len;
+    return heap_push(cur, c);
+}
+
+/* A fuzzy search carries the row of the Levenshtein matrix between the query
+ * and the path to the current node, one row per byte of the path. A branch is
+ * pruned as soon as every entry of its row exceeds the edit budget, for no
+ * extension of the path can get closer to the query. As soon as the last
+ * entry is within the budget, the path matches a prefix of the query closely
+ * enough, so every key below it is a completion, and the subtree is handed
+ * over whole, to the top-K search or to an enumeration, instead of being
+ * walked any further.
+ *
+ * An enumeration walks the trie depth-first, in lexicographic order, keeping
+ * the row of every byte of the path. A top-K search is best-first, like an
+ * exact one: the heap holds the paths that may still match along with the row
+ * of their last byte, ranked by the highest weight below them, so it stops as
+ * soon as it has found `k` keys rather than after it has found every path
+ * within the budget.
+ *
+ * Entries never exceed the length of the path plus that of the query, and a
+ * branch is cut before the path gets longer than the query plus the budget,
+ * so 16 bits and `len + max_edits + 1` rows per path are enough.
+ */
+typedef struct {
+    const char *query;
+    size_t len;
+    size_t max_edits;
+    bool in_query[UCHAR_MAX + 1];   /* The labels of the bytes `query` holds. */
+} FuzzyQuery;
+
+static bool fuzzy_rows_reserve(trie_cursor_t *cur, size_t n)
+{
+    if (cur->fuzzy_rows_cap - cur->fuzzy_rows_len >= n) {
+        return true;
+    }
+
+    size_t cap = cur->fuzzy_rows_cap ? cur->fuzzy_rows_cap : INITIAL_POOL_CAP;
+
+    while (cap - cur->fuzzy_rows_len < n) {
+        cap *= 2;
+    }
+
+    void *const tmp = realloc(cur->fuzzy_rows, sizeof *cur->fuzzy_rows * cap);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    cur->fuzzy_rows = tmp;
+    cur->fuzzy_rows_cap = cap;
+    return true;
+}
+
+/* Fills `row`, that of the path extended by `ch`, from `prev`, that of the
+ * path. Returns the smallest entry.
+ */
+static uint16_t fuzzy_step(const FuzzyQuery *fz, const uint16_t *prev,
+                           uint16_t *row, char ch)
+{
+    uint16_t min = row[0] = (uint16_t) (prev[0] + 1);
+
+    for (size_t j = 1; j <= fz->len; ++j) {
+        uint16_t d = (uint16_t) (prev[j - 1] + (fz->query[j - 1] != ch));
+
+        if (prev[j] + 1 < d) {
+            d = (uint16_t) (prev[j] + 1);
+        }
+
+        if (row[j - 1] + 1 < d) {
+            d = (uint16_t) (row[j - 1] + 1);
+        }
+
+        row[j] = d;
+        min = d < min ? d : min;
+    }
+    return min;
+}
+
+/* Steps the row at offset `from` of `cur->fuzzy_rows` through the edge in
+ * `slot`. Returns NO_ROW if the path matches somewhere along the edge,
+ * PRUNED_ROW if it can no longer match, and FAILED_ROW on memory allocation
+ * failure. Otherwise, appends the row of the end of the edge to
+ * `cur->fuzzy_rows`, and returns its offset.
+ */
+#define PRUNED_ROW (SIZE_MAX - 1)
+#define FAILED_ROW (SIZE_MAX - 2)
+
+static size_t fuzzy_edge(trie_cursor_t *cur, const FuzzyQuery *fz, 
+                         size_t from, Index slot)
+{
+    const struct trie *const t = cur->trie;
+    const Node *const child = t->pool + t->targets[slot];
+    const size_t width = fz->len + 1;
+
+    if (!fuzzy_rows_reserve(cur, 2 * width)) {
+        return FAILED_ROW;
+    }
+
+    uint16_t *const end = cur->fuzzy_rows + cur->fuzzy_rows_len;
+    const uint16_t *prev = cur->fuzzy_rows + from;
+
+    for (Index i = 0; i <= child->tail_len; ++i) {
+        /* Alternate between two rows past the end. */
+        uint16_t *const row = end + (i % 2) * width;
+        const char ch = i == 0 ? CHAR_OF(t, t->labels[slot])
+                               : t->text[child->tail + i - 1];
+        const uint16_t min = fuzzy_step(fz, prev, row, ch);
+
+        if (row[fz->len] <= fz->max_edits) {
+            return NO_ROW;
+        }
+
+        if (min > fz->max_edits) {
+            return PRUNED_ROW;
+        }
+        prev = row;
+    }
+
+    if (prev != end) {
+        memcpy(end, prev, sizeof *end * width);
+    }
+
+    cur->fuzzy_rows_len += width;
+    return (size_t) (end - cur->fuzzy_rows);
+}
+
+/* Passes the `k` keys of highest weight below the subtrees on the heap to
+ * `emit`, in decreasing order of weight. If `fz` is not NULL, subtrees with a
+ * row are those of a fuzzy search; see fuzzy_search().
+ */
+static bool top_search(trie_cursor_t *cur, size_t k, const FuzzyQuery *fz, 
+                       trie_emit_fn *emit, void *ctx)
+{
+    const struct trie *const t = cur->trie;
+
+    for (size_t count = 0; count < k && cur->top_heap_len > 0; ) {
+        const Candidate c = heap_pop(cur);
+
+        if (c.node == INVALID_OFFSET) {
+            if (!emit(ctx, cur->top_keys + c.key, c.key_len, c.score)) {
+                break;
+            }
+            ++count;
+            continue;
+        }
+
+        const Node *const node = t->pool + c.node;
+
+        /* The key of a path that has not matched yet is no completion. */
+        if (node->terminal && c.row == NO_ROW
+            && !heap_push(cur, (Candidate) { node->weight, INVALID_OFFSET,
+                                             c.key, c.key_len, NO_ROW })) {
+            return false;
+        }
+
+        /* A path that has used up its budget can only be extended by a byte
+         * of the query: any other byte costs one more edit.
+         */
+        bool spent = c.row != NO_ROW;
+
+        for (size_t j = 0; spent && j <= fz->len; ++j) {
+            spent = cur->fuzzy_rows[c.row + j] >= fz->max_edits;
+        }
+
+        Index slot = INVALID_OFFSET;
+
+        for (uint8_t i = 0; i < node->nchildren; ++i) {
+            slot = next_slot(t, node, slot);
+
+            if (spent && !fz->in_query[t->labels[slot]]) {
+                continue;
+            }
+
+            const size_t row = c.row == NO_ROW ? NO_ROW 
+                                               : fuzzy_edge(cur, fz, c.row, slot);
+
+            if (row == PRUNED_ROW) {
+                continue;
+            }
+
+            if (row == FAILED_ROW) {
+                return false;
+            }
+
+            const Index child_idx = t->targets[slot];
+            const Node *child = t->pool + child_idx;
+            const size_t tail_len = (size_t) child->tail_len;
+            Candidate cc = {
+                child->max_weight, child_idx, cur->top_keys_len,
+                c.key_len + 1 + tail_len, row
+            };
+
+            if (!top_keys_reserve(cur, cc.key_len)) {
+                return false;
+            }
+
+            char *const dst = cur->top_keys + cc.key;
+
+            memcpy(dst, cur->top_keys + c.key, c.key_len);
+            dst[c.key_len] = CHAR_OF(t, t->labels[slot]);
+            memcpy(dst + c.key_len + 1, t->text + child->tail, tail_len);
+            cur->top_keys_len += cc.key_len;
+
+            /* Every key below a chain of nodes with one child and no key of
+             * their own goes through the whole chain, so the chain is
+             * appended to this key rather than pushed a node at a time, each
+             * with a copy of the key so far: in a plain trie, that took memory
+             * quadratic in the length of a long key. The key is the last one
+             * in the buffer, and grows in place.
+             */
+            while (row == NO_ROW && !child->terminal && child->nchildren == 1) {
+                const Index next = next_slot(t, child, INVALID_OFFSET);
+                const Node *const next_child = t->pool + t->targets[next];
+                const size_t next_len = (size_t) next_child->tail_len;
+
+                if (!top_keys_reserve(cur, 1 + next_len)) {
+                    return false;
+                }
+
+                cur->top_keys[cur->top_keys_len] = CHAR_OF(t, t->labels[next]);
+                memcpy(cur->top_keys + cur->top_keys_len + 1, 
+                       t->text + next_child->tail, next_len);
+                cur->top_keys_len += 1 + next_len;
+                cc.key_len += 1 + next_len;
+                cc.node = t->targets[next];
+                child = next_child;
+            }
+
+            if (!heap_push(cur, cc)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Passes the `k` keys of highest weight below `root_idx` to `emit`, in
+ * decreasing order of weight. `cur->path` must hold the path to the node.
+ */
+static bool print_top_suggestions(trie_cursor_t *cur, Index root_idx, size_t k,
+                                  trie_emit_fn *emit, void *ctx)
+{
+    cur->top_heap_len = 0;
+    cur->top_keys_len = 0;
+
+    return top_push_subtree(cur, root_idx, cur->path, cur->path_len)
+        && top_search(cur, k, NULL, emit, ctx);
+}
+
+/* Passes every key below the paths within the budget of `fz` to `emit`, in
+ * lexicographic order; see the comment above FuzzyQuery.
+ */
+static bool fuzzy_enumerate(trie_cursor_t *cur, const FuzzyQuery *fz, 
+                            trie_emit_fn *emit, void *ctx)
+{
+    const struct trie *const t = cur->trie;
+    const size_t width = fz->len + 1;
+    size_t depth = 0;
+    bool stopped = false;
+
+    cur->fuzzy_rows_len = 0;
+
+    if (!fuzzy_rows_reserve(cur, width * (fz->len + fz->max_edits + 2))
+        || !key_reserve(&cur->fuzzy_key, &cur->fuzzy_key_cap, 1)
+        || !frames_reserve(&cur->fuzzy_stack, &cur->fuzzy_stack_cap, 1)) {
+        return false;
+    }
+
+    for (size_t j = 0; j < width; ++j) {
+        cur->fuzzy_rows[j] = (uint16_t) j;
+    }
+
+    cur->fuzzy_stack[depth++] = (Frame) { 
+        t->root, INVALID_OFFSET, 0, t->pool[t->root].nchildren 
+    };
+
+    while (depth && !stopped) {
+        Frame *const f = cur->fuzzy_stack + depth - 1;
+
+        if (f->left == 0) {
+            --depth;
+            continue;
+        }
+
+        f->slot = next_slot(t, t->pool + f->node, f->slot);
+        --f->left;
+
+        const Index child_idx = t->targets[f->slot];
+        const Node *const child = t->pool + child_idx;
+        const size_t edge_len = 1 + (size_t) child->tail_len;
+        const size_t key_len = f->key_len + edge_len;
+
+        if (!key_reserve(&cur->fuzzy_key, &cur->fuzzy_key_cap, key_len)) {
+            return false;
+        }
+
+        cur->fuzzy_key[f->key_len] = CHAR_OF(t, t->labels[f->slot]);
+        memcpy(cur->fuzzy_key + f->key_len + 1, t->text + child->tail, 
+               (size_t) child->tail_len);
+
+        /* Step through the edge one byte at a time, until the path either
+         * matches or can not match any more.
+         */
+        bool pruned = false;
+        bool matched = false;
+
+        for (size_t i = 0; i < edge_len && !pruned && !matched; ++i) {
+            const size_t d = f->key_len + i + 1;
+            uint16_t *const row = cur->fuzzy_rows + width * d;
+            const uint16_t min = fuzzy_step(fz, row - width, row, 
+                                            cur->fuzzy_key[d - 1]);
+
+            matched = row[fz->len] <= fz->max_edits;
+            pruned = min > fz->max_edits;
+        }
+
+        if (matched) {
+            if (!print_suggestions(cur, child_idx, cur->fuzzy_key, key_len, 
+                                   &stopped, emit, ctx)) {
+                return false;
+            }
+        } else if (!pruned && child->nchildren) {
+            if (!frames_reserve(&cur->fuzzy_stack, &cur->fuzzy_stack_cap, 
+                                depth + 1)) {
+                return false;
+            }
+
+            cur->fuzzy_stack[depth++] = (Frame) { 
+                child_idx, INVALID_OFFSET, key_len, child->nchildren 
+            };
+        }
+    }
+    return true;
+}
+
+static bool fuzzy_search(trie_cursor_t *cur, const char *query, 
+                         size_t max_edits, size_t k, trie_emit_fn *emit, 
+                         void *ctx)
+{
+    const struct trie *const t = cur->trie;
+    const size_t len = strlen(query);
+    /* Any path is within `len` edits of the query. */
+    FuzzyQuery fz = { query, len, max_edits < len ? max_edits : len, { 0 } };
+    bool stopped = false;
+
+    for (size_t j = 0; j < len; ++j) {
+        fz.in_query[LABEL_OF(t, query[j])] = true;
+    }
+
+    if (len <= max_edits) {
+        cur->top_heap_len = 0;
+        cur->top_keys_len = 0;
+
+        return k ? top_push_subtree(cur, t->root, "", 0) 
+                   && top_search(cur, k, NULL, emit, ctx)
+                 : print_suggestions(cur, t->root, "", 0, &stopped, emit, ctx);
+    }
+
+    if (k == 0) {
+        return fuzzy_enumerate(cur, &fz, emit, ctx);
+    }
+
+    cur->top_heap_len = 0;
+    cur->top_keys_len = 0;
+    cur->fuzzy_rows_len = 0;
+
+    if (!fuzzy_rows_reserve(cur, len + 1)) {
+        return false;
+    }
+
+    for (size_t j = 0; j <= len; ++j) {
+        cur->fuzzy_rows[j] = (uint16_t) j;
+    }
+
+    cur->fuzzy_rows_len = len + 1;
+    return heap_push(cur, (Candidate) { 
+            t->pool[t->root].max_weight, t->root, 0, 0, 0 
+        })
+        && top_search(cur, k, &fz, emit, ctx);
+}
+
+/* Splits an optional weight column, separated from the key by a tab, off
+ * `line`. A line without one has a weight of 1.
+ */
+static uint32_t split_weight(char *line)
+{
+    char *const tab = strrchr(line, '\t');
+
+    if (tab == NULL || tab[1] < '0' || tab[1] > '9') {
+        return 1;
+    }
+
+    char *end = NULL;
+
+    errno = 0;
+    const unsigned long w = strtoul(tab + 1, &end, 10);
+
+    if (*end != '\0' && *end != '\r') {
+        return 1;
+    }
+
+    *tab = '\0';
+    return errno || w > UINT32_MAX ? UINT32_MAX : (uint32_t) w;
+}
+
+uint32_t trie_split_weight(char *line)
+{
+    return split_weight(line);
+}
+
+static inline bool insert_line(struct trie *t, Index root_idx, char *line)
+{
+    const uint32_t weight = split_weight(line);
+
+    return insert_text(t, root_idx, line, weight);
+}
+
+/* Applies a line of a delta: `-key` removes the key, `+key` inserts it, and
+ * any other line is inserted whole, so that lines appended to a word list make
+ * a delta as they are. Either may end with a weight.
+ */
+static bool apply_line(struct trie *t, Index root_idx, char *line, bool delta)
+{
+    if (delta && *line == '-') {
+        /* The weight of a key does not matter to its removal. */
+        split_weight(line + 1);
+        return remove_text(t, line + 1);
+    }
+    return insert_line(t, root_idx, line + (delta && *line == '+'));
+}
+
+/* The lines of a delta being recorded; see trie_record_delta(). */
+typedef struct {
+    struct trie *adds;
+    struct trie *dels;
+} DeltaRecorder;
+
+static bool record_next_line(void *ctx, char *line)
+{
+    const DeltaRecorder *const r = ctx;
+
+    if (*line == '-') {
+        split_weight(line + 1);
+        return remove_text(r->adds, line + 1)
+            && insert_text(r->dels, r->dels->root, line + 1, 1);
+    }
+    return insert_line(r->adds, r->adds->root, line + (*line == '+'));
+}
+
+static bool populate_trie(struct trie *t, Index root_idx, char **lines, 
+                          size_t num_lines)
+{
+    for (size_t i = 0; i < num_lines; ++i) {
+        if (!insert_line(t, root_idx, lines[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Appends `n` bytes of `s` to the nul-terminated line in `*carry`. */
+static bool carry_append(char **carry, size_t *len, size_t *cap, const char *s,
+                         size_t n)
+{
+    if (*carry == NULL || *cap - *len <= n) {
+        size_t new_cap = *cap ? *cap : IO_CHUNK_SIZE;
+
+        while (new_cap - *len <= n) {
+            new_cap *= 2;
+        }
+
+        void *const tmp = realloc(*carry, new_cap);
+
+        if (tmp == NULL) {
+            perror("realloc()");
+            return false;
+        }
+
+        *carry = tmp;
+        *cap = new_cap;
+    }
+
+    memcpy(*carry + *len, s, n);
+    *len += n;
+    (*carry)[*len] = '\0';
+    return true;
+}
+
+/* Receives a line of a stream, terminated in place; see read_lines(). */
+typedef bool LineFn(void *ctx, char *line);
+
+/* Passes the lines of `stream` to `fn` as they are read, one chunk at a time.
+ * Lines are terminated in place in the chunk, and only a line that straddles
+ * two chunks is copied, to `carry`, so the memory needed on top of what `fn`
+ * keeps is one chunk and the longest line. Lines are split as
+ * io_split_lines_valid() splits them: an empty line is the empty key, a last
+ * line without a newline counts, and a line holding a nul byte, which would
+ * cut its key short, is skipped.
+ */
+static bool read_lines(FILE *stream, LineFn *fn, void *ctx, size_t *nlines,
+                       size_t *nskipped)
+{
+    char *const chunk = malloc(IO_CHUNK_SIZE);
+    char *carry = NULL;
+    size_t carry_len = 0;
+    size_t carry_cap = 0;
+    bool carry_ok = true;
+    size_t count = 0;
+    size_t skipped = 0;
+    bool rv = chunk != NULL;
+
+    if (!rv) {
+        perror("malloc()");
+    }
+
+    for (size_t n = 0; rv && (n = io_read_next_chunk(stream, chunk)) > 0; ) {
+        char *p = chunk;
+        char *const end = chunk + n;
+
+        while (rv && p < end) {
+            bool valid = true;
+            const size_t len = io_find_line(p, (size_t) (end - p), &valid);
+
+            if (p + len == end) {
+                rv = carry_append(&carry, &carry_len, &carry_cap, p, len);
+                carry_ok = carry_ok && valid;
+                break;
+            }
+
+            p[len] = '\0';
+
+            if (carry_len) {
+                valid = valid && carry_ok;
+                rv = carry_append(&carry, &carry_len, &carry_cap, p, len)
+                    && (!valid || fn(ctx, carry));
+                carry_len = 0;
+                carry_ok = true;
+            } else {
+                rv = !valid || fn(ctx, p);
+            }
+
+            valid ? ++count : ++skipped;
+            p += len + 1;
+        }
+    }
+
+    if (rv && ferror(stream)) {
+        perror("fread()");
+        rv = false;
+    }
+
+    if (rv && carry_len) {
+        rv = !carry_ok || fn(ctx, carry);
+        carry_ok ? ++count : ++skipped;
+    }
+
+    if (nlines) {
+        *nlines = count;
+    }
+
+    if (nskipped) {
+        *nskipped = skipped;
+    }
+
+    free(carry);
+    free(chunk);
+    return rv;
+}
+
+typedef struct {
+    struct trie *t;
+    Index root_idx;
+    bool delta;
+} LineApplier;
+
+static bool apply_next_line(void *ctx, char *line)
+{
+    const LineApplier *const a = ctx;
+
+    return apply_line(a->t, a->root_idx, line, a->delta);
+}
+
+/* Inserts the lines of `stream` as they are read, or applies them as a delta. */
+static bool populate_trie_stream(struct trie *t, Index root_idx, FILE *stream,
+                                 bool delta, size_t *nlines, size_t *nskipped)
+{
+    LineApplier a = { t, root_idx, delta };
+
+    return read_lines(stream, apply_next_line, &a, nlines, nskipped);
+}
+
+/* A parallel build partitions the lines by their first byte into contiguous
+ * ranges of bytes holding about as many lines each, and has every thread
+ * build a trie of its own out of one partition. The tries share no nodes, so
+ * the threads need no synchronization. The subtries are then stitched together
+ * by copying their pools one after the other and relocating the indices, and
+ * the children of their roots become the children of the final root. The
+ * result holds exactly the same keys, weights and edges as a serial build;
+ * only the numbering of the nodes differs.
+ */
+typedef struct {
+    struct trie trie;
+    char **lines;
+    size_t nlines;
+    bool ok;
+} BuildJob;
+
+static void *run_build_job(void *arg)
+{
+    BuildJob *const job = arg;
+
+    job->ok = init_pool(&job->trie)
+        && alloc_node(&job->trie) != INVALID_OFFSET
+        && populate_trie(&job->trie, 0, job->lines, job->nlines);
+    return NULL;
+}
+
+/* Appends the pools of `src`, but for its root, to `t` and hangs the children
+ * of its root below the root of `t`.
+ */
+static bool stitch_trie(struct trie *t, const struct trie *src)
+{
+    const Index node_base = t->count - 1;
+    const Index edge_base = t->edge_count;
+    const Index text_base = t->text_len;
+
+    if (INDEX_MAX - t->count < src->count
+        || INDEX_MAX - t->edge_count < src->edge_count
+        || INDEX_MAX - t->text_len < src->text_len) {
+        fputs("Error: too many nodes. Consider recompiling the program "
+            "with 64-bit indices (make index64).\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    for (Index i = 1; i < src->count; ++i) {
+        Node node = src->pool[i];
+
+        if (node.edges != INVALID_OFFSET) {
+            node.edges += edge_base;
+        }
+
+        node.tail += text_base;
+        t->pool[node_base + i] = node;
+    }
+
+    memcpy(t->labels + edge_base, src->labels, (size_t) src->edge_count);
+
+    for (Index i = 0; i < src->edge_count; ++i) {
+        t->targets[edge_base + i] = node_base + src->targets[i];
+    }
+
+    /* The first slot of a free block links to the next one rather than to a
+     * node, and the block of the root of `src` is no longer used.
+     */
+    for (uint8_t cls = 0; cls < BLOCK_CLASS_COUNT; ++cls) {
+        for (Index b = src->free_blocks[cls]; b != INVALID_OFFSET; 
+             b = src->targets[b]) {
+            free_block(t, edge_base + b, cls);
+        }
+    }
+
+    const Node *const src_root = src->pool;
+
+    if (src_root->edges != INVALID_OFFSET) {
+        free_block(t, edge_base + src_root->edges, src_root->block_class);
+    }
+
+    memcpy(t->text + text_base, src->text, (size_t) src->text_len);
+    t->count += src->count - 1;
+    t->edge_count += src->edge_count;
+    t->text_len += src->text_len;
+    t->keys += src->keys;
+
+    Node *const root = t->pool;
+
+    if (src_root->terminal) {
+        root->terminal = true;
+        root->weight = UINT32_MAX - root->weight < src_root->weight 
+                     ? UINT32_MAX 
+                     : root->weight + src_root->weight;
+    }
+
+    root->keys += src_root->keys;
+
+    if (root->max_weight < src_root->max_weight) {
+        root->max_weight = src_root->max_weight;
+    }
+
+    if (root->max_weight < root->weight) {
+        root->max_weight = root->weight;
+    }
+
+    for (uint8_t i = 0; i < src_root->nchildren; ++i) {
+        const Index slot = src_root->edges + i;
+
+        if (!add_child(t, 0, src->labels[slot], node_base + src->targets[slot])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool populate_trie_parallel(struct trie *t, char **lines, size_t nlines,
+                                   size_t njobs)
+{
+    size_t histogram[UCHAR_MAX + 1] = { 0 };
+
+    for (size_t i = 0; i < nlines; ++i) {
+        ++histogram[(unsigned char) lines[i][0]];
+    }
+
+    /* Assign contiguous ranges of first bytes to jobs. */
+    unsigned char job_of[UCHAR_MAX + 1];
+    size_t job_lines[UCHAR_MAX + 1] = { 0 };
+    size_t job = 0;
+    size_t seen = 0;
+
+    if (njobs > UCHAR_MAX + 1) {
+        njobs = UCHAR_MAX + 1;
+    }
+
+    for (size_t b = 0; b <= UCHAR_MAX; ++b) {
+        if (seen >= nlines / njobs * (job + 1) && job_lines[job] && job + 1 < njobs) {
+            ++job;
+        }
+
+        job_of[b] = (unsigned char) job;
+        job_lines[job] += histogram[b];
+        seen += histogram[b];
+    }
+
+    njobs = job + 1;
+
+    char **const sorted = malloc(sizeof *sorted * (nlines ? nlines : 1));
+    BuildJob *const jobs = calloc(njobs, sizeof *jobs);
+    pthread_t *const threads = malloc(sizeof *threads * njobs);
+    bool *const started = calloc(njobs, sizeof *started);
+    bool rv = sorted && jobs && threads && started;
+
+    if (!rv) {
+        perror("malloc()");
+        goto cleanup;
+    }
+
+    for (size_t j = 0, offset = 0; j < njobs; offset += job_lines[j++]) {
+        jobs[j].lines = sorted + offset;
+        jobs[j].trie.radix = t->radix;
+        jobs[j].trie.huge_pages = t->huge_pages;
+    }
+
+    for (size_t i = 0; i < nlines; ++i) {
+        BuildJob *const jb = jobs + job_of[(unsigned char) lines[i][0]];
+
+        jb->lines[jb->nlines++] = lines[i];
+    }
+
+    for (size_t j = 0; j < njobs; ++j) {
+        started[j] = pthread_create(threads + j, NULL, run_build_job, jobs + j) == 0;
+
+        if (!started[j]) {
+            run_build_job(jobs + j);
+        }
+    }
+
+    for (size_t j = 0; j < njobs; ++j) {
+        if (started[j]) {
+            pthread_join(threads[j], NULL);
+        }
+        rv = rv && jobs[j].ok;
+    }
+
+    if (!rv) {
+        goto cleanup;
+    }
+
+    /* Size the pools of `t` for all the subtries at once. */
+    size_t node_total = 1;
+    size_t edge_total = 0;
+    size_t text_total = 0;
+
+    for (size_t j = 0; j < njobs; ++j) {
+        node_total += (size_t) jobs[j].trie.count - 1;
+        edge_total += (size_t) jobs[j].trie.edge_count;
+        text_total += (size_t) jobs[j].trie.text_len;
+        t->grows += jobs[j].trie.grows;
+    }
+
+    if (node_total > INDEX_MAX || edge_total > INDEX_MAX - INITIAL_POOL_CAP
+        || text_total > INDEX_MAX) {
+        fputs("Error: too many nodes. Consider recompiling the program "
+            "with 64-bit indices (make index64).\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Leave some room for the block of the root. */
+    edge_total += INITIAL_POOL_CAP;
+
+    void *const pool = realloc(t->pool, sizeof *t->pool * node_total);
+    void *const labels = pool ? realloc(t->labels, edge_total) : NULL;
+    void *const targets = labels ? realloc(t->targets, sizeof *t->targets * edge_total) : NULL;
+    void *const text = targets ? realloc(t->text, text_total ? text_total : 1) : NULL;
+
+    t->pool = pool ? pool : t->pool;
+    t->labels = labels ? labels : t->labels;
+    t->targets = targets ? targets : t->targets;
+    t->text = text ? text : t->text;
+
+    if (text == NULL) {
+        perror("realloc()");
+        rv = false;
+        goto cleanup;
+    }
+
+    t->capacity = (Index) node_total;
+    t->edge_capacity = (Index) edge_total;
+    t->text_capacity = (Index) (text_total ? text_total : 1);
+    advise_huge_pages(t, t->pool, sizeof *t->pool * node_total);
+    advise_huge_pages(t, t->targets, sizeof *t->targets * edge_total);
+
+    for (size_t j = 0; rv && j < njobs; ++j) {
+        rv = stitch_trie(t, &jobs[j].trie);
+    }
+
+  cleanup:
+    if (jobs) {
+        for (size_t j = 0; j < njobs; ++j) {
+            free_pool(&jobs[j].trie);
+        }
+    }
+
+    free(started);
+    free(threads);
+    free(jobs);
+    free(sorted);
+    return rv;
+}
+
+static void shrink_pools(struct trie *t)
+{
+    /* A failure to shrink leaves a pool as it was, which is fine. */
+    const size_t nodes = (size_t) (t->count ? t->count : 1);
+    const size_t edges = (size_t) (t->edge_count ? t->edge_count : 1);
+    const size_t text = (size_t) (t->text_len ? t->text_len : 1);
+    void *tmp = NULL;
+
+    if ((tmp = realloc(t->pool, sizeof *t->pool * nodes))) {
+        t->pool = tmp;
+        t->capacity = (Index) nodes;
+    }
+
+    /* If only `labels` shrinks, `targets` is merely larger than it needs to
+     * be.
+     */
+    if ((tmp = realloc(t->labels, sizeof *t->labels * edges))) {
+        t->labels = tmp;
+        t->edge_capacity = (Index) edges;
+
+        if ((tmp = realloc(t->targets, sizeof *t->targets * edges))) {
+            t->targets = tmp;
+        }
+    }
+
+    if ((tmp = realloc(t->text, text))) {
+        t->text = tmp;
+        t->text_capacity = (Index) text;
+    }
+}
+
+/* Minimization turns the trie into the minimal acyclic automaton (DAWG) that
+ * accepts the same keys with the same weights, by merging equivalent
+ * subtrees: two nodes are equivalent if they agree on being terminal, on
+ * their weights and the text of the edge into them, and if their children
+ * are equivalent, label for label. Word lists share so many suffixes that
+ * most nodes merge away.
+ *
+ * The nodes are visited in post-order, so that every child is interned before
+ * its parent. A node is interned by appending a copy of it, with its children
+ * renumbered, to fresh pools, and looking the copy up in a hash table of the
+ * nodes appended so far. If an equivalent node is there, the copy is dropped
+ * again. Nothing in the lookup paths changes, for they never assumed that a
+ * node has a single parent; only insertion did, so a minimized trie is
+ * read-only.
+ */
+static inline uint64_t hash_mix(uint64_t h, uint64_t x)
+{
+    return (h ^ x) * UINT64_C(0x100000001b3);
+}
+
+static uint64_t hash_node(const struct trie *t, Index idx)
+{
+    const Node *const node = t->pool + idx;
+    uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+    h = hash_mix(h, node->terminal);
+    h = hash_mix(h, node->weight);
+    h = hash_mix(h, node->max_weight);
+    h = hash_mix(h, node->nchildren);
+    h = hash_mix(h, node->tail_len);
+
+    for (Index i = 0; i < node->tail_len; ++i) {
+        h = hash_mix(h, (unsigned char) t->text[node->tail + i]);
+    }
+
+    for (uint8_t i = 0; i < node->nchildren; ++i) {
+        h = hash_mix(h, t->labels[node->edges + i]);
+        h = hash_mix(h, t->targets[node->edges + i]);
+    }
+    return h;
+}
+
+static bool nodes_equal(const struct trie *t, Index a_idx, Index b_idx)
+{
+    const Node *const a = t->pool + a_idx;
+    const Node *const b = t->pool + b_idx;
+
+    return a->terminal == b->terminal 
+        && a->weight == b->weight
+        && a->max_weight == b->max_weight
+        && a->nchildren == b->nchildren
+        && a->tail_len == b->tail_len
+        && memcmp(t->text + a->tail, t->text + b->tail, (size_t) a->tail_len) == 0
+        && (a->nchildren == 0
+            || (memcmp(t->labels + a->edges, t->labels + b->edges, a->nchildren) == 0
+                && memcmp(t->targets + a->edges, t->targets + b->edges,
+                          sizeof *t->targets * a->nchildren) == 0));
+}
+
+/* Looks up the node just past the last one of `dst`, whose children and tail
+ * are just past the last ones too, in the register `table` of the nodes of
+ * `dst`. Returns the index of an equivalent node if there is one, and appends
+ * the node and returns its index otherwise. Children are packed, for a
+ * minimized trie never grows a block.
+ */
+static Index register_node(struct trie *dst, Index *table, size_t mask)
+{
+    const Index id = dst->count;
+    const Node *const node = dst->pool + id;
+
+    for (size_t slot = (size_t) hash_node(dst, id) & mask; ; slot = (slot + 1) & mask) {
+        if (table[slot] == INVALID_OFFSET) {
+            table[slot] = id;
+            dst->count += 1;
+            dst->edge_count += node->nchildren;
+            dst->text_len += node->tail_len;
+            return id;
+        }
+
+        if (nodes_equal(dst, table[slot], id)) {
+            return table[slot];
+        }
+    }
+}
+
+/* Appends a copy of `src->pool[idx]` to `dst`, with its children renumbered
+ * through `map`, and returns the index of the node of `dst` equivalent to it.
+ * `dst` has room for it, and `table` for every node of `dst`.
+ */
+static Index intern_node(struct trie *dst, const struct trie *src, Index idx, 
+                         const Index *map, Index *table, size_t mask)
+{
+    const Node *const node = src->pool + idx;
+    const Index id = dst->count;
+    Node *const copy = dst->pool + id;
+
+    memcpy(copy, node, sizeof *copy);
+    copy->edges = node->nchildren ? dst->edge_count : INVALID_OFFSET;
+    copy->block_class = 0;
+    copy->tail = node->tail_len ? dst->text_len : 0;
+
+    while (BLOCK_SIZE(copy->block_class) < node->nchildren) {
+        ++copy->block_class;
+    }
+
+    for (uint8_t i = 0; i < node->nchildren; ++i) {
+        dst->labels[copy->edges + i] = src->labels[node->edges + i];
+        dst->targets[copy->edges + i] = map[src->targets[node->edges + i]];
+    }
+
+    memcpy(dst->text + copy->tail, src->text + node->tail, (size_t) node->tail_len);
+    return register_node(dst, table, mask);
+}
+
+static bool minimize_trie(struct trie *t)
+{
+    size_t mask = 1;
+
+    while (mask < (size_t) t->count * 2) {
+        mask <<= 1;
+    }
+
+    struct trie dst = { 
+        .radix = t->radix, 
+        .huge_pages = t->huge_pages,
+        .keys = t->keys,
+        .grows = t->grows,
+        .generation = t->generation,
+    };
+    const size_t nodes = (size_t) t->count;
+    const size_t edges = (size_t) (t->edge_count ? t->edge_count : 1);
+    const size_t text = (size_t) (t->text_len ? t->text_len : 1);
+
+    /* Only a trie that is not frozen is minimized, so it labels every byte
+     * with itself.
+     */
+    init_alphabet(&dst);
+    dst.pool = malloc(sizeof *dst.pool * nodes);
+    dst.labels = malloc(sizeof *dst.labels * edges);
+    dst.targets = malloc(sizeof *dst.targets * edges);
+    dst.text = malloc(text);
+
+    Index *const map = malloc(sizeof *map * nodes);
+    Index *const table = malloc(sizeof *table * mask);
+    /* The path from the root to the node being visited, and for each node on
+     * it, the number of its children visited so far.
+     */
+    Index *const stack = malloc(sizeof *stack * nodes);
+    uint8_t *const next = malloc(sizeof *next * nodes);
+    bool rv = dst.pool && dst.labels && dst.targets && dst.text && map && table 
+           && stack && next;
+
+    if (!rv) {
+        perror("malloc()");
+        free_pool(&dst);
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < mask; ++i) {
+        table[i] = INVALID_OFFSET;
+    }
+
+    --mask;
+
+    size_t depth = 1;
+
+    stack[0] = t->root;
+    next[0] = 0;
+
+    while (depth) {
+        const Index top = stack[depth - 1];
+        const Node *const node = t->pool + top;
+
+        if (next[depth - 1] < node->nchildren) {
+            stack[depth] = t->targets[node->edges + next[depth - 1]++];
+            next[depth++] = 0;
+            continue;
+        }
+
+        map[top] = intern_node(&dst, t, top, map, table, mask);
+        --depth;
+    }
+
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; ++i) {
+        dst.free_blocks[i] = INVALID_OFFSET;
+    }
+
+    dst.free_nodes = INVALID_OFFSET;
+    dst.root = map[t->root];
+    dst.capacity = (Index) nodes;
+    dst.edge_capacity = (Index) edges;
+    dst.text_capacity = (Index) text;
+    dst.minimized = true;
+    free_pool(t);
+    *t = dst;
+
+    /* The pools were sized for the trie; give back what the merged nodes
+     * would have taken.
+     */
+    shrink_pools(t);
+    advise_huge_pages(t, t->pool, sizeof *t->pool * (size_t) t->capacity);
+    advise_huge_pages(t, t->targets, sizeof *t->targets * (size_t) t->edge_capacity);
+
+  cleanup:
+    free(next);
+    free(stack);
+    free(table);
+    free(map);
+    return rv;
+}
+
+/* Insertion leaves the nodes in the order they were created in, so the top
+ * levels of the trie, which every lookup goes through, are spread across the
+ * whole pool, about one node per page. Relayout renumbers the nodes so that a
+ * descent touches as few cache lines and pages as it can: the top levels are
+ * numbered breadth-first, until RELAYOUT_TOP_NODES nodes are, so that they
+ * share a few pages that stay cached, and the subtrees hanging below them are
+ * numbered depth-first, one after another, so that a path through one of them
+ * runs through neighbouring nodes. A breadth-first order all the way down
+ * would be slower than insertion order, for it puts the nodes of a path a
+ * whole level apart. The child blocks and edge text are laid out in the same
+ * order. In a minimized trie, a shared node goes where it is first reached.
+ * Nodes that can not be reached from the root are dropped.
+ */
+#define RELAYOUT_TOP_NODES (1024 * 8)
+
+static bool relayout_trie(struct trie *t)
+{
+    const size_t nodes = (size_t) t->count;
+    Index *const map = malloc(sizeof *map * nodes);
+    /* The old index of every node, in the new order. The breadth-first part
+     * uses it as its queue.
+     */
+    Index *const order = malloc(sizeof *order * nodes);
+    Frame *stack = NULL;
+    size_t stack_cap = 0;
+    struct trie dst = { 
+        .radix = t->radix, 
+        .huge_pages = t->huge_pages,
+        .minimized = t->minimized,
+        .keys = t->keys,
+        .grows = t->grows,
+        .generation = t->generation + 1,
+    };
+    bool rv = map && order;
+
+    /* A frozen trie is not relaid out, so `t` labels every byte with itself. */
+    init_alphabet(&dst);
+
+    if (!rv) {
+        perror("malloc()");
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < nodes; ++i) {
+        map[i] = INVALID_OFFSET;
+    }
+
+    size_t count = 1;
+    size_t head = 0;
+
+    order[0] = t->root;
+    map[t->root] = 0;
+
+    for (; head < count && count < RELAYOUT_TOP_NODES; ++head) {
+        const Node *const node = t->pool + order[head];
+
+        for (uint8_t j = 0; j < node->nchildren; ++j) {
+            const Index child = t->targets[node->edges + j];
+
+            if (map[child] == INVALID_OFFSET) {
+                map[child] = (Index) count;
+                order[count++] = child;
+            }
+        }
+    }
+
+    /* The nodes still queued are the roots of the depth-first part. */
+    for (const size_t end = count; rv && head < end; ++head) {
+        size_t depth = 0;
+
+        if (!(rv = frames_reserve(&stack, &stack_cap, 1))) {
+            break;
+        }
+
+        stack[depth++] = (Frame) { 
+            order[head], INVALID_OFFSET, 0, t->pool[order[head]].nchildren 
+        };
+
+        while (depth) {
+            Frame *const f = stack + depth - 1;
+
+            if (f->left == 0) {
+                --depth;
+                continue;
+            }
+
+            f->slot = next_slot(t, t->pool + f->node, f->slot);
+            --f->left;
+
+            const Index child = t->targets[f->slot];
+
+            if (map[child] != INVALID_OFFSET) {
+                continue;
+            }
+
+            map[child] = (Index) count;
+            order[count++] = child;
+
+            if (!(rv = frames_reserve(&stack, &stack_cap, depth + 1))) {
+                break;
+            }
+
+            stack[depth++] = (Frame) { 
+                child, INVALID_OFFSET, 0, t->pool[child].nchildren 
+            };
+        }
+    }
+
+    if (!rv) {
+        goto cleanup;
+    }
+
+    size_t edges = 0;
+    size_t text = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const Node *const node = t->pool + order[i];
+
+        /* A minimized trie packs its blocks, for it never grows them. */
+        if (node->nchildren) {
+            edges += t->minimized ? node->nchildren 
+                                  : (size_t) BLOCK_SIZE(node->block_class);
+        }
+        text += (size_t) node->tail_len;
+    }
+
+    dst.pool = malloc(sizeof *dst.pool * count);
+    dst.labels = malloc(sizeof *dst.labels * (edges ? edges : 1));
+    dst.targets = malloc(sizeof *dst.targets * (edges ? edges : 1));
+    dst.text = malloc(text ? text : 1);
+
+    if (!(rv = dst.pool && dst.labels && dst.targets && dst.text)) {
+        perror("malloc()");
+        free_pool(&dst);
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const Node *const node = t->pool + order[i];
+        Node *const copy = dst.pool + i;
+
+        memcpy(copy, node, sizeof *copy);
+
+        if (node->nchildren) {
+            const Index span = t->minimized ? node->nchildren 
+                                            : BLOCK_SIZE(node->block_class);
+
+            copy->edges = dst.edge_count;
+            memset(dst.labels + copy->edges, 0, sizeof *dst.labels * (size_t) span);
+            memset(dst.targets + copy->edges, 0, sizeof *dst.targets * (size_t) span);
+
+            for (uint8_t j = 0; j < node->nchildren; ++j) {
+                dst.labels[copy->edges + j] = t->labels[node->edges + j];
+                dst.targets[copy->edges + j] = map[t->targets[node->edges + j]];
+            }
+            dst.edge_count += span;
+        }
+
+        copy->tail = node->tail_len ? dst.text_len : 0;
+        memcpy(dst.text + copy->tail, t->text + node->tail, (size_t) node->tail_len);
+        dst.text_len += node->tail_len;
+    }
+
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; ++i) {
+        dst.free_blocks[i] = INVALID_OFFSET;
+    }
+
+    dst.free_nodes = INVALID_OFFSET;
+    dst.count = dst.capacity = (Index) count;
+    dst.edge_capacity = (Index) (edges ? edges : 1);
+    dst.text_capacity = (Index) (text ? text : 1);
+    dst.root = 0;
+    free_pool(t);
+    *t = dst;
+    advise_huge_pages(t, t->pool, sizeof *t->pool * (size_t) t->capacity);
+    advise_huge_pages(t, t->targets, sizeof *t->targets * (size_t) t->edge_capacity);
+
+  cleanup:
+    free(stack);
+    free(order);
+    free(map);
+    return rv;
+}
+
+/* How many free slots a search for a base passes over before the next one
+ * starts past them.
+ */
+#define DA_MAX_SKIPS 16
+
+/* Makes room for `need` slots in the arrays of `dst`, and as many bases in
+ * `used`.
+ */
+static bool grow_double_array(struct trie *dst, unsigned char **used, 
+                              size_t need)
+{
+    if ((size_t) dst->edge_capacity >= need) {
+        return true;
+    }
+
+    const size_t old_cap = (size_t) dst->edge_capacity;
+    const size_t new_cap = (size_t) grow_capacity(0, dst->edge_capacity, need,
+                                                  INITIAL_POOL_CAP);
+
+    if (new_cap == 0) {
+        fputs("Error: too many edges. Consider recompiling the program "
+            "with 64-bit indices (make index64).\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    void *tmp = realloc(dst->labels, sizeof *dst->labels * new_cap);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    dst->labels = tmp;
+    memset(dst->labels + old_cap, DA_FREE, new_cap - old_cap);
+
+    if ((tmp = realloc(dst->targets, sizeof *dst->targets * new_cap)) == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    dst->targets = tmp;
+    memset(dst->targets + old_cap, 0, sizeof *dst->targets * (new_cap - old_cap));
+
+    if ((tmp = realloc(*used, new_cap)) == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    *used = tmp;
+    memset(*used + old_cap, 0, new_cap - old_cap);
+    dst->edge_capacity = (Index) new_cap;
+    return true;
+}
+
+static bool freeze_trie(struct trie *t)
+{
+    /* Number the bytes on the edges in byte order, which keeps the children of
+     * every node in the same order, and makes the windows no wider than the
+     * alphabet of the keys.
+     */
+    uint8_t label_of[UCHAR_MAX + 1] = { 0 };
+    uint8_t byte_of[UCHAR_MAX + 1] = { 0 };
+    uint8_t alphabet_size = 0;
+
+    for (Index i = 0; i < t->count; ++i) {
+        const Node *const node = t->pool + i;
+
+        for (uint8_t j = 0; j < node->nchildren; ++j) {
+            label_of[t->byte_of[t->labels[node->edges + j]]] = 1;
+        }
+    }
+
+    for (size_t ch = 1; ch <= UCHAR_MAX; ++ch) {
+        if (label_of[ch]) {
+            label_of[ch] = ++alphabet_size;
+            byte_of[alphabet_size] = (uint8_t) ch;
+        }
+    }
+
+    struct trie dst = { 0 };
+    unsigned char *used = NULL;
+    Index *const base = malloc(sizeof *base * (size_t) t->count);
+    const size_t window = (size_t) alphabet_size + 1;
+    size_t lo = window;             /* Where the search for a base starts. */
+    size_t len = window;            /* One past the last slot in use. */
+    bool rv = base != NULL;
+
+    if (!rv) {
+        perror("malloc()");
+    }
+
+    /* A base is at most `len` - 1, and needs `window` slots from there,
+     * so with twice as many past `len`, the search below always ends in
+     * bounds.
+     */
+    rv = rv && grow_double_array(&dst, &used, len + 2 * window);
+
+    if (rv) {
+        used[0] = 1;
+    }
+
+    for (Index i = 0; rv && i < t->count; ++i) {
+        const Node *const node = t->pool + i;
+
+        if (node->nchildren == 0) {
+            base[i] = 0;
+            continue;
+        }
+
+        uint8_t labels[UCHAR_MAX];
+        size_t b = 0;
+
+        for (uint8_t j = 0; j < node->nchildren; ++j) {
+            labels[j] = label_of[t->byte_of[t->labels[node->edges + j]]];
+        }
+
+        /* Try the bases that put the first child on a free slot, lowest first,
+         * until one puts the others on free slots too.
+         */
+        size_t skipped = 0;
+
+        for (size_t p = lo; ; ++p) {
+            p = (size_t) ((const uint8_t *) memchr(dst.labels + p, DA_FREE,
+                                                   (size_t) dst.edge_capacity - p)
+                          - dst.labels);
+            b = p - labels[0];
+
+            bool fits = !used[b];
+
+            for (uint8_t j = 1; fits && j < node->nchildren; ++j) {
+                fits = dst.labels[b + labels[j]] == DA_FREE;
+            }
+
+            if (fits) {
+                break;
+            }
+
+            /* The free slots that every search passes over are mostly those
+             * that fit no node, and rescanning them for every node makes the
+             * packing quadratic. Once a search has passed over enough of
+             * them, later searches start after them.
+             */
+            if (++skipped == DA_MAX_SKIPS) {
+                lo = p + 1;
+            }
+        }
+
+        for (uint8_t j = 0; j < node->nchildren; ++j) {
+            dst.labels[b + labels[j]] = labels[j];
+            dst.targets[b + labels[j]] = t->targets[node->edges + j];
+        }
+
+        used[b] = 1;
+        base[i] = (Index) b;
+
+        if (b + labels[node->nchildren - 1] + 1 > len) {
+            len = b + labels[node->nchildren - 1] + 1;
+        }
+
+        while (dst.labels[lo] != DA_FREE) {
+            ++lo;
+        }
+
+        rv = grow_double_array(&dst, &used, len + 2 * window);
+    }
+
+    /* A mapped trie gets pools of its own, for the image can not change. */
+    Node *pool = t->pool;
+    char *text = t->text;
+
+    if (rv && t->image) {
+        pool = malloc(sizeof *pool * (size_t) t->count);
+        text = malloc((size_t) (t->text_len ? t->text_len : 1));
+
+        if (pool == NULL || text == NULL) {
+            perror("malloc()");
+            free(pool);
+            free(text);
+            rv = false;
+        } else {
+            memcpy(pool, t->pool, sizeof *pool * (size_t) t->count);
+            memcpy(text, t->text, (size_t) t->text_len);
+        }
+    }
+
+    if (!rv) {
+        free(dst.labels);
+        free(dst.targets);
+        goto cleanup;
+    }
+
+    for (Index i = 0; i < t->count; ++i) {
+        pool[i].edges = base[i];
+    }
+
+    if (t->image) {
+        munmap(t->image, t->image_len);
+        t->image = NULL;
+        t->image_len = 0;
+        t->text_capacity = t->text_len;
+    } else {
+        free(t->labels);
+        free(t->targets);
+    }
+
+    t->pool = pool;
+    t->capacity = t->count;
+    t->text = text;
+    t->labels = dst.labels;
+    t->targets = dst.targets;
+    /* Every window lies within the arrays, that of the last base included. */
+    t->edge_count = (Index) (len + window);
+    t->edge_capacity = dst.edge_capacity;
+    memcpy(t->label_of, label_of, sizeof label_of);
+    memcpy(t->byte_of, byte_of, sizeof byte_of);
+    t->alphabet_size = alphabet_size;
+
+    for (size_t i = 0; i < BLOCK_CLASS_COUNT; ++i) {
+        t->free_blocks[i] = INVALID_OFFSET;
+    }
+
+    /* Free nodes are leaves, and got a base too; a frozen trie never allocates
+     * one anyway.
+     */
+    t->free_nodes = INVALID_OFFSET;
+    t->double_array = true;
+    shrink_pools(t);
+    advise_huge_pages(t, t->pool, sizeof *t->pool * (size_t) t->capacity);
+    advise_huge_pages(t, t->targets, sizeof *t->targets * (size_t) t->edge_capacity);
+
+  cleanup:
+    free(used);
+    free(base);
+    return rv;
+}
+
+/* Counts the nodes of `t` by fan-out and by depth, breadth-first, so that a
+ * node shared by a minimized trie is counted once, at its shallowest depth.
+ */
+static bool shape_trie(const struct trie *t, trie_shape_t *shape)
+{
+    const size_t nodes = (size_t) t->count;
+    Index *const queue = malloc(sizeof *queue * nodes);
+    unsigned char *const seen = calloc(nodes, 1);
+
+    if (queue == NULL || seen == NULL) {
+        perror("malloc()");
+        free(queue);
+        free(seen);
+        return false;
+    }
+
+    memset(shape, 0, sizeof *shape);
+    queue[0] = t->root;
+    seen[t->root] = 1;
+
+    /* `level_end` is one past the last queued node one level up. */
+    for (size_t head = 0, count = 1, depth = 0, level_end = 1; head < count; 
+         ++head) {
+        if (head == level_end) {
+            ++depth;
+            level_end = count;
+        }
+
+        const Node *const node = t->pool + queue[head];
+        Index slot = INVALID_OFFSET;
+
+        ++shape->fanout[node->nchildren < TRIE_SHAPE_BUCKETS 
+                        ? node->nchildren : TRIE_SHAPE_BUCKETS - 1];
+        ++shape->depth[depth < TRIE_SHAPE_BUCKETS ? depth : TRIE_SHAPE_BUCKETS - 1];
+
+        for (uint8_t j = 0; j < node->nchildren; ++j) {
+            slot = next_slot(t, node, slot);
+
+            const Index child = t->targets[slot];
+
+            if (!seen[child]) {
+                seen[child] = 1;
+                queue[count++] = child;
+            }
+        }
+    }
+
+    free(queue);
+    free(seen);
+    return true;
+}
+
+/* A binary image is this header followed by the node pool, the edge labels,
+ * the edge targets, and the edge text, each starting at the offset recorded in
+ * the header. The sections are the in-memory arrays written out verbatim, so
+ * that a loaded image can be used in place without any parsing. As a
+ * consequence, an image is only portable across hosts that agree on the byte
+ * order, the width of indices and the layout of Node, which is what
+ * `byte_order`, `index_size` and `node_size` check for.
+ *
+ * The header holds indices too, so its layout depends on `index_size`, which
+ * is at the same offset for every width. Images written before that field was
+ * added hold zero there, and always have 32-bit indices.
+ *
+ * The header also holds the label of every byte, so that a frozen image is
+ * looked up through the alphabet it was frozen with, without a pass over it.
+ */
+#define IMAGE_MAGIC      "TRIEIMG"
+#define IMAGE_VERSION    5
+#define IMAGE_BYTE_ORDER UINT32_C(0x01020304)
+#define IMAGE_ALIGN      8
+
+/* Flags of an image. Images written before there was more than one hold 0 or
+ * 1 there, which still reads right.
+ */
+#define IMAGE_RADIX        (1u << 0)
+#define IMAGE_MINIMIZED    (1u << 1)
+#define IMAGE_DOUBLE_ARRAY (1u << 2)
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint8_t alphabet_offset;    /* 0; see `alphabet`. */
+    uint8_t alphabet_size;      /* Labels in use. */
+    uint8_t flags;
+    uint8_t index_size;         /* sizeof (Index) */
+    Index root;
+    Index node_count;
+    Index edge_count;
+    Index text_len;
+    Index free_blocks[BLOCK_CLASS_COUNT];
+    uint64_t keys;
+    uint64_t nodes_offset;
+    uint64_t labels_offset;
+    uint64_t targets_offset;
+    uint64_t text_offset;
+    uint64_t image_len;
+    uint8_t alphabet[UCHAR_MAX + 1];    /* The label of every byte. */
+} ImageHeader;
+
+static inline uint64_t image_align(uint64_t offset)
+{
+    return (offset + IMAGE_ALIGN - 1) & ~(uint64_t) (IMAGE_ALIGN - 1);
+}
+
+static bool write_section(FILE *sink, uint64_t *pos, uint64_t offset,
+                          size_t nbytes, const void *data)
+{
+    static const char padding[IMAGE_ALIGN];
+
+    if (!io_write_file(sink, (size_t) (offset - *pos), padding)
+        || (nbytes && !io_write_file(sink, nbytes, data))) {
+        return false;
+    }
+
+    *pos = offset + nbytes;
+    return true;
+}
+
+bool trie_save(const trie_t *t, const char *path)
+{
+    ImageHeader hdr = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .byte_order = IMAGE_BYTE_ORDER,
+        .node_size = sizeof *t->pool,
+        .alphabet_size = t->alphabet_size,
+        .flags = (uint8_t) ((t->radix ? IMAGE_RADIX : 0) 
+                          | (t->minimized ? IMAGE_MINIMIZED : 0)
+                          | (t->double_array ? IMAGE_DOUBLE_ARRAY : 0)),
+        .index_size = sizeof (Index),
+        .root = t->root,
+        .node_count = t->count,
+        .edge_count = t->edge_count,
+        .text_len = t->text_len,
+        .keys = t->keys,
+    };
+    const size_t nodes_sz = sizeof *t->pool * (size_t) t->count;
+    const size_t labels_sz = sizeof *t->labels * (size_t) t->edge_count;
+    const size_t targets_sz = sizeof *t->targets * (size_t) t->edge_count;
+
+    memcpy(hdr.free_blocks, t->free_blocks, sizeof hdr.free_blocks);
+    memcpy(hdr.alphabet, t->label_of, sizeof hdr.alphabet);
+    hdr.nodes_offset = image_align(sizeof hdr);
+    hdr.labels_offset = image_align(hdr.nodes_offset + nodes_sz);
+    hdr.targets_offset = image_align(hdr.labels_offset + labels_sz);
+    hdr.text_offset = image_align(hdr.targets_offset + targets_sz);
+    hdr.image_len = hdr.text_offset + (uint64_t) t->text_len;
+
+    FILE *const sink = fopen(path, "wb");
+
+    if (sink == NULL) {
+        perror(path);
+        return false;
+    }
+
+    uint64_t pos = 0;
+
+    if (!write_section(sink, &pos, 0, sizeof hdr, &hdr)
+        || !write_section(sink, &pos, hdr.nodes_offset, nodes_sz, t->pool)
+        || !write_section(sink, &pos, hdr.labels_offset, labels_sz, t->labels)
+        || !write_section(sink, &pos, hdr.targets_offset, targets_sz, t->targets)
+        || !write_section(sink, &pos, hdr.text_offset, (size_t) t->text_len, 
+                t->text)) {
+        perror(path);
+        fclose(sink);
+        remove(path);
+        return false;
+    }
+
+    if (fclose(sink)) {
+        perror(path);
+        remove(path);
+        return false;
+    }
+    return true;
+}
+
+/* Returns whether the labels of an image number the bytes they stand for 1,
+ * 2, ... in byte order, as trie_freeze() does, and label every byte with itself
+ * unless the image is frozen.
+ */
+static bool check_alphabet(const ImageHeader *hdr)
+{
+    size_t next = 1;
+
+    for (size_t ch = 1; ch <= UCHAR_MAX; ++ch) {
+        if (hdr->alphabet[ch] == next) {
+            ++next;
+        } else if (hdr->alphabet[ch] != 0) {
+            return false;
+        }
+    }
+
+    return hdr->alphabet[0] == 0
+        && next - 1 == hdr->alphabet_size
+        && ((hdr->flags & IMAGE_DOUBLE_ARRAY) || hdr->alphabet_size == ALPHABET_SIZE);
+}
+
+static bool check_image(const ImageHeader *hdr, size_t len)
+{
+    const uint64_t nodes_end = hdr->nodes_offset 
+                             + sizeof (Node) * (uint64_t) hdr->node_count;
+    const uint64_t labels_end = hdr->labels_offset
+                              + sizeof (uint8_t) * (uint64_t) hdr->edge_count;
+    const uint64_t targets_end = hdr->targets_offset
+                               + sizeof (Index) * (uint64_t) hdr->edge_count;
+
+    return len >= sizeof *hdr
+        && memcmp(hdr->magic, IMAGE_MAGIC, sizeof hdr->magic) == 0
+        && hdr->version == IMAGE_VERSION
+        && hdr->byte_order == IMAGE_BYTE_ORDER
+        && (hdr->index_size == sizeof (Index)
+            || (hdr->index_size == 0 && sizeof (Index) == sizeof (uint32_t)))
+        && hdr->node_size == sizeof (Node)
+        && hdr->alphabet_offset == 0
+        && check_alphabet(hdr)
+        && hdr->image_len == len
+        && hdr->node_count > 0 && hdr->node_count != INVALID_OFFSET
+        && hdr->edge_count != INVALID_OFFSET && hdr->text_len != INVALID_OFFSET
+        && hdr->root < hdr->node_count
+        && hdr->nodes_offset % IMAGE_ALIGN == 0 
+        && hdr->targets_offset % IMAGE_ALIGN == 0
+        && hdr->nodes_offset >= sizeof *hdr
+        && hdr->labels_offset >= nodes_end
+        && hdr->targets_offset >= labels_end
+        && hdr->text_offset >= targets_end
+        && hdr->text_offset + (uint64_t) hdr->text_len <= len;
+}
+
+/* Returns whether the slice of `len` bytes at `off` lies within `size`. */
+static bool in_bounds(Index off, Index len, Index size)
+{
+    return off <= size && len <= size - off;
+}
+
+/* Returns whether every index in the pools of the image `t` is within them,
+ * so that no lookup or update of it reads out of bounds: the child blocks of
+ * every node, and in a double array, the windows, which must hold as many
+ * children as the nodes say; the targets of every child; the edge text; and
+ * the free lists of blocks, which must end. A pass over the pools, which only
+ * an image that was truncated, corrupted, or written by a build of another
+ * TRIE_INDEX_BITS gets past the header with and fails.
+ */
+static bool check_pools(const struct trie *t)
+{
+    for (Index i = 0; i < t->count; ++i) {
+        const Node *const node = t->pool + i;
+
+        if (node->tail_len && !in_bounds(node->tail, node->tail_len, t->text_len)) {
+            return false;
+        }
+
+        if (node->nchildren == 0) {
+            continue;
+        }
+
+        if (t->double_array) {
+            const Index window = (Index) t->alphabet_size + 1;
+            uint8_t children = 0;
+
+            if (!in_bounds(node->edges, window, t->edge_count)) {
+                return false;
+            }
+
+            for (Index slot = node->edges; slot < node->edges + window; ++slot) {
+                if (t->labels[slot] == (uint8_t) (slot - node->edges)
+                    && t->labels[slot] != DA_FREE) {
+                    if (t->targets[slot] >= t->count) {
+                        return false;
+                    }
+                    ++children;
+                }
+            }
+
+            if (children != node->nchildren) {
+                return false;
+            }
+            continue;
+        }
+
+        /* A minimized trie is read-only, and packs its blocks to the children
+         * they hold, but the whole block of a node may be written to when one
+         * is added.
+         */
+        if (node->block_class >= BLOCK_CLASS_COUNT
+            || node->nchildren > BLOCK_SIZE(node->block_class)
+            || !in_bounds(node->edges, t->minimized 
+                                       ? (Index) node->nchildren 
+                                       : BLOCK_SIZE(node->block_class), 
+                          t->edge_count)) {
+            return false;
+        }
+
+        for (Index slot = node->edges; slot < node->edges + node->nchildren; ++slot) {
+            if (t->targets[slot] >= t->count) {
+                return false;
+            }
+        }
+    }
+
+    if (t->double_array) {
+        return true;
+    }
+
+    for (uint8_t cls = 0; cls < BLOCK_CLASS_COUNT; ++cls) {
+        Index block = t->free_blocks[cls];
+
+        for (Index left = t->edge_count / BLOCK_SIZE(cls) + 1; 
+             block != INVALID_OFFSET; --left) {
+            if (left == 0 || !in_bounds(block, BLOCK_SIZE(cls), t->edge_count)) {
+                return false;
+            }
+            block = t->targets[block];
+        }
+    }
+    return true;
+}
+
+/* Beyond the header and section bounds, the pools of an image are checked to
+ * index nothing out of them, but not to form a trie, let alone the one that was
+ * saved: the image must come from a trusted writer.
+ */
+trie_t *trie_load(const char *path)
+{
+    const int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1) {
+        perror("fstat()");
+        close(fd);
+        return NULL;
+    }
+
+    const size_t len = (size_t) st.st_size;
+
+    if (len < sizeof (ImageHeader)) {
+        fprintf(stderr, "Error: %s is not a trie image.\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *const image = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (image == MAP_FAILED) {
+        perror("mmap()");
+        return NULL;
+    }
+
+    const ImageHeader *const hdr = image;
+
+    if (!check_image(hdr, len)) {
+        fprintf(stderr, "Error: %s is not a compatible trie image.\n", path);
+        munmap(image, len);
+        return NULL;
+    }
+
+    struct trie *const t = calloc(1, sizeof *t);
+
+    if (t == NULL) {
+        perror("calloc()");
+        munmap(image, len);
+        return NULL;
+    }
+
+    char *const base = image;
+
+    t->image = image;
+    t->image_len = len;
+    t->pool = (Node *) (base + hdr->nodes_offset);
+    t->count = t->capacity = hdr->node_count;
+    t->labels = (uint8_t *) (base + hdr->labels_offset);
+    t->targets = (Index *) (base + hdr->targets_offset);
+    t->edge_count = t->edge_capacity = hdr->edge_count;
+    t->text = base + hdr->text_offset;
+    t->text_len = t->text_capacity = hdr->text_len;
+    memcpy(t->free_blocks, hdr->free_blocks, sizeof t->free_blocks);
+    memcpy(t->label_of, hdr->alphabet, sizeof t->label_of);
+
+    for (size_t ch = 1; ch <= UCHAR_MAX; ++ch) {
+        t->byte_of[t->label_of[ch]] = (uint8_t) ch;
+    }
+
+    t->alphabet_size = hdr->alphabet_size;
+    t->keys = (size_t) hdr->keys;
+    t->radix = hdr->flags & IMAGE_RADIX;
+    t->minimized = hdr->flags & IMAGE_MINIMIZED;
+    t->double_array = hdr->flags & IMAGE_DOUBLE_ARRAY;
+    t->root = hdr->root;
+    t->free_nodes = INVALID_OFFSET;
+
+    if (!check_pools(t)) {
+        fprintf(stderr, "Error: %s is a corrupt trie image.\n", path);
+        trie_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+/* Points the pools of `dst` at copies of those of `src`, sized to what they
+ * use. Returns false on allocation failure, in which case `dst` is left as it
+ * was.
+ */
+static bool copy_pools(struct trie *dst, const struct trie *src)
+{
+    const size_t nodes = (size_t) (src->count ? src->count : 1);
+    const size_t edges = (size_t) (src->edge_count ? src->edge_count : 1);
+    const size_t text = (size_t) (src->text_len ? src->text_len : 1);
+    Node *const pool = malloc(sizeof *pool * nodes);
+    uint8_t *const labels = malloc(sizeof *labels * edges);
+    Index *const targets = malloc(sizeof *targets * edges);
+    char *const text_pool = malloc(text);
+
+    if (pool == NULL || labels == NULL || targets == NULL || text_pool == NULL) {
+        perror("malloc()");
+        free(pool);
+        free(labels);
+        free(targets);
+        free(text_pool);
+        return false;
+    }
+
+    memcpy(pool, src->pool, sizeof *pool * (size_t) src->count);
+    memcpy(labels, src->labels, sizeof *labels * (size_t) src->edge_count);
+    memcpy(targets, src->targets, sizeof *targets * (size_t) src->edge_count);
+    memcpy(text_pool, src->text, (size_t) src->text_len);
+    dst->pool = pool;
+    dst->capacity = (Index) nodes;
+    dst->labels = labels;
+    dst->targets = targets;
+    dst->edge_capacity = (Index) edges;
+    dst->text = text_pool;
+    dst->text_capacity = (Index) text;
+    return true;
+}
+
+/* Gives a loaded trie pools of its own, copied out of the image, so that it
+ * can be changed. The copy is made once, on the first update; the image is
+ * the pools written out verbatim, so it is one memcpy() per pool.
+ */
+static bool thaw_image(struct trie *t)
+{
+    void *const image = t->image;
+
+    if (!copy_pools(t, t)) {
+        return false;
+    }
+
+    munmap(image, t->image_len);
+    t->image = NULL;
+    t->image_len = 0;
+    return true;
+}
+
+/* Insertion may split or extend any node on the path of the key, and removal
+ * may unlink or merge them, which is not possible in place if a node is
+ * shared, or if its children are packed into a double array. A loaded trie is
+ * copied out of its image first. Every update bumps the generation of the
+ * trie, which tells cursors that the nodes they cached may have changed.
+ */
+static bool begin_update(struct trie *t)
+{
+    if (t->minimized) {
+        fputs("Error: a minimized trie is read-only.\n", stderr);
+        return false;
+    }
+
+    if (t->double_array) {
+        fputs("Error: a frozen trie is read-only.\n", stderr);
+        return false;
+    }
+
+    if (t->image && !thaw_image(t)) {
+        return false;
+    }
+
+    ++t->generation;
+    return true;
+}
+
+/* A sorted build takes the keys in byte order, so that once a key has been
+ * added, the nodes off the path to it will never get another child: they are
+ * final, and are written out right away, children first. Only the path to the
+ * last key is kept open, as a stack of frames; the next key closes the frames
+ * below the prefix it shares with the last one, and opens frames for the rest
+ * of it. In radix mode, a frame stands for a whole edge, and the next key can
+ * split the one it leaves the path in, which is still open.
+ *
+ * Nodes are appended to `out` in the order they are closed, so its pools are
+ * only ever written at their ends, and the root is the last node. A minimizing
+ * build looks every node up in a register of the nodes of `out` as it closes
+ * it, as minimize_trie() does, and drops it for an equivalent one if there is
+ * one. A build into an image writes the nodes of `out` to the image, and the
+ * other sections to scratch files, every SORTED_FLUSH_NODES nodes, and starts
+ * `out` over; only a minimizing build, whose register has to see every node,
+ * keeps them all.
+ */
+#define SORTED_FLUSH_NODES (1024 * 64)
+
+typedef struct {
+    size_t depth;               /* Bytes of the key the node is reached by. */
+    size_t children;            /* Its first child in `kids`. */
+    uint32_t weight;
+    bool terminal;
+} SortedFrame;
+
+typedef struct {
+    Index target;
+    Index keys;
+    uint32_t max_weight;
+    uint8_t label;
+} SortedChild;
+
+typedef struct {
+    struct trie out;
+    bool minimize;
+    Index *table;               /* The register of a minimizing build. */
+    size_t mask;
+
+    SortedFrame *path;          /* path[0] is the root. */
+    size_t path_len;
+    size_t path_cap;
+    SortedChild *kids;          /* The children of the frames closed so far. */
+    size_t kids_len;
+    size_t kids_cap;
+    char *key;                  /* The last key. */
+    size_t key_len;
+    size_t key_cap;
+    size_t lines;
+
+    /* A build into an image writes the nodes to `sink`, and the labels,
+     * targets and text to scratch files, to be copied into the image at the
+     * end. The bases count what was written out already, and are added to the
+     * indices of `out` to make those of the image.
+     */
+    const char *image_path;
+    FILE *sink;
+    FILE *scratch[3];
+    uint64_t sink_pos;
+    Index node_base;
+    Index edge_base;
+    Index text_base;
+} SortedBuild;
+
+/* Grows `*array`, of `*cap` elements of `size` bytes, to hold `need`. */
+static bool sorted_reserve(void **array, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap) {
+        return true;
+    }
+
+    size_t new_cap = *cap ? *cap * 2 : 64;
+
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+
+    void *const tmp = realloc(*array, new_cap * size);
+
+    if (tmp == NULL) {
+        perror("realloc()");
+        return false;
+    }
+
+    *array = tmp;
+    *cap = new_cap;
+    return true;
+}
+
+/* Makes room in the pools of `t` for one more node, `span` slots and
+ * `tail_len` bytes of text.
+ */
+static bool sorted_reserve_pools(struct trie *t, Index span, Index tail_len)
+{
+    if (t->count == t->capacity || t->edge_capacity - t->edge_count < span) {
+        const Index node_cap = grow_capacity(t->count, t->capacity, 1,
+                                             INITIAL_POOL_CAP);
+        const Index edge_cap = grow_capacity(t->edge_count, t->edge_capacity,
+                                             (size_t) span, INITIAL_POOL_CAP);
+
+        if (node_cap == 0 || edge_cap == 0) {
+            fputs("Error: too many nodes. Consider recompiling the program "
+                "with 64-bit indices (make index64).\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        void *const pool = realloc(t->pool, sizeof *t->pool * (size_t) node_cap);
+        void *const labels = pool ? realloc(t->labels, (size_t) edge_cap) : NULL;
+        void *const targets = labels
+                            ? realloc(t->targets, sizeof *t->targets * (size_t) edge_cap)
+                            : NULL;
+
+        t->pool = pool ? pool : t->pool;
+        t->labels = labels ? labels : t->labels;
+        t->targets = targets ? targets : t->targets;
+
+        if (targets == NULL) {
+            perror("realloc()");
+            return false;
+        }
+
+        t->capacity = node_cap;
+        t->edge_capacity = edge_cap;
+        ++t->grows;
+        advise_huge_pages(t, t->pool, sizeof *t->pool * (size_t) node_cap);
+        advise_huge_pages(t, t->targets, sizeof *t->targets * (size_t) edge_cap);
+    }
+
+    if (t->text_capacity - t->text_len < tail_len) {
+        const Index text_cap = grow_capacity(t->text_len, t->text_capacity,
+                                             (size_t) tail_len, TEXT_POOL_STEP);
+
+        if (text_cap == 0) {
+            fputs("Error: too much edge text. Consider recompiling the program "
+                "with 64-bit indices (make index64).\n", stderr);
+            exit(EXIT_FAILURE);
+        }
+
+        void *const text = realloc(t->text, (size_t) text_cap);
+
+        if (text == NULL) {
+            perror("realloc()");
+            return false;
+        }
+
+        t->text = text;
+        t->text_capacity = text_cap;
+        ++t->grows;
+    }
+    return true;
+}
+
+/* Doubles the register of `b` and enters the nodes of `out` in it again. */
+static bool sorted_grow_register(SortedBuild *b)
+{
+    const size_t size = b->table ? (b->mask + 1) * 2 : INITIAL_POOL_CAP;
+    Index *const table = malloc(sizeof *table * size);
+
+    if (table == NULL) {
+        perror("malloc()");
+        return false;
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+        table[i] = INVALID_OFFSET;
+    }
+
+    for (Index id = 0; id < b->out.count; ++id) {
+        size_t slot = (size_t) hash_node(&b->out, id) & (size - 1);
+
+        while (table[slot] != INVALID_OFFSET) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = id;
+    }
+
+    free(b->table);
+    b->table = table;
+    b->mask = size - 1;
+    return true;
+}
+
+/* Writes the nodes, edges and text of `out` to the image and the scratch
+ * files, and empties it.
+ */
+static bool sorted_flush(SortedBuild *b)
+{
+    struct trie *const out = &b->out;
+    const size_t nodes_sz = sizeof *out->pool * (size_t) out->count;
+
+    if (INDEX_MAX - b->node_base <= out->count
+        || INDEX_MAX - b->edge_base <= out->edge_count
+        || INDEX_MAX - b->text_base <= out->text_len) {
+        fputs("Error: too many nodes. Consider recompiling the program "
+            "with 64-bit indices (make index64).\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!write_section(b->sink, &b->sink_pos, b->sink_pos, nodes_sz, out->pool)
+        || fwrite(out->labels, sizeof *out->labels, (size_t) out->edge_count,
+                  b->scratch[0]) != (size_t) out->edge_count
+        || fwrite(out->targets, sizeof *out->targets, (size_t) out->edge_count,
+                  b->scratch[1]) != (size_t) out->edge_count
+        || fwrite(out->text, 1, (size_t) out->text_len,
+                  b->scratch[2]) != (size_t) out->text_len) {
+        perror(b->image_path);
+        return false;
+    }
+
+    b->node_base += out->count;
+    b->edge_base += out->edge_count;
+    b->text_base += out->text_len;
+    out->count = 0;
+    out->edge_count = 0;
+    out->text_len = 0;
+    return true;
+}
+
+/* Closes the frame `f`, whose children are the last ones of `kids`, and which
+ * is reached by the `edge_len` bytes at `edge` (none for the root). Its node is
+ * written to `out`, or an equivalent one found, and its children are replaced
+ * by the node in `kids`.
+ */
+static bool sorted_close(SortedBuild *b, const SortedFrame *f, const char *edge,
+                         size_t edge_len)
+{
+    struct trie *const out = &b->out;
+    const SortedChild *const kids = b->kids + f->children;
+    const size_t nkids = b->kids_len - f->children;
+    const Index tail_len = (Index) (edge_len ? edge_len - 1 : 0);
+    uint8_t cls = 0;
+
+    while (BLOCK_SIZE(cls) < nkids) {
+        ++cls;
+    }
+
+    /* A minimized trie packs its blocks, for it never grows them. */
+    const Index span = nkids == 0 ? 0 : b->minimize ? (Index) nkids : BLOCK_SIZE(cls);
+
+    if (!sorted_reserve_pools(out, span, tail_len)) {
+        return false;
+    }
+
+    Node *const node = out->pool + out->count;
+
+    /* Clear the padding as well, so that images are reproducible. */
+    memset(node, 0, sizeof *node);
+    node->edges = nkids ? b->edge_base + out->edge_count : INVALID_OFFSET;
+    node->nchildren = (uint8_t) nkids;
+    node->block_class = cls;
+    node->terminal = f->terminal;
+    node->weight = f->weight;
+    node->max_weight = f->terminal ? f->weight : 0;
+    node->keys = f->terminal;
+    node->tail = tail_len ? b->text_base + out->text_len : 0;
+    node->tail_len = tail_len;
+
+    for (size_t i = 0; i < span; ++i) {
+        const Index slot = out->edge_count + (Index) i;
+
+        out->labels[slot] = i < nkids ? kids[i].label : 0;
+        out->targets[slot] = i < nkids ? kids[i].target : 0;
+
+        if (i < nkids && kids[i].max_weight > node->max_weight) {
+            node->max_weight = kids[i].max_weight;
+        }
+
+        node->keys += i < nkids ? kids[i].keys : 0;
+    }
+
+    memcpy(out->text + out->text_len, edge + 1, (size_t) tail_len);
+
+    const SortedChild closed = {
+        .label = edge_len ? LABEL_OF(out, *edge) : 0,
+        .keys = node->keys,
+        .max_weight = node->max_weight,
+    };
+    Index id = out->count;
+
+    if (b->minimize) {
+        if ((size_t) out->count * 2 >= b->mask && !sorted_grow_register(b)) {
+            return false;
+        }
+        id = register_node(out, b->table, b->mask);
+    } else {
+        ++out->count;
+        out->edge_count += span;
+        out->text_len += tail_len;
+    }
+
+    b->kids_len = f->children;
+    b->kids[b->kids_len] = closed;
+    b->kids[b->kids_len++].target = b->node_base + id;
+
+    return !b->sink || b->minimize || out->count < SORTED_FLUSH_NODES
+        || sorted_flush(b);
+}
+
+/* Adds the key of `line`, which must not sort before the last one. */
+static bool sorted_add_line(void *ctx, char *line)
+{
+    SortedBuild *const b = ctx;
+    const uint32_t weight = split_weight(line);
+    const size_t len = strlen(line);
+    size_t lcp = 0;
+
+    ++b->lines;
+
+    while (lcp < len && lcp < b->key_len && line[lcp] == b->key[lcp]) {
+        ++lcp;
+    }
+
+    if (lcp < b->key_len
+        && (lcp == len || (unsigned char) line[lcp] < (unsigned char) b->key[lcp])) {
+        fprintf(stderr, "Error: line %zu is out of order; the word list is not "
+            "sorted.\n", b->lines);
+        return false;
+    }
+
+    /* Close the frames below the shared prefix. A frame that the new key
+     * leaves in the middle of its edge gives way to a frame at the fork, with
+     * the closed node as its first child.
+     */
+    while (b->path[b->path_len - 1].depth > lcp) {
+        SortedFrame *const f = b->path + b->path_len - 1;
+        const size_t parent_depth = b->path[b->path_len - 2].depth;
+
+        /* The kids still hold a slot past the last child of `f`. */
+        if (parent_depth >= lcp) {
+            if (!sorted_close(b, f, b->key + parent_depth, f->depth - parent_depth)) {
+                return false;
+            }
+            --b->path_len;
+        } else {
+            if (!sorted_close(b, f, b->key + lcp, f->depth - lcp)) {
+                return false;
+            }
+            *f = (SortedFrame) { .depth = lcp, .children = b->kids_len - 1 };
+        }
+    }
+
+    /* At most one frame per byte, and at most one more child than frames. */
+    if (!sorted_reserve((void **) &b->path, &b->path_cap, b->path_len + len - lcp + 1,
+                        sizeof *b->path)
+        || !sorted_reserve((void **) &b->kids, &b->kids_cap,
+                           b->kids_len + len - lcp + 2, sizeof *b->kids)
+        || !sorted_reserve((void **) &b->key, &b->key_cap, len + 1, 1)) {
+        return false;
+    }
+
+    SortedFrame *top = b->path + b->path_len - 1;
+
+    if (top->depth < len) {
+        for (size_t depth = b->out.radix ? len : lcp + 1; depth <= len; ++depth) {
+            b->path[b->path_len++] = (SortedFrame) {
+                .depth = depth, .children = b->kids_len
+            };
+        }
+        top = b->path + b->path_len - 1;
+    }
+
+    if (top->terminal) {
+        top->weight = UINT32_MAX - top->weight < weight
+                    ? UINT32_MAX
+                    : top->weight + weight;
+    } else {
+        top->terminal = true;
+        top->weight = weight;
+        ++b->out.keys;
+    }
+
+    memcpy(b->key + lcp, line + lcp, len - lcp + 1);
+    b->key_len = len;
+    return true;
+}
+
+/* Copies the scratch file `src` into the image at `offset`. */
+static bool sorted_copy_section(SortedBuild *b, uint64_t offset, FILE *src)
+{
+    char *const chunk = malloc(IO_CHUNK_SIZE);
+    bool rv = chunk && write_section(b->sink, &b->sink_pos, offset, 0, NULL)
+           && fflush(src) == 0 && fseek(src, 0, SEEK_SET) == 0;
+
+    for (size_t n = 0; rv && (n = fread(chunk, 1, IO_CHUNK_SIZE, src)) > 0; ) {
+        rv = io_write_file(b->sink, n, chunk);
+        b->sink_pos += n;
+    }
+
+    if (!rv || ferror(src)) {
+        perror(chunk ? b->image_path : "malloc()");
+        rv = false;
+    }
+
+    free(chunk);
+    return rv;
+}
+
+/* Writes what is left of `out` to the image, copies the scratch files in after
+ * it, and writes the header, now that the size of every section is known.
+ */
+static bool sorted_write_image(SortedBuild *b)
+{
+    if (!sorted_flush(b)) {
+        return false;
+    }
+
+    const struct trie *const out = &b->out;
+    ImageHeader hdr = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .byte_order = IMAGE_BYTE_ORDER,
+        .node_size = sizeof (Node),
+        .alphabet_size = ALPHABET_SIZE,
+        .flags = (uint8_t) ((out->radix ? IMAGE_RADIX : 0)
+                          | (b->minimize ? IMAGE_MINIMIZED : 0)),
+        .index_size = sizeof (Index),
+        .root = out->root,
+        .node_count = b->node_base,
+        .edge_count = b->edge_base,
+        .text_len = b->text_base,
+        .keys = out->keys,
+    };
+
+    memcpy(hdr.free_blocks, out->free_blocks, sizeof hdr.free_blocks);
+    memcpy(hdr.alphabet, out->label_of, sizeof hdr.alphabet);
+    hdr.nodes_offset = image_align(sizeof hdr);
+    hdr.labels_offset = image_align(hdr.nodes_offset
+                                    + sizeof (Node) * (uint64_t) hdr.node_count);
+    hdr.targets_offset = image_align(hdr.labels_offset + (uint64_t) hdr.edge_count);
+    hdr.text_offset = image_align(hdr.targets_offset
+                                  + sizeof (Index) * (uint64_t) hdr.edge_count);
+    hdr.image_len = hdr.text_offset + (uint64_t) hdr.text_len;
+
+    if (!sorted_copy_section(b, hdr.labels_offset, b->scratch[0])
+        || !sorted_copy_section(b, hdr.targets_offset, b->scratch[1])
+        || !sorted_copy_section(b, hdr.text_offset, b->scratch[2])) {
+        return false;
+    }
+
+    if (fseek(b->sink, 0, SEEK_SET) || fwrite(&hdr, sizeof hdr, 1, b->sink) != 1) {
+        perror(b->image_path);
+        return false;
+    }
+    return true;
+}
+
+/* Opens an unlinked scratch file next to `path`, so that it is on a disk that
+ * the image fits on, rather than in a temporary directory that may be in
+ * memory.
+ */
+static FILE *open_scratch(const char *path)
+{
+    const size_t len = strlen(path);
+    char *const name = malloc(len + sizeof ".XXXXXX");
+
+    if (name == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    memcpy(name, path, len);
+    memcpy(name + len, ".XXXXXX", sizeof ".XXXXXX");
+
+    const int fd = mkstemp(name);
+    FILE *const f = fd == -1 ? NULL : fdopen(fd, "w+b");
+
+    if (f == NULL) {
+        perror(name);
+
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+
+    if (fd != -1) {
+        unlink(name);
+    }
+
+    free(name);
+    return f;
+}
+
+static void free_sorted_build(SortedBuild *b)
+{
+    for (size_t i = 0; i < 3; ++i) {
+        if (b->scratch[i]) {
+            fclose(b->scratch[i]);
+        }
+    }
+
+    free(b->table);
+    free(b->path);
+    free(b->kids);
+    free(b->key);
+}
+
+trie_t *trie_create(unsigned flags)
+{
+    struct trie *const t = calloc(1, sizeof *t);
+
+    if (t == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    t->radix = flags & TRIE_RADIX;
+    t->huge_pages = flags & TRIE_HUGE_PAGES;
+
+    if (!init_pool(t)) {
+        free(t);
+        return NULL;
+    }
+
+    t->root = alloc_node(t);
+    return t;
+}
+
+trie_t *trie_clone(const trie_t *t)
+{
+    struct trie *const copy = malloc(sizeof *copy);
+
+    if (copy == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    *copy = *t;
+    copy->image = NULL;
+    copy->image_len = 0;
+
+    if (!copy_pools(copy, t)) {
+        free(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+void trie_destroy(trie_t *t)
+{
+    if (t) {
+        free_pool(t);
+        free(t);
+    }
+}
+
+bool trie_insert(trie_t *t, const char *key, uint32_t weight)
+{
+    return begin_update(t) && insert_text(t, t->root, key, weight);
+}
+
+bool trie_remove(trie_t *t, const char *key)
+{
+    return begin_update(t) && remove_text(t, key);
+}
+
+bool trie_lookup(const trie_t *t, const char *key, size_t len, 
+                 uint32_t *weight)
+{
+    const char *const end = key + len;
+    Index node_idx = t->root;
+
+    while (key < end) {
+        node_idx = find_child(t, t->pool + node_idx, LABEL_OF(t, *key++));
+
+        if (node_idx == INVALID_OFFSET) {
+            return false;
+        }
+
+        const Node *const child = t->pool + node_idx;
+
+        if ((size_t) (end - key) < child->tail_len
+            || (child->tail_len 
+                && memcmp(key, t->text + child->tail, child->tail_len))) {
+            return false;
+        }
+        key += child->tail_len;
+    }
+
+    if (!t->pool[node_idx].terminal) {
+        return false;
+    }
+
+    if (weight) {
+        *weight = t->pool[node_idx].weight;
+    }
+    return true;
+}
+
+bool trie_insert_lines(trie_t *t, char **lines, size_t nlines, size_t jobs)
+{
+    if (!begin_update(t)) {
+        return false;
+    }
+
+    /* A parallel build stitches the subtries below an empty root. */
+    return jobs > 1 && t->count == 1
+        ? populate_trie_parallel(t, lines, nlines, jobs)
+        : populate_trie(t, t->root, lines, nlines);
+}
+
+bool trie_insert_stream(trie_t *t, FILE *stream, size_t *nlines, 
+                        size_t *nskipped)
+{
+    return begin_update(t) 
+        && populate_trie_stream(t, t->root, stream, false, nlines, nskipped);
+}
+
+bool trie_apply_delta(trie_t *t, FILE *stream, size_t *nlines, 
+                      size_t *nskipped)
+{
+    return begin_update(t) 
+        && populate_trie_stream(t, t->root, stream, true, nlines, nskipped);
+}
+
+bool trie_record_delta(trie_t *adds, trie_t *dels, FILE *stream, 
+                       size_t *nlines, size_t *nskipped)
+{
+    DeltaRecorder r = { adds, dels };
+
+    return begin_update(adds) && begin_update(dels)
+        && read_lines(stream, record_next_line, &r, nlines, nskipped);
+}
+
+trie_t *trie_build_sorted(FILE *stream, unsigned flags, const char *path,
+                          size_t *nlines, size_t *nskipped)
+{
+    static const ImageHeader blank;
+    SortedBuild b = {
+        .out = {
+            .radix = flags & TRIE_RADIX,
+            .huge_pages = flags & TRIE_HUGE_PAGES,
+        },
+        .minimize = flags & TRIE_MINIMIZE,
+        .image_path = path,
+    };
+
+    if (!init_pool(&b.out)) {
+        return NULL;
+    }
+
+    bool rv = sorted_reserve((void **) &b.path, &b.path_cap, 1, sizeof *b.path)
+           && sorted_reserve((void **) &b.kids, &b.kids_cap, 2, sizeof *b.kids)
+           && sorted_reserve((void **) &b.key, &b.key_cap, 1, 1);
+
+    if (rv) {
+        b.path[b.path_len++] = (SortedFrame) { .depth = 0 };
+        b.key[0] = '\0';
+    }
+
+    if (rv && path) {
+        if ((b.sink = fopen(path, "wb")) == NULL) {
+            perror(path);
+            rv = false;
+        }
+
+        for (size_t i = 0; rv && i < 3; ++i) {
+            rv = (b.scratch[i] = open_scratch(path)) != NULL;
+        }
+
+        if (rv && (!write_section(b.sink, &b.sink_pos, 0, sizeof blank, &blank)
+                   || !write_section(b.sink, &b.sink_pos, image_align(sizeof blank),
+                                     0, NULL))) {
+            perror(path);
+            rv = false;
+        }
+    }
+
+    rv = rv && read_lines(stream, sorted_add_line, &b, nlines, nskipped);
+
+    /* Close the path to the last key, and the root last of all. */
+    for (; rv && b.path_len > 1; --b.path_len) {
+        const SortedFrame *const f = b.path + b.path_len - 1;
+        const size_t parent_depth = b.path[b.path_len - 2].depth;
+
+        rv = sorted_close(&b, f, b.key + parent_depth, f->depth - parent_depth);
+    }
+
+    rv = rv && sorted_close(&b, b.path, b.key, 0);
+
+    struct trie *t = NULL;
+
+    if (rv) {
+        b.out.root = b.kids[0].target;
+        b.out.minimized = b.minimize;
+    }
+
+    if (b.sink) {
+        rv = rv && sorted_write_image(&b);
+
+        if (fclose(b.sink) && rv) {
+            perror(path);
+            rv = false;
+        }
+
+        if (!rv) {
+            remove(path);
+        }
+    } else if (rv && (t = calloc(1, sizeof *t)) == NULL) {
+        perror("calloc()");
+    }
+
+    if (t) {
+        *t = b.out;
+    } else {
+        free_pool(&b.out);
+    }
+
+    free_sorted_build(&b);
+    return b.sink && rv ? trie_load(path) : t;
+}
+
+bool trie_minimize(trie_t *t)
+{
+    if (t->minimized) {
+        return true;
+    }
+    return begin_update(t) && minimize_trie(t);
+}
+
+bool trie_relayout(trie_t *t)
+{
+    /* The slots of a double array can not move, and an image was laid out
+     * by the trie it was saved from.
+     */
+    return t->image || t->double_array || relayout_trie(t);
+}
+
+bool trie_freeze(trie_t *t)
+{
+    if (t->double_array) {
+        return true;
+    }
+
+    ++t->generation;
+    return freeze_trie(t);
+}
+
+void trie_shrink_to_fit(trie_t *t)
+{
+    if (!t->image) {
+        shrink_pools(t);
+    }
+}
+
+void trie_get_stats(const trie_t *t, trie_stats_t *stats)
+{
+    const size_t edge_size = sizeof *t->labels + sizeof *t->targets;
+
+    *stats = (trie_stats_t) {
+        .keys = t->keys,
+        .nodes = (size_t) (t->count - t->free_node_count),
+        .nodes_allocated = (size_t) t->capacity,
+        .edges = (size_t) t->edge_count,
+        .edges_allocated = (size_t) t->edge_capacity,
+        .text = (size_t) t->text_len,
+        .text_allocated = (size_t) t->text_capacity,
+        .node_size = sizeof *t->pool,
+        .grows = t->grows,
+        .radix = t->radix,
+        .minimized = t->minimized,
+        .double_array = t->double_array,
+        .mapped = t->image != NULL,
+    };
+    stats->bytes_used = stats->nodes * stats->node_size
+                      + stats->edges * edge_size + stats->text;
+    stats->bytes_allocated = stats->nodes_allocated * stats->node_size
+                           + stats->edges_allocated * edge_size
+                           + stats->text_allocated;
+}
+
+bool trie_get_shape(const trie_t *t, trie_shape_t *shape)
+{
+    return shape_trie(t, shape);
+}
+
+trie_cursor_t *trie_cursor_create(const trie_t *t)
+{
+    trie_cursor_t *const cur = calloc(1, sizeof *cur);
+
+    if (cur == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    if (!key_reserve(&cur->path, &cur->path_cap, TRIE_PREFIX_MAX)) {
+        free(cur);
+        return NULL;
+    }
+
+    cur->trie = t;
+    cur->node = t->root;
+    cur->descent_nodes[0] = t->root;
+    cur->descent_depth = 1;
+    cur->generation = t->generation;
+    return cur;
+}
+
+void trie_cursor_rebind(trie_cursor_t *cur, const trie_t *t)
+{
+    cur->trie = t;
+    cur->node = t->root;
+    cur->path_len = 0;
+    cur->descent_nodes[0] = t->root;
+    cur->descent_depth = 1;
+    cur->generation = t->generation;
+}
+
+void trie_cursor_destroy(trie_cursor_t *cur)
+{
+    if (cur) {
+        free(cur->path);
+        free(cur->top_heap);
+        free(cur->top_keys);
+        free(cur->dfs_stack);
+        free(cur->dfs_key);
+        free(cur->fuzzy_stack);
+        free(cur->fuzzy_key);
+        free(cur->fuzzy_rows);
+        free(cur);
+    }
+}
+
+bool trie_find_prefix(trie_cursor_t *cur, const char *prefix)
+{
+    if (strlen(prefix) >= TRIE_PREFIX_MAX) {
+        cur->node = INVALID_OFFSET;
+        return false;
+    }
+
+    const Index start = resume_descent(cur, prefix);
+    const size_t resumed = cur->descent_depth;
+
+    cur->node = descend(cur, start, prefix + cur->path_len);
+    cur->visits = cur->descent_depth - resumed;
+    return cur->node != INVALID_OFFSET;
+}
+
+void trie_find_prefixes(trie_cursor_t *const *curs, const char *const *prefixes,
+                        size_t n, bool *found)
+{
+    FindLane lanes[FIND_BATCH_WIDTH];
+    size_t active = 0;
+    size_t next = 0;
+
+    for (;;) {
+        /* Start lookups until every lane is busy, or none are left. */
+        while (active < FIND_BATCH_WIDTH && next < n) {
+            trie_cursor_t *const cur = curs[next];
+            const char *const prefix = prefixes[next];
+            FindLane *const lane = lanes + active;
+
+            *lane = (FindLane) { 
+                .cur = cur, 
+                .found = found ? found + next : NULL,
+            };
+            ++next;
+
+            if (strlen(prefix) >= TRIE_PREFIX_MAX) {
+                lane->resumed = cur->descent_depth;
+                finish_lane(lane, INVALID_OFFSET);
+                continue;
+            }
+
+            lane->node = resume_descent(cur, prefix);
+            lane->prefix = prefix + cur->path_len;
+            lane->resumed = cur->descent_depth;
+
+            if (*lane->prefix == '\0') {
+                finish_lane(lane, lane->node);
+                continue;
+            }
+
+            prefetch_children(cur->trie, lane->node, *lane->prefix);
+            ++active;
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < active; ) {
+            if (step_lane(lanes + i)) {
+                ++i;
+            } else {
+                lanes[i] = lanes[--active];
+            }
+        }
+    }
+}
+
+size_t trie_cursor_visits(const trie_cursor_t *cur)
+{
+    return cur->visits;
+}
+
+bool trie_complete(trie_cursor_t *cur, size_t k, trie_emit_fn *emit, void *ctx)
+{
+    if (cur->node == INVALID_OFFSET) {
+        return true;
+    }
+
+    if (k) {
+        return print_top_suggestions(cur, cur->node, k, emit, ctx);
+    }
+
+    bool stopped = false;
+
+    return print_suggestions(cur, cur->node, cur->path, cur->path_len, &stopped,
+                             emit, ctx);
+}
+
+bool trie_complete_page(trie_cursor_t *cur, const trie_page_t *page,
+                        trie_emit_fn *emit, void *ctx)
+{
+    return cur->node == INVALID_OFFSET || print_page(cur, page, emit, ctx);
+}
+
+bool trie_complete_buffer(trie_cursor_t *cur, const trie_page_t *page,
+                          char *buf, size_t size, size_t *len, size_t *nkeys)
+{
+    PageBuffer b = { .buf = buf, .size = size };
+    const bool rv = trie_complete_page(cur, page, buffer_key, &b);
+
+    *len = b.len;
+    *nkeys = b.nkeys;
+    return rv;
+}
+
+size_t trie_count_completions(const trie_cursor_t *cur)
+{
+    return cur->node == INVALID_OFFSET 
+         ? 0 
+         : (size_t) cur->trie->pool[cur->node].keys;
+}
+
+bool trie_complete_fuzzy(trie_cursor_t *cur, const char *prefix, 
+                         size_t max_edits, size_t k, trie_emit_fn *emit, 
+                         void *ctx)
+{
+    return strlen(prefix) >= TRIE_PREFIX_MAX 
+        || fuzzy_search(cur, prefix, max_edits, k, emit, ctx);
+}
+
+bool trie_dump_dot(const trie_cursor_t *cur, FILE *sink)
+{
+    if (cur->node == INVALID_OFFSET) {
+        return false;
+    }
+
+    const struct trie *const t = cur->trie;
+    const bool whole = cur->node == t->root;
+    DotWriter w = { .sink = sink, .buf = malloc(DOT_BUFFER_SIZE) };
+    unsigned char *const seen = whole && !t->minimized 
+                              ? NULL : calloc(t->count, sizeof *seen);
+    bool rv = w.buf && (seen || (whole && !t->minimized));
+
+    if (!rv) {
+        perror("malloc()");
+        goto cleanup;
+    }
+
+    dot_puts(&w, "digraph Trie {\n"
+        "\tnode [fillcolor=lightblue,style=filled,arrowhead=vee,color=black]\n"
+        "\tNode_");
+    dot_index(&w, cur->node);
+    dot_puts(&w, " [label=\"");
+    dot_escape(&w, cur->path_len ? cur->path : "root", 
+               cur->path_len ? cur->path_len : 4, NULL, 0);
+    dot_puts(&w, "\"]\n");
+
+    if (seen) {
+        seen[cur->node] = 1;
+    }
+
+    if (whole) {
+        dump_dot_whole(t, &w, seen);
+    } else {
+        rv = dump_dot_prefix(t, &w, cur->node, seen);
+    }
+
+    dot_puts(&w, "}\n");
+    dot_flush(&w);
+    rv = rv && !w.failed && !ferror(sink);
+
+  cleanup:
+    free(seen);
+    free(w.buf);
+    return rv;
 }
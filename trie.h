@@ -0,0 +1,407 @@
+#ifndef TRIE_H
+#define TRIE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A trie of nul-terminated keys, each with a weight. Keys may hold any byte
+ * but nul, so UTF-8 keys work as they are, and completions are enumerated in
+ * the byte order strcmp() sorts them in.
+ *
+ * A `trie_t` is built with trie_create() and trie_insert(), or mapped from an
+ * image with trie_load(). Lookups go through a `trie_cursor_t`, which holds all
+ * the state of a query, so that any number of threads can query the same trie
+ * at once as long as each one has a cursor of its own and nobody updates the
+ * trie in the meantime. Nothing in this library writes to stdout;
+ * completions are handed to a caller-supplied callback, and errors are reported
+ * on stderr.
+ */
+
+/* One more than the length of the longest prefix a cursor can be positioned
+ * at.
+ */
+#define TRIE_PREFIX_MAX  (1024 * 2)
+
+/* How many lookups trie_find_prefixes() runs at once. */
+#define TRIE_FIND_BATCH  16
+
+/* Flags for trie_create(). */
+#define TRIE_RADIX       (1u << 0)  /* Collapse single-child chains into one edge. */
+#define TRIE_HUGE_PAGES  (1u << 1)  /* Back the pools with transparent huge pages. */
+#define TRIE_MINIMIZE    (1u << 2)  /* For trie_build_sorted(); see there. */
+
+typedef struct trie trie_t;
+typedef struct trie_cursor trie_cursor_t;
+
+/*
+ * Receives one completion of `len` bytes (not nul-terminated) and its weight.
+ * `ctx` is the pointer passed to trie_complete(). Returns false to stop the
+ * enumeration.
+ */
+typedef bool trie_emit_fn(void *ctx, const char *key, size_t len, uint32_t weight);
+
+/* A page of completions; see trie_complete_page(). */
+typedef struct {
+    const char *after;          /* Only the keys after this one, if not NULL. */
+    size_t offset;              /* Less the first `offset` of them. */
+    size_t limit;               /* At most this many, if non-zero. */
+} trie_page_t;
+
+typedef struct {
+    size_t keys;                /* Distinct keys in the trie. */
+    size_t nodes;
+    size_t nodes_allocated;
+    size_t edges;               /* Edge slots in use, free blocks included. */
+    size_t edges_allocated;
+    size_t text;                /* Bytes of edge text in radix mode. */
+    size_t text_allocated;
+    size_t node_size;           /* sizeof of a node, edges excluded. */
+    size_t bytes_used;
+    size_t bytes_allocated;
+    size_t grows;               /* Times a pool was reallocated to grow. */
+    bool radix;
+    bool minimized;             /* Subtrees are shared; see trie_minimize(). */
+    bool double_array;          /* Children are laid out by trie_freeze(). */
+    bool mapped;                /* Loaded from an image by trie_load(). */
+} trie_stats_t;
+
+/* Buckets of the histograms of trie_get_shape(). */
+#define TRIE_SHAPE_BUCKETS 64
+
+typedef struct {
+    /* Nodes by number of children, and by number of edges from the root. The
+     * last bucket of each counts the nodes of TRIE_SHAPE_BUCKETS - 1 or more.
+     */
+    size_t fanout[TRIE_SHAPE_BUCKETS];
+    size_t depth[TRIE_SHAPE_BUCKETS];
+} trie_shape_t;
+
+/*
+ * Returns a new trie holding no keys, or NULL on memory allocation failure.
+ * `flags` is zero or a combination of TRIE_RADIX and TRIE_HUGE_PAGES.
+ */
+trie_t *trie_create(unsigned flags);
+
+/*
+ * Returns a copy of `trie` that shares nothing with it, or NULL on memory
+ * allocation failure. The copy of a loaded trie is not mapped, and that of a
+ * minimized or frozen trie is still read-only. This is how an update is
+ * prepared while readers go on querying the original.
+ */
+trie_t *trie_clone(const trie_t *trie);
+
+/* Releases all memory held by `trie`. A null pointer is ignored. */
+void trie_destroy(trie_t *trie);
+
+/*
+ * Inserts `key`. Inserting a key again adds `weight` to its weight, saturating
+ * at UINT32_MAX. A trie loaded from an image is copied out of it first, once.
+ *
+ * Returns false on memory allocation failure, or if the trie is minimized or
+ * frozen, which makes it read-only.
+ */
+bool trie_insert(trie_t *trie, const char *key, uint32_t weight);
+
+/*
+ * Removes `key` and its weight. The nodes that no longer lead to any key are
+ * reclaimed, and reused by later insertions, so the cost is that of a lookup
+ * of the key, whatever the size of the trie. A key not in the trie is ignored.
+ * A trie loaded from an image is copied out of it first, once.
+ *
+ * Returns false on memory allocation failure, or if the trie is read-only.
+ */
+bool trie_remove(trie_t *trie, const char *key);
+
+/*
+ * Returns whether the `len` bytes at `key` are a key of `trie`, and if so, sets
+ * `*weight` to its weight, unless `weight` is NULL. The key may be of any
+ * length, and need not be nul-terminated. No cursor is needed, so any number
+ * of threads may look keys up at once, as long as nobody updates the trie.
+ */
+bool trie_lookup(const trie_t *trie, const char *key, size_t len, 
+                 uint32_t *weight);
+
+/*
+ * Inserts one key per line. A line may end with a weight, separated from the
+ * key by a tab; a line without one has a weight of 1. The weight column is
+ * split off the lines in place.
+ *
+ * If `jobs` is greater than one and the trie is empty, the lines are inserted
+ * by that many threads. The result answers every query exactly as a serial
+ * build would.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_insert_lines(trie_t *trie, char **lines, size_t nlines, size_t jobs);
+
+/*
+ * Splits the weight column off `line` in place, as trie_insert_lines() does,
+ * and returns the weight, which is 1 for a line without one.
+ */
+uint32_t trie_split_weight(char *line);
+
+/*
+ * Inserts one key per line of `stream`, as trie_insert_lines() does, without
+ * reading the whole stream first. Lines are inserted as they are scanned, one
+ * chunk at a time, so the memory needed on top of the trie is one chunk and
+ * the longest line. Lines holding a nul byte are skipped. If `nlines` is not
+ * NULL, it receives the number of lines inserted, and if `nskipped` is not
+ * NULL, the number of lines skipped.
+ *
+ * Returns false on memory allocation failure or on a read error.
+ */
+bool trie_insert_stream(trie_t *trie, FILE *stream, size_t *nlines, 
+                        size_t *nskipped);
+
+/*
+ * Applies the lines of `stream` as updates, in order, as trie_insert_stream()
+ * reads them: a line starting with '-' removes the rest of it, and a line
+ * starting with '+' inserts the rest of it. Any other line is inserted whole,
+ * so lines appended to a word list can be applied as they are. The weight
+ * column of a removal is ignored.
+ *
+ * Returns false on memory allocation failure, on a read error, or if the trie
+ * is read-only.
+ */
+bool trie_apply_delta(trie_t *trie, FILE *stream, size_t *nlines, 
+                      size_t *nskipped);
+
+/*
+ * Records the lines of `stream`, read as trie_apply_delta() reads them, as
+ * updates to another trie, without applying them to it: the keys they insert
+ * go to `adds`, with the weight they add, and the keys they remove go to
+ * `dels`, and out of `adds`. A key of the other trie is then a key of the
+ * updated one unless it is in `dels`, and every key of `adds` is a key of the
+ * updated one, of its weight in `adds` plus, unless it is in `dels`, that in
+ * the other trie, saturating at UINT32_MAX. Recording more lines in the same
+ * pair of tries composes the updates, so the cost of a delta is proportional
+ * to its size, whatever that of the other trie.
+ *
+ * Returns false on memory allocation failure, on a read error, or if either
+ * trie is read-only.
+ */
+bool trie_record_delta(trie_t *adds, trie_t *dels, FILE *stream, 
+                       size_t *nlines, size_t *nskipped);
+
+/*
+ * Builds a trie out of the lines of `stream`, which are read as
+ * trie_insert_stream() reads them, but whose keys must be in byte order, as
+ * `LC_ALL=C sort` sorts them unless they hold bytes below a tab or a carriage
+ * return. Repeated keys add up their weights. The trie is
+ * built in one pass, in time linear in the length of the lines: only the path
+ * to the last key is kept open, and every other node is final, and is written
+ * once, after its children, at the end of the pools. `flags` are those of
+ * trie_create(), and TRIE_MINIMIZE, which merges every node with an equivalent
+ * one as soon as it is final, for the trie trie_minimize() would turn it into,
+ * without ever holding the trie before it.
+ *
+ * If `path` is not NULL, the nodes are written to an image at `path` as they
+ * are final, and the trie is then mapped from it by trie_load(). Memory use is
+ * then that of the open path, and of the minimized trie with TRIE_MINIMIZE,
+ * however big the trie is.
+ *
+ * Returns NULL on memory allocation failure, on a read or write error, or if
+ * the lines are not sorted, in which case no image is left behind.
+ */
+trie_t *trie_build_sorted(FILE *stream, unsigned flags, const char *path,
+                          size_t *nlines, size_t *nskipped);
+
+/*
+ * Merges the equivalent subtrees of `trie`, turning it into the minimal
+ * acyclic automaton (DAWG) of its keys. Subtrees are equivalent if they hold
+ * the same keys with the same weights, so lookups and completions answer
+ * exactly as before, while word lists with many shared suffixes shrink
+ * several times over.
+ *
+ * Afterwards the trie is read-only. Returns false on memory allocation
+ * failure, in which case the trie is left as it was, or if it is read-only.
+ */
+bool trie_minimize(trie_t *trie);
+
+/*
+ * Renumbers the nodes of `trie`, and lays out their edges, so that a descent
+ * touches as few cache lines and pages as it can: the top levels of the trie,
+ * which every lookup goes through, breadth-first, and the subtrees below them
+ * depth-first. Lookups and completions answer exactly as before, and inserting
+ * afterwards is still allowed. Does nothing to a loaded or frozen trie; relay
+ * out before trie_freeze() and trie_save().
+ *
+ * Returns false on memory allocation failure, in which case the trie is left
+ * as it was.
+ */
+bool trie_relayout(trie_t *trie);
+
+/*
+ * Packs the children of all nodes of `trie` into a double array, in which
+ * following an edge takes an add and a compare instead of a search through
+ * the children of the node. Lookups and completions answer exactly as before,
+ * in about the same memory. The bytes the keys hold are renumbered densely
+ * first, so that the array has no room for bytes they do not. A loaded trie
+ * is copied out of its image first; saving a frozen trie writes an image that
+ * loads frozen.
+ *
+ * Afterwards the trie is read-only. Returns false on memory allocation
+ * failure, in which case the trie is left as it was.
+ */
+bool trie_freeze(trie_t *trie);
+
+/*
+ * Releases the memory the pools of `trie` hold beyond what the keys inserted so
+ * far use. Pools grow geometrically, so up to half of them can be slack after a
+ * build. Inserting afterwards is still allowed. Does nothing to a loaded trie.
+ */
+void trie_shrink_to_fit(trie_t *trie);
+
+/*
+ * Writes a binary image of `trie` to the file at `path`.
+ * Returns false on failure, in which case no file is left behind.
+ */
+bool trie_save(const trie_t *trie, const char *path);
+
+/*
+ * Maps the image at `path` written by trie_save(). Nothing is copied up front;
+ * lookups run on the mapped pages, which are read once to check that no index
+ * in them is out of bounds. The image must still come from a trusted writer:
+ * one that passes the check but was not written by trie_save() may answer
+ * queries wrongly, or without end. The first update copies the trie out of the
+ * image, unless it was saved minimized or frozen, which makes it read-only.
+ *
+ * Returns NULL if the file can not be mapped, is not a compatible image, or is
+ * corrupt.
+ */
+trie_t *trie_load(const char *path);
+
+/* Fills `stats` with the size and memory usage of `trie`. */
+void trie_get_stats(const trie_t *trie, trie_stats_t *stats);
+
+/*
+ * Fills `shape` with the fan-out and depth histograms of `trie`. This walks
+ * the whole trie; a node shared by a minimized trie is counted once, at the
+ * shallowest depth it is reached at.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_get_shape(const trie_t *trie, trie_shape_t *shape);
+
+/*
+ * Returns a cursor positioned at the root of `trie`, or NULL on memory
+ * allocation failure. The trie must outlive the cursor.
+ */
+trie_cursor_t *trie_cursor_create(const trie_t *trie);
+
+/*
+ * Positions `cur` at the root of `trie`, which may be another trie than the one
+ * it was created for, keeping the memory it holds. The trie must outlive the
+ * cursor, or the next call to this function.
+ */
+void trie_cursor_rebind(trie_cursor_t *cur, const trie_t *trie);
+
+/* Releases `cur`. A null pointer is ignored. */
+void trie_cursor_destroy(trie_cursor_t *cur);
+
+/*
+ * Positions `cur` at the subtree of the keys starting with `prefix`.
+ * The descent resumes from the deepest node the prefix shares with the
+ * previous position of the cursor, so looking up prefixes in sorted order is
+ * cheaper than looking them up at random, unless the trie was updated in
+ * between. A cursor must be positioned again after an update before it is
+ * used for anything else.
+ *
+ * Returns false if no key starts with `prefix`, or if it is longer than
+ * TRIE_PREFIX_MAX - 1 bytes. The cursor is then positioned nowhere, and
+ * trie_complete() yields nothing.
+ */
+bool trie_find_prefix(trie_cursor_t *cur, const char *prefix);
+
+/*
+ * Positions each of the `n` cursors at `curs` at the prefix of the same index
+ * in `prefixes`, as trie_find_prefix() would, and sets found[i], unless `found`
+ * is NULL, to what it would return. The cursors must be distinct, but may be
+ * on different tries.
+ *
+ * The lookups run TRIE_FIND_BATCH at a time, interleaved a step at a time, and
+ * each step prefetches what the next one of its lookup reads. The cache
+ * misses of a batch are thus waited for in parallel rather than one after the
+ * other, which makes a batch of lookups on a trie bigger than the caches
+ * several times cheaper than as many calls to trie_find_prefix().
+ */
+void trie_find_prefixes(trie_cursor_t *const *curs, const char *const *prefixes,
+                        size_t n, bool *found);
+
+/*
+ * Returns the number of nodes the last trie_find_prefix() on `cur` descended
+ * to. The nodes it resumed from, which the lookup before it descended to, are
+ * not counted again.
+ */
+size_t trie_cursor_visits(const trie_cursor_t *cur);
+
+/*
+ * Passes keys below the position of `cur` to `emit`. If `k` is zero, it passes
+ * all of them, in lexicographic order. Otherwise, it passes the `k` keys of
+ * highest weight, in decreasing order of weight and then in lexicographic
+ * order, and the work done is proportional to `k` rather than to the size of
+ * the subtree.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_complete(trie_cursor_t *cur, size_t k, trie_emit_fn *emit, void *ctx);
+
+/*
+ * Passes a page of the keys below the position of `cur` to `emit`, in
+ * lexicographic order: those after `page->after`, if it is not NULL, less the
+ * first `page->offset` of them, and at most `page->limit` of them, if it is
+ * not zero. Passing the last key of a page as the `after` of the next one
+ * resumes where it ended. Every node records how many keys are below it, so
+ * the page is found without enumerating the keys before it, in time
+ * proportional to the depth of the trie and its fan-out on the way.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_complete_page(trie_cursor_t *cur, const trie_page_t *page, 
+                        trie_emit_fn *emit, void *ctx);
+
+/*
+ * Writes the keys trie_complete_page() would pass to an emit function into
+ * the `size` bytes at `buf`, each followed by a newline, as long as they fit.
+ * Sets `*len` to the number of bytes written, and `*nkeys` to the number of
+ * keys. If the first key does not fit on its own, nothing is written, and
+ * `*len` is set to the number of bytes it needs instead. Passing the last key
+ * written as the `after` of the page resumes where the buffer filled up; a
+ * page is over when `*nkeys` is zero and so is `*len`.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_complete_buffer(trie_cursor_t *cur, const trie_page_t *page, 
+                          char *buf, size_t size, size_t *len, size_t *nkeys);
+
+/* Returns the number of keys below the position of `cur`, in constant time. */
+size_t trie_count_completions(const trie_cursor_t *cur);
+
+/*
+ * Passes the completions of every prefix within `max_edits` insertions,
+ * deletions and substitutions of `prefix` to `emit`: all of them in
+ * lexicographic order if `k` is zero, and otherwise the `k` of highest weight,
+ * as trie_complete() does. The search prunes every branch as soon as it can no
+ * longer come within `max_edits` of `prefix`, so its cost depends on the
+ * budget and on the length of the prefix rather than on the size of the trie.
+ * The position of `cur` is left as it was. A prefix longer than
+ * TRIE_PREFIX_MAX - 1 bytes has no completions.
+ *
+ * Returns false on memory allocation failure.
+ */
+bool trie_complete_fuzzy(trie_cursor_t *cur, const char *prefix, 
+                         size_t max_edits, size_t k, trie_emit_fn *emit, 
+                         void *ctx);
+
+/*
+ * Writes the subtree at the position of `cur` to `sink` as a Graphviz
+ * digraph. At the root, that is the whole trie.
+ *
+ * Returns false if the cursor is positioned nowhere or on a write error.
+ */
+bool trie_dump_dot(const trie_cursor_t *cur, FILE *sink);
+
+#endif                          /* TRIE_H */